@@ -1,7 +1,7 @@
 #!/bin/bash
 
 # List of directories with Makefiles
-DIRS=("shared" "packet_hunter" "daemon" "kernel_module")
+DIRS=("shared" "packet_hunter" "daemon" "benchmarks" "kernel_module")
 
 echo "Starting full clean..."
 
@@ -0,0 +1,78 @@
+#!/bin/bash
+
+# What sniffer.ko costs the network stack: floods loopback with build/benchmarks/loopback_flood
+# with the module unloaded, loaded with no subscribers, and loaded with the daemon and the packet hunter subscribed.
+# Run as root in a VM after build_all.sh (it loads and unloads the module). Arguments are passed to loopback_flood,
+# e.g. ./bash_scripts/hook_overhead.sh -P udp -s 64,1400 -d 10
+
+KERNEL_MODULE="build/kernel_module/sniffer.ko"
+FLOOD="build/benchmarks/loopback_flood"
+DAEMON="build/daemon/portmon_daemon"
+HUNTER="build/packet_hunter/packet_hunter"
+DAEMON_SERVICE="portmon_daemon"
+HOOK_LATENCY="/sys/kernel/debug/sniffer/hook_latency"
+
+# Move to the root of the project
+cd "$(dirname "$0")/.." || exit 1
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "Run as root, the module is loaded and unloaded"
+    exit 1
+fi
+for file in "$KERNEL_MODULE" "$FLOOD" "$DAEMON" "$HUNTER"; do
+    if [ ! -e "$file" ]; then
+        echo "$file is missing, run bash_scripts/build_all.sh first"
+        exit 1
+    fi
+done
+if systemctl is-active --quiet "$DAEMON_SERVICE" 2>/dev/null; then
+    echo "Stop $DAEMON_SERVICE first (systemctl stop $DAEMON_SERVICE), it would subscribe in every setup"
+    exit 1
+fi
+
+DAEMON_PID=""
+HUNTER_PID=""
+HISTORY_DIR=$(mktemp -d)
+
+# Stop the subscribers and unload the module, also on Ctrl+C
+function cleanup() {
+    [ -n "$HUNTER_PID" ] && kill -INT "$HUNTER_PID" 2>/dev/null && wait "$HUNTER_PID" 2>/dev/null
+    if [ -n "$DAEMON_PID" ] && kill "$DAEMON_PID" 2>/dev/null; then
+        while kill -0 "$DAEMON_PID" 2>/dev/null; do sleep 0.1; done # not our child, it daemonized
+    fi
+    HUNTER_PID=""
+    DAEMON_PID=""
+    lsmod | grep -q "^sniffer " && rmmod sniffer
+    rm -rf "$HISTORY_DIR"
+}
+trap cleanup EXIT
+
+# Print the module's own view of the hook, if debugfs is mounted
+function show_hook_latency() {
+    if [ -r "$HOOK_LATENCY" ]; then
+        echo "hook latency:"
+        head -n 4 "$HOOK_LATENCY" | sed 's/^/  /'
+    fi
+}
+
+echo "=== module unloaded ==="
+lsmod | grep -q "^sniffer " && rmmod sniffer
+"$FLOOD" "$@" || exit 1
+
+echo
+echo "=== module loaded, no subscribers ==="
+insmod "$KERNEL_MODULE" || exit 1
+"$FLOOD" "$@" || exit 1
+show_hook_latency
+
+echo
+echo "=== module loaded, daemon and packet hunter subscribed ==="
+rmmod sniffer && insmod "$KERNEL_MODULE" || exit 1 # fresh hook latency counters
+"$DAEMON" -j "$HISTORY_DIR" || exit 1
+sleep 1
+DAEMON_PID=$(pgrep -f -- "-j $HISTORY_DIR")
+"$HUNTER" < /dev/null > /dev/null 2>&1 &
+HUNTER_PID=$!
+sleep 1
+"$FLOOD" "$@" || exit 1
+show_hook_latency
@@ -0,0 +1,291 @@
+// Contention benchmark of the shared containers on the per packet path:
+//   queue: MessageQueue with P producers pushing batches and C consumers popping (the daemon has one
+//          producer, the loop, and one consumer, the resolver, more show how the single lock scales)
+//   map:   ThreadSafeUnorderedMap<uint16_t, PortMapping-sized value> with R reader and W writer threads,
+//          keys drawn uniformly or zipf-skewed (a few hot ports, like real traffic), over 1, 16 and 64 shards
+// Reports ops/s and per operation latency percentiles. Every 8th operation is timed, so the clock
+// reads dont dominate the cheap ones. For the queue the end to end latency (push -> pop) is reported too.
+// Usage: container_contention [-b queue|map|all] [-p producers] [-c consumers] [-B batch]
+//                             [-r readers] [-w writers] [-k uniform|zipf|all] [-s skew] [-d ms]
+#include "MessageQueue.h"
+#include "ThreadSafeUnorderedMap.h"
+#include "LatencyHistogram.h" // monotonicNs
+#include <unistd.h> // getopt
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+static constexpr unsigned TIME_EVERY = 8;       // time one operation in this many
+static constexpr size_t QUEUE_CAPACITY = 65536; // producers back off when its full, like a bounded daemon queue
+static constexpr size_t POP_BATCH = 256;        // consumers take up to this many at once, like the daemon's resolver
+static constexpr size_t KEY_COUNT = 65536;      // every port
+static constexpr size_t KEYS_PER_THREAD = 1 << 16; // pre-drawn keys each thread cycles through
+
+struct BenchOptions {
+    std::string bench = "all";
+    std::string keys = "all";
+    unsigned producers = 0; // 0 = sweep
+    unsigned consumers = 0;
+    unsigned batch = 16;    // records per pushBatch, a netlink drain hands over spans of this order
+    unsigned readers = 0;
+    unsigned writers = 0;
+    double skew = 1.0;      // zipf exponent
+    std::chrono::milliseconds duration{500};
+};
+
+// Per thread results, merged after the run
+struct ThreadResult {
+    uint64_t ops = 0;
+    std::vector<uint64_t> latencyNs;   // sampled operation latencies
+    std::vector<uint64_t> endToEndNs;  // queue only, push -> pop
+};
+
+// Value of the size the daemon stores per port
+struct MappingValue {
+    int32_t pid;
+    uint64_t inode;
+    char proto;
+};
+
+static void printUsage(const char* prog) {
+    std::fprintf(stderr,
+        "Usage: %s [-b queue|map|all] [-p producers] [-c consumers] [-B batch] [-r readers] [-w writers]\n"
+        "          [-k uniform|zipf|all] [-s skew] [-d ms]\n"
+        "  -b bench      which container to run (default all)\n"
+        "  -p / -c       queue producer / consumer threads (default: sweep 1,2,4 x 1,2)\n"
+        "  -B batch      records per push (default 16, 1 = push)\n"
+        "  -r / -w       map reader / writer threads (default: sweep)\n"
+        "  -k keys       map key distribution (default all)\n"
+        "  -s skew       zipf exponent (default 1.0)\n"
+        "  -d ms         duration of every run (default 500)\n",
+        prog);
+}
+
+static bool parseOptions(int argc, char* argv[], BenchOptions& options) {
+    int opt;
+    while ((opt = getopt(argc, argv, "b:p:c:B:r:w:k:s:d:h")) != -1) {
+        switch (opt) {
+        case 'b': options.bench = optarg; break;
+        case 'p': options.producers = std::atoi(optarg); break;
+        case 'c': options.consumers = std::atoi(optarg); break;
+        case 'B': options.batch = std::max(1, std::atoi(optarg)); break;
+        case 'r': options.readers = std::atoi(optarg); break;
+        case 'w': options.writers = std::atoi(optarg); break;
+        case 'k': options.keys = optarg; break;
+        case 's': options.skew = std::atof(optarg); break;
+        case 'd': options.duration = std::chrono::milliseconds(std::max(1, std::atoi(optarg))); break;
+        default:
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    bool benchOk = options.bench == "all" || options.bench == "queue" || options.bench == "map";
+    bool keysOk = options.keys == "all" || options.keys == "uniform" || options.keys == "zipf";
+    if (!benchOk || !keysOk) {
+        printUsage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t index = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+    return sorted[index];
+}
+
+// "p50/p99/p999" in microseconds
+static std::string formatPercentiles(std::vector<uint64_t>& samples) {
+    if (samples.empty()) return "-";
+    std::sort(samples.begin(), samples.end());
+    char text[64];
+    std::snprintf(text, sizeof(text), "%.2f/%.2f/%.2f", percentile(samples, 0.50) / 1e3,
+                  percentile(samples, 0.99) / 1e3, percentile(samples, 0.999) / 1e3);
+    return text;
+}
+
+// Start threads at once, stop them after duration, returns the seconds they ran
+template <typename Body>
+static double runThreads(unsigned count, std::chrono::milliseconds duration, std::vector<ThreadResult>& results, Body body,
+                         std::atomic<bool>& stop, const std::function<void()>& onStop = nullptr) {
+    std::atomic<bool> start{false};
+    std::vector<std::thread> threads;
+    results.assign(count, ThreadResult());
+    for (unsigned i = 0; i < count; i++) {
+        threads.emplace_back([&, i]() {
+            while (!start) std::this_thread::yield();
+            body(i, results[i]);
+        });
+    }
+
+    start = true;
+    auto begin = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    if (onStop) onStop();
+    for (std::thread& thread : threads) thread.join();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// One queue run: producers push batches (backing off while the queue is full), consumers pop batches
+static void runQueue(unsigned producers, unsigned consumers, unsigned batch, std::chrono::milliseconds duration) {
+    MessageQueue queue(QUEUE_CAPACITY);
+    std::atomic<bool> stop{false};
+    std::vector<ThreadResult> results;
+
+    double seconds = runThreads(producers + consumers, duration, results, [&](unsigned i, ThreadResult& result) {
+        if (i < producers) {
+            std::vector<pckt_info> records(batch);
+            for (unsigned j = 0; j < batch; j++) records[j].dst_port = static_cast<uint16_t>(i * batch + j);
+            uint64_t calls = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                bool timed = calls++ % TIME_EVERY == 0;
+                uint64_t before = timed ? monotonicNs() : 0;
+                size_t pushed = queue.pushBatch(records.data(), batch);
+                if (timed) result.latencyNs.push_back(monotonicNs() - before);
+                if (pushed < batch) std::this_thread::yield();// full, let the consumers catch up
+                result.ops += pushed;
+            }
+        } else {
+            std::vector<MessageQueue::Entry> popped;
+            while (queue.waitPopBatch(popped, POP_BATCH)) {// false once closed
+                uint64_t now = monotonicNs();
+                for (const MessageQueue::Entry& entry : popped) {
+                    if (++result.ops % TIME_EVERY == 0) result.endToEndNs.push_back(now - entry.enqueuedNs);
+                }
+            }
+        }
+    }, stop, [&queue]() { queue.close(); });
+
+    uint64_t pushed = 0, popped = 0;
+    std::vector<uint64_t> pushLatency, endToEnd;
+    for (unsigned i = 0; i < results.size(); i++) {
+        (i < producers ? pushed : popped) += results[i].ops;
+        pushLatency.insert(pushLatency.end(), results[i].latencyNs.begin(), results[i].latencyNs.end());
+        endToEnd.insert(endToEnd.end(), results[i].endToEndNs.begin(), results[i].endToEndNs.end());
+    }
+    std::printf("%9u %9u %6u %12.2f %12.2f %22s %22s\n", producers, consumers, batch, pushed / seconds / 1e6,
+                popped / seconds / 1e6, formatPercentiles(pushLatency).c_str(), formatPercentiles(endToEnd).c_str());
+}
+
+// Keys a thread cycles through, uniform over every port or zipf: port of rank k drawn with weight 1/k^skew
+static std::vector<uint16_t> drawKeys(bool zipf, double skew, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::vector<uint16_t> keys(KEYS_PER_THREAD);
+    if (!zipf) {
+        for (uint16_t& key : keys) key = static_cast<uint16_t>(rng());
+        return keys;
+    }
+
+    static std::vector<double> cdf;// shared by every thread, built once before they start
+    if (cdf.empty()) {
+        cdf.resize(KEY_COUNT);
+        double sum = 0;
+        for (size_t k = 0; k < KEY_COUNT; k++) cdf[k] = (sum += 1.0 / std::pow(double(k + 1), skew));
+        for (double& value : cdf) value /= sum;
+    }
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (uint16_t& key : keys) {
+        size_t rank = std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+        key = static_cast<uint16_t>(std::min(rank, KEY_COUNT - 1) * 40503u);// spread the hot ranks over the port range
+    }
+    return keys;
+}
+
+// One map run: readers call get, writers insertOrAssign, on keys of the given distribution
+static void runMap(size_t shards, unsigned readers, unsigned writers, bool zipf, double skew, std::chrono::milliseconds duration) {
+    ThreadSafeUnorderedMap<uint16_t, MappingValue> map(shards);
+    for (uint32_t port = 0; port < KEY_COUNT; port += 4) map.insertOrAssign(port, MappingValue{int32_t(port), port, 'T'});// a quarter mapped
+
+    std::vector<std::vector<uint16_t>> keys;
+    for (unsigned i = 0; i < readers + writers; i++) keys.push_back(drawKeys(zipf, skew, i + 1));
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> found{0};// keeps the lookups from being optimized away
+    std::vector<ThreadResult> results;
+    double seconds = runThreads(readers + writers, duration, results, [&](unsigned i, ThreadResult& result) {
+        const std::vector<uint16_t>& mine = keys[i];
+        bool writer = i >= readers;
+        uint64_t hits = 0;
+        size_t next = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+            for (unsigned j = 0; j < 64; j++, result.ops++) {// check the stop flag only now and then
+                uint16_t key = mine[next++ & (KEYS_PER_THREAD - 1)];
+                bool timed = result.ops % TIME_EVERY == 0;
+                uint64_t before = timed ? monotonicNs() : 0;
+                if (writer) {
+                    map.insertOrAssign(key, MappingValue{int32_t(result.ops), key, 'U'});
+                } else if (map.get(key)) {
+                    hits++;
+                }
+                if (timed) result.latencyNs.push_back(monotonicNs() - before);
+            }
+        }
+        found += hits;
+    }, stop);
+
+    uint64_t reads = 0, writes = 0;
+    std::vector<uint64_t> getLatency, insertLatency;
+    for (unsigned i = 0; i < results.size(); i++) {
+        bool writer = i >= readers;
+        (writer ? writes : reads) += results[i].ops;
+        std::vector<uint64_t>& samples = writer ? insertLatency : getLatency;
+        samples.insert(samples.end(), results[i].latencyNs.begin(), results[i].latencyNs.end());
+    }
+    std::printf("%8s %6zu %8u %8u %12.2f %12.2f %22s %22s\n", zipf ? "zipf" : "uniform", shards, readers, writers,
+                reads / seconds / 1e6, writes / seconds / 1e6, formatPercentiles(getLatency).c_str(),
+                formatPercentiles(insertLatency).c_str());
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options)) return 1;
+    unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+
+    if (options.bench != "map") {
+        std::printf("MessageQueue, %lld ms per run, latencies in us (p50/p99/p999)\n", static_cast<long long>(options.duration.count()));
+        std::printf("%9s %9s %6s %12s %12s %22s %22s\n", "producers", "consumers", "batch", "push Mrec/s", "pop Mrec/s",
+                    "pushBatch latency", "push->pop latency");
+        std::vector<unsigned> producerCounts = options.producers ? std::vector<unsigned>{options.producers} : std::vector<unsigned>{1, 2, 4};
+        std::vector<unsigned> consumerCounts = options.consumers ? std::vector<unsigned>{options.consumers} : std::vector<unsigned>{1, 2};
+        for (unsigned producers : producerCounts) {
+            for (unsigned consumers : consumerCounts) runQueue(producers, consumers, options.batch, options.duration);
+        }
+        std::printf("\n");
+    }
+
+    if (options.bench != "queue") {
+        std::printf("ThreadSafeUnorderedMap<uint16_t, %zu byte value>, %lld ms per run, latencies in us (p50/p99/p999)\n",
+                    sizeof(MappingValue), static_cast<long long>(options.duration.count()));
+        std::printf("%8s %6s %8s %8s %12s %12s %22s %22s\n", "keys", "shards", "readers", "writers", "get Mops/s",
+                    "insert Mops/s", "get latency", "insert latency");
+
+        // Default sweep: read mostly (like the daemon, the loop reads and the resolver writes), then write heavy
+        std::vector<std::pair<unsigned, unsigned>> mixes;
+        if (options.readers || options.writers) {
+            mixes.emplace_back(options.readers, options.writers);
+        } else {
+            mixes = {{1, 1}, {std::max(2u, cpus), 1}, {std::max(2u, cpus / 2), std::max(2u, cpus / 2)}};
+        }
+        std::vector<bool> distributions;
+        if (options.keys != "zipf") distributions.push_back(false);
+        if (options.keys != "uniform") distributions.push_back(true);
+
+        const size_t shardCounts[] = {1, 16, 64};
+        for (bool zipf : distributions) {
+            for (const auto& mix : mixes) {
+                for (size_t shards : shardCounts) runMap(shards, mix.first, mix.second, zipf, options.skew, options.duration);
+            }
+        }
+    }
+    return 0;
+}
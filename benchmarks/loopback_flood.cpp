@@ -0,0 +1,347 @@
+// Loopback flood for measuring what sniffer.ko costs the network stack: senders blast 127.0.0.1 with
+// UDP datagrams or TCP writes of fixed sizes, receivers drain them, and every run reports IPv4 packets
+// delivered per second and CPU cycles per packet over the whole machine (the hook runs in softirq,
+// on whichever cpu handles the packet, so per process counters would miss it).
+// Packets are counted from Ip InDelivers in /proc/net/snmp (TCP acks included, every one of them crosses the hook),
+// cycles with a system wide perf counter per cpu (needs root or perf_event_paranoid <= 0, "n/a" in VMs without a PMU)
+// and busy cpu time from /proc/stat, which works everywhere.
+//
+// bash_scripts/hook_overhead.sh runs it with the module unloaded, loaded idle and loaded with subscribers:
+//   loopback_flood -P udp -s 64,1400 -f 2 -d 5
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/perf_event.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <algorithm>
+
+struct FloodOptions {
+    bool udp = true;
+    bool tcp = true;
+    std::vector<unsigned> sizes{64, 512, 1400}; // payload bytes per datagram / write
+    unsigned flows = 1;                         // sender + receiver pairs
+    unsigned seconds = 5;
+};
+
+// What a run measured
+struct FloodResult {
+    uint64_t packets = 0;   // IPv4 packets delivered locally
+    uint64_t cycles = 0;    // 0 if the perf counters arent available
+    uint64_t busyNs = 0;    // cpu time spent outside idle, every cpu
+    double seconds = 0;
+};
+
+static constexpr unsigned UDP_BATCH = 32; // datagrams per sendmmsg
+
+static void printUsage(const char* prog) {
+    std::fprintf(stderr,
+        "Usage: %s [-P udp|tcp|all] [-s sizes] [-f flows] [-d seconds]\n"
+        "  -P proto    traffic to send (default all)\n"
+        "  -s sizes    comma separated payload sizes in bytes (default 64,512,1400)\n"
+        "  -f flows    concurrent sender/receiver pairs (default 1)\n"
+        "  -d seconds  duration of every run (default 5)\n",
+        prog);
+}
+
+static bool parseSizes(const char* arg, std::vector<unsigned>& sizes) {
+    sizes.clear();
+    std::stringstream in(arg);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        unsigned size = std::strtoul(item.c_str(), nullptr, 10);
+        if (size == 0 || size > 65000) return false;
+        sizes.push_back(size);
+    }
+    return !sizes.empty();
+}
+
+// Ip InDelivers, the packets the stack handed to a local protocol (after LOCAL_IN, where the hook sits)
+static uint64_t readIpDelivered() {
+    std::ifstream in("/proc/net/snmp");
+    std::string names, values;
+    while (std::getline(in, names)) {
+        if (names.compare(0, 3, "Ip:") != 0) continue;
+        std::getline(in, values);// the line after the names holds the values
+        std::stringstream n(names), v(values);
+        std::string name, value;
+        while (n >> name && v >> value) {
+            if (name == "InDelivers") return std::strtoull(value.c_str(), nullptr, 10);
+        }
+        break;
+    }
+    return 0;
+}
+
+// Non idle cpu time of every cpu from /proc/stat, in ns
+static uint64_t readBusyNs() {
+    std::ifstream in("/proc/stat");
+    std::string cpu;
+    uint64_t user, nice, system, idle, iowait, irq, softirq, steal;
+    if (!(in >> cpu >> user >> nice >> system >> idle >> iowait >> irq >> softirq >> steal)) return 0;
+    return (user + nice + system + irq + softirq + steal) * (1000000000ULL / sysconf(_SC_CLK_TCK));
+}
+
+// One cycle counter per cpu, counting everything that runs on it (user, kernel and softirq)
+class CycleCounters {
+public:
+    CycleCounters() {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long cpu = 0; cpu < cpus; cpu++) {
+            perf_event_attr attr{};
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            attr.disabled = 1;
+            int fd = syscall(SYS_perf_event_open, &attr, -1, cpu, -1, 0);
+            if (fd < 0) {// all or nothing, a partial sum would look like a cheaper run
+                closeAll();
+                return;
+            }
+            fds.push_back(fd);
+        }
+    }
+    ~CycleCounters() { closeAll(); }
+
+    bool available() const { return !fds.empty(); }
+
+    void start() {
+        for (int fd : fds) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    uint64_t stop() {
+        uint64_t total = 0;
+        for (int fd : fds) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t value = 0;
+            if (read(fd, &value, sizeof(value)) == sizeof(value)) total += value;
+        }
+        return total;
+    }
+
+private:
+    void closeAll() {
+        for (int fd : fds) close(fd);
+        fds.clear();
+    }
+
+    std::vector<int> fds;
+};
+
+// A socket on 127.0.0.1 with a kernel chosen port, bound and (for TCP) listening
+static int bindLoopback(int type, sockaddr_in& addr) {
+    int fd = socket(AF_INET, type | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    addr = sockaddr_in{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) < 0 ||
+        (type == SOCK_STREAM && listen(fd, 16) < 0)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Receivers block at most this long, so they notice the end of the run
+static void setReceiveTimeout(int fd) {
+    timeval timeout{0, 100000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+// Sender: sendmmsg batches of datagrams until stop. Receiver: recvmmsg until stop
+static void udpSender(int fd, const sockaddr_in& to, unsigned size, const std::atomic<bool>& stop) {
+    std::vector<char> payload(size, 'x');
+    iovec iov{payload.data(), size};
+    mmsghdr msgs[UDP_BATCH];
+    for (auto& msg : msgs) {
+        msg = mmsghdr{};
+        msg.msg_hdr.msg_name = const_cast<sockaddr_in*>(&to);
+        msg.msg_hdr.msg_namelen = sizeof(to);
+        msg.msg_hdr.msg_iov = &iov;
+        msg.msg_hdr.msg_iovlen = 1;
+    }
+    while (!stop.load(std::memory_order_relaxed)) {
+        sendmmsg(fd, msgs, UDP_BATCH, 0);// datagrams a full receive buffer drops still crossed the hook, and are counted
+    }
+}
+
+static void udpReceiver(int fd, unsigned size, const std::atomic<bool>& stop) {
+    std::vector<char> buffers(UDP_BATCH * size);
+    iovec iovs[UDP_BATCH];
+    mmsghdr msgs[UDP_BATCH];
+    for (unsigned i = 0; i < UDP_BATCH; i++) {
+        iovs[i] = iovec{buffers.data() + i * size, size};
+        msgs[i] = mmsghdr{};
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    while (!stop.load(std::memory_order_relaxed)) {
+        recvmmsg(fd, msgs, UDP_BATCH, 0, nullptr);
+    }
+}
+
+// Sender: one write of size bytes at a time (TCP_NODELAY, so small writes arent merged into one segment)
+static void tcpSender(int fd, unsigned size, const std::atomic<bool>& stop) {
+    std::vector<char> payload(size, 'x');
+    while (!stop.load(std::memory_order_relaxed)) {
+        if (send(fd, payload.data(), size, MSG_NOSIGNAL) < 0 && errno != EINTR && errno != EAGAIN) break;
+    }
+}
+
+static void tcpReceiver(int fd, const std::atomic<bool>& stop) {
+    char buffer[64 * 1024];
+    while (!stop.load(std::memory_order_relaxed)) {
+        if (recv(fd, buffer, sizeof(buffer), 0) == 0) break;
+    }
+}
+
+// Run the flows for the configured time and measure the whole machine meanwhile
+static bool runFlood(bool tcp, unsigned size, const FloodOptions& options, CycleCounters& counters, FloodResult& result) {
+    std::vector<int> fds;
+    std::vector<std::thread> threads;
+    std::atomic<bool> stop{false};
+    auto closeAll = [&fds] { for (int fd : fds) close(fd); };
+
+    // Sockets first, so setting up isnt measured
+    std::vector<std::pair<int, int>> pairs; // sender, receiver
+    std::vector<sockaddr_in> targets;
+    for (unsigned i = 0; i < options.flows; i++) {
+        sockaddr_in addr;
+        int receiver = bindLoopback(tcp ? SOCK_STREAM : SOCK_DGRAM, addr);
+        if (receiver < 0) {
+            perror("bind");
+            closeAll();
+            return false;
+        }
+        fds.push_back(receiver);
+        int sender = socket(AF_INET, (tcp ? SOCK_STREAM : SOCK_DGRAM) | SOCK_CLOEXEC, 0);
+        if (sender < 0) {
+            perror("socket");
+            closeAll();
+            return false;
+        }
+        fds.push_back(sender);
+
+        if (tcp) {
+            int one = 1;
+            setsockopt(sender, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            if (connect(sender, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+                perror("connect");
+                closeAll();
+                return false;
+            }
+            int accepted = accept4(receiver, nullptr, nullptr, SOCK_CLOEXEC);
+            if (accepted < 0) {
+                perror("accept");
+                closeAll();
+                return false;
+            }
+            fds.push_back(accepted);
+            receiver = accepted;
+        }
+        setReceiveTimeout(receiver);
+        pairs.emplace_back(sender, receiver);
+        targets.push_back(addr);
+    }
+
+    uint64_t packetsBefore = readIpDelivered();
+    uint64_t busyBefore = readBusyNs();
+    counters.start();
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned i = 0; i < options.flows; i++) {
+        int sender = pairs[i].first, receiver = pairs[i].second;
+        if (tcp) {
+            threads.emplace_back(tcpReceiver, receiver, std::cref(stop));
+            threads.emplace_back(tcpSender, sender, size, std::cref(stop));
+        } else {
+            threads.emplace_back(udpReceiver, receiver, size, std::cref(stop));
+            threads.emplace_back(udpSender, sender, std::cref(targets[i]), size, std::cref(stop));
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+    stop = true;
+    for (unsigned i = 0; i < options.flows; i++) shutdown(pairs[i].first, SHUT_RDWR);// unblocks a sender stuck on a full socket
+    for (auto& thread : threads) thread.join();
+
+    result.cycles = counters.stop();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.busyNs = readBusyNs() - busyBefore;
+    result.packets = readIpDelivered() - packetsBefore;
+    closeAll();
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    FloodOptions options;
+    int opt;
+    while ((opt = getopt(argc, argv, "P:s:f:d:h")) != -1) {
+        switch (opt) {
+        case 'P':
+            options.udp = std::strcmp(optarg, "tcp") != 0;
+            options.tcp = std::strcmp(optarg, "udp") != 0;
+            if (std::strcmp(optarg, "udp") && std::strcmp(optarg, "tcp") && std::strcmp(optarg, "all")) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's':
+            if (!parseSizes(optarg, options.sizes)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'f':
+            options.flows = std::max(1, std::atoi(optarg));
+            break;
+        case 'd':
+            options.seconds = std::max(1, std::atoi(optarg));
+            break;
+        default:
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    CycleCounters counters;
+    if (!counters.available()) {
+        std::fprintf(stderr, "perf cycle counters unavailable (not root, perf_event_paranoid or no PMU), reporting cpu time only\n");
+    }
+
+    std::printf("%-5s %7s %6s %12s %12s %12s\n", "proto", "size", "flows", "pkt/s", "cycles/pkt", "cpu ns/pkt");
+    for (int tcp = 0; tcp < 2; tcp++) {
+        if ((tcp && !options.tcp) || (!tcp && !options.udp)) continue;
+        for (unsigned size : options.sizes) {
+            FloodResult result;
+            if (!runFlood(tcp, size, options, counters, result)) return 1;
+            char cycles[32] = "n/a";
+            if (counters.available() && result.packets) {
+                std::snprintf(cycles, sizeof(cycles), "%.0f", double(result.cycles) / result.packets);
+            }
+            std::printf("%-5s %6uB %6u %12.0f %12s %12.0f\n", tcp ? "tcp" : "udp", size, options.flows,
+                        result.packets / result.seconds, cycles,
+                        result.packets ? double(result.busyNs) / result.packets : 0.0);
+            std::fflush(stdout);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+// Contention benchmark of ThreadSafeUnorderedMap: 1..N threads doing lookups and updates on port keys,
+// with one shard (every writer behind one lock, like the map used to be) and with more shards.
+// Usage: map_contention [max threads] [write percent] [milliseconds per run]
+#include "ThreadSafeUnorderedMap.h"
+#include <sys/types.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+// Ops per second of threadCount threads hammering a map with shardCount shards
+static double runBenchmark(size_t shardCount, unsigned threadCount, unsigned writePercent, std::chrono::milliseconds duration) {
+    ThreadSafeUnorderedMap<uint16_t, pid_t> map(shardCount);
+    for (uint32_t port = 0; port < 65536; port += 4) map.insertOrAssign(port, static_cast<pid_t>(port));// a quarter of the ports mapped
+
+    std::atomic<bool> start{false};
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> totalOps{0};
+    std::atomic<uint64_t> totalFound{0};// keeps the lookups from being optimized away
+    std::vector<std::thread> threads;
+
+    for (unsigned i = 0; i < threadCount; i++) {
+        threads.emplace_back([&, i]() {
+            std::mt19937 rng(i + 1);
+            uint64_t ops = 0;
+            uint64_t found = 0;
+            while (!start) std::this_thread::yield();
+
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (int batch = 0; batch < 256; batch++, ops++) {// check the stop flag only now and then
+                    uint32_t random = rng();
+                    uint16_t port = static_cast<uint16_t>(random);
+                    if ((random >> 16) % 100 < writePercent) {
+                        map.insertOrAssign(port, static_cast<pid_t>(random >> 16));
+                    } else if (map.get(port)) {
+                        found++;
+                    }
+                }
+            }
+            totalOps += ops;
+            totalFound += found;
+        });
+    }
+
+    start = true;
+    auto begin = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    for (std::thread& thread : threads) thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    return totalOps / seconds;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned maxThreads = (argc > 1) ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+    unsigned writePercent = (argc > 2) ? std::atoi(argv[2]) : 10;
+    std::chrono::milliseconds duration((argc > 3) ? std::atoi(argv[3]) : 500);
+    if (maxThreads == 0) maxThreads = 1;
+
+    const size_t shardCounts[] = {1, 16, 64};
+
+    std::printf("ThreadSafeUnorderedMap<uint16_t, pid_t>, %u%% writes, %lld ms per run (Mops/s)\n",
+                writePercent, static_cast<long long>(duration.count()));
+    std::printf("%8s", "threads");
+    for (size_t shards : shardCounts) std::printf("  %6zu shard%s", shards, shards == 1 ? " " : "s");
+    std::printf("\n");
+
+    for (unsigned threads = 1; threads <= maxThreads;) {
+        std::printf("%8u", threads);
+        for (size_t shards : shardCounts) {
+            std::printf("  %13.2f", runBenchmark(shards, threads, writePercent, duration) / 1e6);
+        }
+        std::printf("\n");
+        if (threads == maxThreads) break;
+        threads = std::min(threads * 2, maxThreads);// doubles, always ending with maxThreads
+    }
+    return 0;
+}
@@ -0,0 +1,248 @@
+// Load test of the daemon's query path: many connections asking for ports at a fixed total rate,
+// a chosen share of them mapped (hits) and the rest not (misses). Reports throughput and latency percentiles.
+// Latency is measured from when a query was due, not when it was sent, so a daemon that falls behind
+// shows up in the tail instead of quietly lowering the rate.
+//
+// Runs against a daemon serving a synthetic table, no kernel module needed:
+//   query_load -T /tmp/ports.txt -g 20000                 # write a table of 20000 ports
+//   portmon_daemon -t /tmp/ports.txt -u /tmp/hk.sock      # serve it
+//   query_load -T /tmp/ports.txt -u /tmp/hk.sock -c 64 -r 50000 -H 90 -d 10
+#include "UnixSocketConfig.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+struct LoadOptions {
+    std::string socketPath = SOCKET_FILE_ADRESS;
+    std::string tablePath;       // ports the daemon serves, the hits are picked from it
+    unsigned generatePorts = 0;  // write a table of this many ports to tablePath and exit
+    unsigned connections = 16;
+    unsigned rate = 10000;       // queries per second over all connections, 0 = as fast as each connection can
+    unsigned hitPercent = 90;
+    unsigned seconds = 5;
+    bool framed = false;         // PidByPort requests instead of the bare port ones
+};
+
+// Per connection results
+struct ConnectionResult {
+    std::vector<uint64_t> latencyNs;
+    uint64_t errors = 0;      // wrong answer or broken connection
+    bool connected = false;
+};
+
+static void printUsage(const char* prog) {
+    std::fprintf(stderr,
+        "Usage: %s -T table [-g ports] [-u socket] [-c connections] [-r rate] [-H hit%%] [-d seconds] [-F]\n"
+        "  -T table        port table the daemon serves (portmon_daemon -t)\n"
+        "  -g ports        write a table with this many ports to -T and exit\n"
+        "  -u socket       daemon socket (default %s)\n"
+        "  -c connections  concurrent connections (default 16)\n"
+        "  -r rate         total queries per second, 0 = as fast as possible (default 10000)\n"
+        "  -H percent      share of queries for mapped ports (default 90)\n"
+        "  -d seconds      duration (default 5)\n"
+        "  -F              framed PidByPort requests instead of bare ports\n",
+        prog, SOCKET_FILE_ADRESS);
+}
+
+// Table of count ports spread over the port range, every other one TCP, with made up pids
+static bool writeTable(const std::string& path, unsigned count) {
+    std::ofstream out(path);
+    if (!out) return false;
+    out << "# synthetic port table, port pid proto\n";
+    unsigned step = std::max(1u, 65000 / std::max(count, 1u));
+    for (unsigned i = 0; i < count && 1 + i * step <= UINT16_MAX; i++) {
+        out << 1 + i * step << ' ' << 1000 + i << ' ' << (i % 2 ? 'U' : 'T') << '\n';
+    }
+    return static_cast<bool>(out);
+}
+
+// Port -> pid of the table, pid 0 for ports it doesnt have
+static bool readTable(const std::string& path, std::vector<pid_t>& pids) {
+    std::ifstream in(path);
+    if (!in) return false;
+    pids.assign(65536, 0);
+    std::string line;
+    while (std::getline(in, line)) {
+        unsigned port;
+        int pid;
+        if (line.empty() || line[0] == '#' || std::sscanf(line.c_str(), "%u %d", &port, &pid) != 2 || port > UINT16_MAX) continue;
+        pids[port] = pid;
+    }
+    return true;
+}
+
+static int connectTo(const std::string& path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool sendAll(int fd, const void* data, size_t len) {
+    const char* bytes = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t res = send(fd, bytes, len, MSG_NOSIGNAL);
+        if (res <= 0) return false;
+        bytes += res;
+        len -= res;
+    }
+    return true;
+}
+
+static bool recvAll(int fd, void* data, size_t len) {
+    char* bytes = static_cast<char*>(data);
+    while (len > 0) {
+        ssize_t res = recv(fd, bytes, len, 0);
+        if (res <= 0) return false;
+        bytes += res;
+        len -= res;
+    }
+    return true;
+}
+
+// One query, false if the connection broke. pid is the answer (-1 if the daemon doesnt know the port)
+static bool query(int fd, uint16_t port, bool framed, pid_t& pid) {
+    if (!framed) {
+        return sendAll(fd, &port, sizeof(port)) && recvAll(fd, &pid, sizeof(pid));
+    }
+    DaemonRequest request;
+    request.type = DaemonRequestType::PidByPort;
+    request.port = port;
+    DaemonReplyHeader header;
+    ProcessInfo info;
+    if (!sendAll(fd, &request, sizeof(request)) || !recvAll(fd, &header, sizeof(header))) return false;
+    if (header.length != 0 && (header.length != sizeof(info) || !recvAll(fd, &info, sizeof(info)))) return false;
+    pid = header.length ? info.pid : -1;
+    return true;
+}
+
+// One connection: a query every interval (or back to back), until the deadline
+static void runConnection(const LoadOptions& options, const std::vector<uint16_t>& hits, const std::vector<uint16_t>& misses,
+                          const std::vector<pid_t>& table, unsigned index, std::chrono::steady_clock::time_point start,
+                          std::chrono::steady_clock::time_point end, ConnectionResult& result) {
+    int fd = connectTo(options.socketPath);
+    if (fd < 0) return;
+    result.connected = true;
+
+    std::mt19937 rng(index + 1);
+    std::chrono::nanoseconds interval(options.rate ? 1000000000ULL * options.connections / options.rate : 0);
+    // Spread the connections over the first interval so they dont all fire together
+    auto due = start + interval * index / options.connections;
+
+    while (due < end) {
+        if (interval.count()) std::this_thread::sleep_until(due);
+        else due = std::chrono::steady_clock::now();
+
+        bool hit = misses.empty() || (!hits.empty() && rng() % 100 < options.hitPercent);
+        uint16_t port = hit ? hits[rng() % hits.size()] : misses[rng() % misses.size()];
+
+        pid_t pid;
+        if (!query(fd, port, options.framed, pid)) {
+            result.errors++;
+            break;
+        }
+        auto answered = std::chrono::steady_clock::now();
+        result.latencyNs.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(answered - due).count());
+        if (pid != (hit ? table[port] : -1)) result.errors++;
+
+        due += interval;
+    }
+    close(fd);
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t index = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+    return sorted[index];
+}
+
+int main(int argc, char* argv[]) {
+    LoadOptions options;
+    int opt;
+    while ((opt = getopt(argc, argv, "T:g:u:c:r:H:d:Fh")) != -1) {
+        switch (opt) {
+        case 'T': options.tablePath = optarg; break;
+        case 'g': options.generatePorts = std::atoi(optarg); break;
+        case 'u': options.socketPath = optarg; break;
+        case 'c': options.connections = std::max(1, std::atoi(optarg)); break;
+        case 'r': options.rate = std::atoi(optarg); break;
+        case 'H': options.hitPercent = std::min(100, std::atoi(optarg)); break;
+        case 'd': options.seconds = std::max(1, std::atoi(optarg)); break;
+        case 'F': options.framed = true; break;
+        default:
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.tablePath.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (options.generatePorts) {
+        if (!writeTable(options.tablePath, options.generatePorts)) {
+            std::perror(options.tablePath.c_str());
+            return 1;
+        }
+        return 0;
+    }
+
+    // Hits are ports in the table, misses are ports it doesnt have
+    std::vector<pid_t> table;
+    if (!readTable(options.tablePath, table)) {
+        std::perror(options.tablePath.c_str());
+        return 1;
+    }
+    std::vector<uint16_t> hits, misses;
+    for (uint32_t port = 1; port <= UINT16_MAX; port++) (table[port] ? hits : misses).push_back(static_cast<uint16_t>(port));
+    if (hits.empty()) options.hitPercent = 0;
+
+    std::vector<ConnectionResult> results(options.connections);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);// time to start the threads
+    auto end = start + std::chrono::seconds(options.seconds);
+    for (unsigned i = 0; i < options.connections; i++) {
+        threads.emplace_back(runConnection, std::cref(options), std::cref(hits), std::cref(misses), std::cref(table),
+                             i, start, end, std::ref(results[i]));
+    }
+    for (std::thread& thread : threads) thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<uint64_t> latency;
+    uint64_t errors = 0;
+    unsigned connected = 0;
+    for (ConnectionResult& result : results) {
+        latency.insert(latency.end(), result.latencyNs.begin(), result.latencyNs.end());
+        errors += result.errors;
+        connected += result.connected;
+    }
+    if (connected == 0) {
+        std::fprintf(stderr, "Couldn't connect to %s\n", options.socketPath.c_str());
+        return 1;
+    }
+    std::sort(latency.begin(), latency.end());
+
+    std::printf("connections %u/%u, %s requests, target %u q/s, %u%% hits\n", connected, options.connections,
+                options.framed ? "framed" : "bare", options.rate, options.hitPercent);
+    std::printf("queries %zu in %.2fs: %.0f q/s, %llu errors\n", latency.size(), seconds, latency.size() / seconds,
+                static_cast<unsigned long long>(errors));
+    std::printf("latency us: p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n", percentile(latency, 0.50) / 1000.0,
+                percentile(latency, 0.99) / 1000.0, percentile(latency, 0.999) / 1000.0,
+                latency.empty() ? 0.0 : latency.back() / 1000.0);
+    return errors ? 2 : 0;
+}
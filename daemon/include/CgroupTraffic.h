@@ -0,0 +1,57 @@
+#pragma once
+
+#include "UnixSocketConfig.h" // CgroupTrafficEntry
+#include "PortToPidMap.h"     // owner of each packets port
+#include "ProcessInfoCache.h" // cgroup of the owner
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <memory>
+
+// Packets and bytes per cgroup (and so per container), for the CgroupTraffic request.
+// Each packet is attributed through the pid that owns its destination port, the pid -> cgroup
+// answer is remembered for a second so a busy flow doesnt hit the process cache on every packet.
+// Packets of ports that arent mapped yet are counted as unattributed. Only used on the loop thread.
+class CgroupTraffic {
+public:
+    CgroupTraffic(std::shared_ptr<const PortToPidMap> portPidMap, ProcessInfoCache& processCache);
+
+    CgroupTraffic(const CgroupTraffic&) = delete;
+    CgroupTraffic& operator=(const CgroupTraffic&) = delete;
+
+    // Count a packet on the cgroup of its ports owner
+    void onPacket(const pckt_info* pckt);
+
+    // Forget the pid -> cgroup answers that werent used for a while (exited processes)
+    void prune(std::chrono::steady_clock::time_point now);
+
+    // Totals of every cgroup, most bytes first
+    std::vector<CgroupTrafficEntry> snapshot() const;
+
+private:
+    static constexpr size_t MAX_CGROUPS = 1024; // past this, packets of new cgroups count as unattributed
+    static constexpr auto PID_MAX_AGE = std::chrono::seconds(1);    // pid -> cgroup trusted this long
+    static constexpr auto PID_IDLE_TIMEOUT = std::chrono::minutes(1); // pruned after this without packets
+
+    struct Totals {
+        std::string container;
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+    };
+
+    // The cgroup a pid was in, checkedAt is when it was looked up in the process cache
+    struct PidCgroup {
+        Totals* totals;
+        std::chrono::steady_clock::time_point checkedAt;
+        std::chrono::steady_clock::time_point lastSeen;
+    };
+
+    // Totals of the cgroup pid is in, unattributed if the process is gone or too many cgroups are tracked
+    Totals& totalsFor(pid_t pid, std::chrono::steady_clock::time_point now);
+
+    std::shared_ptr<const PortToPidMap> portPidMap;
+    ProcessInfoCache& processCache;
+    std::unordered_map<std::string, Totals> totals; // by cgroup path, "" is unattributed (nodes dont move, PidCgroup points into it)
+    std::unordered_map<pid_t, PidCgroup> pidCgroups;
+};
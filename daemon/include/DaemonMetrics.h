@@ -0,0 +1,26 @@
+#pragma once
+
+#include "UnixSocketConfig.h" // DaemonStats, LatencyStage
+#include "LatencyHistogram.h"
+#include <atomic>
+
+// Counters the daemon keeps for the Stats request. Each stage records from the thread that handles it
+// (the loop or the resolver), the histograms are atomic so the loop can read them any time
+struct DaemonMetrics {
+    LatencyHistogram latency[LATENCY_STAGE_COUNT];
+
+    // Overload state, written by OverloadControl on the loop
+    std::atomic<uint32_t> overloadLevel{OVERLOAD_NORMAL};
+    std::atomic<uint32_t> queueDepth{0};
+    std::atomic<uint64_t> shedPackets{0};
+    std::atomic<uint64_t> droppedPackets{0};
+
+    // Copy everything into the reply
+    void fill(DaemonStats& stats) const {
+        for (size_t i = 0; i < LATENCY_STAGE_COUNT; i++) stats.latency[i] = latency[i].snapshot();
+        stats.overloadLevel = overloadLevel.load(std::memory_order_relaxed);
+        stats.queueDepth = queueDepth.load(std::memory_order_relaxed);
+        stats.shedPackets = shedPackets.load(std::memory_order_relaxed);
+        stats.droppedPackets = droppedPackets.load(std::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "UnixSocketConfig.h" // SOCKET_FILE_ADRESS
+#include "MappingJournal.h"   // MAPPING_HISTORY_DIR
+#include <string>
+
+// Command line options of the daemon, the defaults are what systemd runs
+struct DaemonOptions {
+    std::string socketPath = SOCKET_FILE_ADRESS; // -u, where clients connect
+    std::string portTablePath;                   // -t, serve this fixed "port pid [T|U]" table instead of the system's
+                                                 //     (load tests: no kernel module, no /proc scan, no snapshot)
+    std::string historyDir = MAPPING_HISTORY_DIR; // -j, where the mapping history segments are kept
+    bool verbose = false;                        // -v, log every client query
+};
+
+// Parse the command line into options, prints usage and returns false on bad arguments
+bool parseDaemonOptions(int argc, char* argv[], DaemonOptions& options);
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "UnixSocketConfig.h" // MappingHistoryEntry, MappingHistoryQuery
+#include "ScanFiles.h"        // PortMapping
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <functional>
+#include <cstdint>
+
+// Where the daemon keeps its mapping history (next to the snapshot, systemd creates the parent with StateDirectory=)
+#define MAPPING_HISTORY_DIR "/var/lib/hut_karish/history"
+
+// Append-only journal of port -> pid changes (assign, reassign, evict), so the owner of a port can be
+// asked for any time in the past, e.g. for packets the hunter reported with pid -1.
+// The journal is split into one segment file per hour, named after the hour it starts at, so a query
+// only opens the segments its range touches. Each segment starts with a checkpoint of every mapping in
+// effect when it was opened, a point-in-time lookup replays a single segment.
+// Changes are recorded from any thread and written to disk by flush (a loop timer). Queries are started on the
+// loop and read the segments on the journals own query thread, so a week long range doesnt stall the loop.
+class MappingJournal {
+public:
+    // Opens the history dir, the latest segment is read back so changes continue from the last known state
+    explicit MappingJournal(const std::string& dir = MAPPING_HISTORY_DIR);
+
+    // Writes whatever is still pending
+    ~MappingJournal();
+
+    MappingJournal(const MappingJournal&) = delete;
+    MappingJournal& operator=(const MappingJournal&) = delete;
+
+    // Record the owner a scan found for port (nothing if the journal already has the same one)
+    void recordMapping(uint16_t port, const PortMapping& mapping);
+
+    // Record the whole current table after a full scan, ports missing from it are evicted
+    void recordTable(const std::unordered_map<uint16_t, PortMapping>& table);
+
+    // Append the pending changes to their segments, drop segments past the retention. False on a write error
+    bool flush();
+
+    // Called on the query thread with the entries of a query and whether some were left out (past MAX_QUERY_ENTRIES)
+    using QueryCallback = std::function<void(std::vector<MappingHistoryEntry> entries, bool truncated)>;
+
+    // Answer a MappingHistory request for port (0 = every port) with at most MAX_QUERY_ENTRIES entries.
+    // Flushes first (on the calling thread, the loop), so changes recorded a moment ago are seen,
+    // then the segments are read on the query thread and done is called there
+    void queryAsync(uint16_t port, const MappingHistoryQuery& range, QueryCallback done);
+
+    // Drop the queries not started yet and wait for the running one, before whatever their callbacks use goes away
+    void stopQueries();
+
+private:
+    static constexpr uint64_t SEGMENT_SECONDS = 3600;       // one segment per hour
+    static constexpr size_t MAX_SEGMENTS = 24 * 7;          // a week, older segments are deleted
+    // Keeps a reply to a huge range bounded, 768KB stays under what the server queues for a client (1MB)
+    static constexpr size_t MAX_QUERY_ENTRIES = 32 * 1024;
+
+    // Segment file layout: a header, checkpointCount InEffect entries, then the changes in the order they happened
+    struct SegmentHeader {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t entrySize;
+        uint64_t startSeconds;    // CLOCK_REALTIME seconds of the hour the segment covers
+        uint32_t checkpointCount;
+        uint32_t pad;
+    };
+
+    // Queue a change and apply it to the recorded state, mtx held
+    void recordLocked(uint16_t port, const PortMapping* mapping, uint64_t nowNs);
+
+    // Close the open segment and start the one for startSeconds with a checkpoint of writtenState
+    bool openSegment(uint64_t startSeconds);
+
+    // Delete the oldest segments past MAX_SEGMENTS
+    void dropOldSegments();
+
+    // Replay the segments of a query, runs on the query thread (segmentList is a copy, the loop may drop segments meanwhile)
+    std::vector<MappingHistoryEntry> readHistory(uint16_t port, const MappingHistoryQuery& range,
+                                                 const std::vector<uint64_t>& segmentList, bool& truncated) const;
+
+    // Run the queued queries until stopQueries
+    void queryLoop();
+
+    // Read a segment, false if its missing or not a segment
+    bool readSegment(uint64_t startSeconds, std::vector<MappingHistoryEntry>& entries, uint32_t& checkpointCount) const;
+
+    std::string segmentPath(uint64_t startSeconds) const;
+
+    std::string dir;
+
+    std::mutex mtx; // protects the two fields below, recorders run on the resolver and reconcile threads
+    std::unordered_map<uint16_t, MappingHistoryEntry> recordedState; // state after every recorded change
+    std::vector<MappingHistoryEntry> pending;                         // recorded, not written yet
+
+    // Only touched by flush and query (the loop thread)
+    std::unordered_map<uint16_t, MappingHistoryEntry> writtenState; // state after every written change, the next checkpoint
+    std::vector<uint64_t> segments; // start of every segment on disk, oldest first (the index queries use)
+    int segmentFd = -1;
+    uint64_t segmentStart = 0;
+
+    // Queries waiting for the query thread (started by the first query)
+    std::thread queryThread;
+    std::mutex queryMtx;
+    std::condition_variable queryCv;
+    std::deque<std::function<void()>> queryJobs;
+    bool stopping = false;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "UserSpaceConfig.h"  // MessageQueuePtr
+#include "PortToPidMap.h"     // packets of mapped ports can be skipped
+#include "DaemonMetrics.h"    // overload level and counters for the Stats request
+#include <functional>
+#include <unordered_set>
+#include <vector>
+#include <chrono>
+#include <memory>
+
+// Sheds resolver work while the resolver cant keep up with the kernel, instead of letting the queue
+// grow and rescanning /proc for packets that are already stale.
+// Every update looks at the queue depth and the age of its oldest packet: past the high water mark
+// the level goes up one stage (each stage adds to the ones before, see OverloadLevel), once both are
+// below the low water mark for a while it goes back down one stage at a time.
+// Shedding only affects what is queued for the resolver, subscribers and cgroup totals still see
+// every packet the kernel sends. Only used on the loop thread.
+class OverloadControl {
+public:
+    // Asks the kernel module to send the daemon 1 in rate packets (1 = all)
+    using KernelSampleFunc = std::function<bool(unsigned rate)>;
+
+    OverloadControl(MessageQueuePtr messageQueue, std::shared_ptr<const PortToPidMap> portPidMap,
+                    DaemonMetrics& metrics, KernelSampleFunc setKernelSample);
+
+    OverloadControl(const OverloadControl&) = delete;
+    OverloadControl& operator=(const OverloadControl&) = delete;
+
+    // Queue the packets of one netlink drain that the current level keeps, count the rest
+    void queuePackets(const pckt_info* records, size_t count);
+
+    // Move the level from the current queue depth and wait, called from a loop timer
+    void update(std::chrono::steady_clock::time_point now);
+
+    OverloadLevel level() const;
+
+private:
+    static constexpr size_t HIGH_WATER_DEPTH = 8192;  // queued packets
+    static constexpr size_t LOW_WATER_DEPTH = 1024;
+    static constexpr auto HIGH_WATER_WAIT = std::chrono::milliseconds(500); // age of the oldest queued packet
+    static constexpr auto LOW_WATER_WAIT = std::chrono::milliseconds(50);
+    static constexpr auto STEP_UP_INTERVAL = std::chrono::milliseconds(500); // a stage gets this long to help before the next one
+    static constexpr auto RECOVER_HOLD = std::chrono::seconds(2);            // below the low water mark this long to step down
+    static constexpr unsigned KERNEL_SAMPLE_RATE = 10;
+
+    void setLevel(OverloadLevel newLevel, std::chrono::steady_clock::time_point now);
+
+    MessageQueuePtr messageQueue;
+    std::shared_ptr<const PortToPidMap> portPidMap;
+    DaemonMetrics& metrics;
+    KernelSampleFunc setKernelSample;
+
+    OverloadLevel current = OVERLOAD_NORMAL;
+    std::chrono::steady_clock::time_point levelSince;
+    std::chrono::steady_clock::time_point calmSince; // first update below the low water mark, epoch while above it
+    std::vector<pckt_info> kept;           // reused for every drain
+    std::unordered_set<uint32_t> drainKeys; // (proto << 16) | port queued in this drain
+};
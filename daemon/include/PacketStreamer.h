@@ -0,0 +1,92 @@
+#pragma once
+
+#include "UnixSocketServer.h" // subscribers are clients of the server
+#include "PortToPidMap.h"     // to annotate packets with their pid
+#include "ProcessInfoCache.h" // comm for subscribers that asked for metadata
+#include "EventLoop.h"
+#include "DaemonMetrics.h"    // delivery latency
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+// Streams the packets the daemon receives to subscribed clients, already joined with the pid of their
+// destination port, so clients dont need their own kernel subscription or a round trip per packet.
+// A packet whose port isnt mapped yet is held (in order with later packets of that port) until the
+// resolver thread maps the port or HOLD_TIMEOUT passes, then it is sent with whatever pid is known.
+// Everything but notifyResolved runs on the event loop thread.
+class PacketStreamer {
+public:
+    PacketStreamer(EventLoop& loop, UnixSocketServer& server, std::shared_ptr<const PortToPidMap> portPidMap, ProcessInfoCache& processCache, DaemonMetrics& metrics);
+    ~PacketStreamer();
+
+    PacketStreamer(const PacketStreamer&) = delete;
+    PacketStreamer& operator=(const PacketStreamer&) = delete;
+
+    // Start streaming to a client (flags of its SubscribePackets request), acks the request
+    void addSubscriber(int clientFd, uint16_t flags);
+
+    // Stop streaming to a client (it disconnected)
+    void removeSubscriber(int clientFd);
+
+    bool hasSubscribers() const;
+
+    // Annotate a packet from the kernel, held if its port isnt mapped yet
+    void onPacket(const pckt_info* pckt);
+
+    // Send the packets annotated so far to every subscriber, one frame each
+    void flush();
+
+    // Called by the resolver thread after it tried to map port, releases the packets held for it
+    void notifyResolved(uint16_t port);
+
+private:
+    static constexpr auto HOLD_TIMEOUT = std::chrono::milliseconds(200); // longest a packet waits for its pid
+    static constexpr auto HOLD_CHECK_INTERVAL = std::chrono::milliseconds(20);
+    static constexpr size_t MAX_HELD_PACKETS = 4096; // the oldest is sent unresolved past this
+    static constexpr size_t MAX_BATCH_PACKETS = 1024; // flushed early past this, keeps frames small
+    static constexpr auto COMM_MAX_AGE = std::chrono::milliseconds(1000); // per packet comm lookups trust the cache this long
+
+    struct HeldPacket {
+        AnnotatedPacket record;
+        std::chrono::steady_clock::time_point deadline;
+        uint64_t seq;   // arrival order over every port, matches the packets heldOrder entry
+    };
+
+    // Add a record to the outgoing batch, with its comm if a subscriber wants it.
+    // Never sends (sending can close a subscriber, and the last one leaving clears held), callers flush when done
+    void emit(AnnotatedPacket& record);
+
+    // Pop the heldOrder entries of packets already released, so the front is the oldest held packet
+    void skipReleased();
+
+    // Rebuild heldOrder from the packets still held, drops every released entry
+    void compactHeldOrder();
+
+    // Send the held packets of port, with the pid the map has now
+    void releasePort(uint16_t port);
+
+    // Send the held packets past their deadline unresolved
+    void releaseExpired();
+
+    // Start / stop the timer that checks deadlines, it only runs while packets are held
+    void updateHoldTimer();
+
+    EventLoop& loop;
+    UnixSocketServer& server;
+    std::shared_ptr<const PortToPidMap> portPidMap;
+    ProcessInfoCache& processCache;
+    DaemonMetrics& metrics;
+
+    std::unordered_map<int, uint16_t> subscribers; // client fd -> request flags
+    size_t metadataSubscribers;                    // how many asked for comm
+    std::vector<AnnotatedPacket> batch;            // annotated, not sent yet
+    std::unordered_map<uint16_t, std::deque<HeldPacket>> held; // per port, waiting for it to be mapped, oldest first
+    std::deque<std::pair<uint16_t, uint64_t>> heldOrder;       // (port, seq) of held packets oldest first, released ones are skipped lazily
+    size_t heldTotal;                              // packets in held
+    uint64_t nextSeq;
+    std::atomic<size_t> heldCount;                 // heldTotal, read by the resolver thread
+    int holdTimer;                                 // -1 while nothing is held
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "ScanFiles.h" // PortMapping
+#include <unordered_map>
+#include <string>
+#include <cstdint>
+
+// Where the daemon keeps its port to pid table between runs (systemd creates the dir with StateDirectory=)
+#define PORT_MAP_SNAPSHOT_PATH "/var/lib/hut_karish/portmap.snapshot"
+
+// Saves the port to pid table to a small binary file and loads it back on startup, so a restarted
+// daemon can answer right away instead of waiting for the full /proc scan.
+// An entry is only loaded if it is still true: same boot, the pid is still the same process
+// (start time matches) and the socket inode is still bound to the port.
+namespace PortMapSnapshot {
+    // Write the table to path (through a synced temp file and rename, a crash never leaves half a snapshot).
+    // Reads /proc/<pid>/stat of every entry, the daemon calls it off the loop
+    bool save(const std::string& path, const std::unordered_map<uint16_t, PortMapping>& map);
+
+    // Load the entries that are still valid into an empty map, returns how many were loaded (0 if the file is missing, old or from another boot)
+    size_t load(const std::string& path, std::unordered_map<uint16_t, PortMapping>& map);
+
+    // Load a synthetic table for load tests, a text file of "port pid [T|U]" lines (# starts a comment).
+    // Nothing is checked against the system, false if the file cant be read or has a bad line
+    bool loadTable(const std::string& path, std::unordered_map<uint16_t, PortMapping>& map);
+}
@@ -3,24 +3,86 @@
 #include <stdint.h>// int types 
 #include <sys/types.h>       
 #include <unordered_map>
+#include <unordered_set>
 #include <mutex>
-#include <shared_mutex>// mutex that allows multyple reads at once (not really needed here but pretty nice)
+#include <condition_variable>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
 #include "ScanFiles.h"// To search the files for port, pid
+#include "PortMapSnapshot.h"// To restore the map after a restart
+#include "MappingJournal.h"// history of the mappings
+#include "ThreadSafeUnorderedMap.h"// sharded, so lookups from the loop dont wait for the resolver
 #include <iostream>
 
 class PortToPidMap{
 public:
     
-    // ctor initilizes the db  with existing port to pid relations using ScanFiles
-    PortToPidMap();
+    // ctor initilizes the db from the snapshot if it has valid entries (and reconciles with ScanFiles in the background),
+    // otherwise with a full ScanFiles scan like on a first start. Every change is recorded in the journal if there is one
+    explicit PortToPidMap(const std::string& snapshotPath = PORT_MAP_SNAPSHOT_PATH, std::shared_ptr<MappingJournal> journal = nullptr);
+
+    // ctor for load tests, serves a fixed table (no scan, no snapshot)
+    explicit PortToPidMap(const std::unordered_map<uint16_t, PortMapping>& table);
+
+    // Waits for the background reconcile and snapshot save if they are still running
+    ~PortToPidMap();
+
+    PortToPidMap(const PortToPidMap&) = delete;
+    PortToPidMap& operator=(const PortToPidMap&) = delete;
     
     // Adds new port to pid mapping to map, return false if cant find pid for port
     bool addPidMapping(uint16_t port, char protocol);
 
+    // Same for a batch of (port, protocol) pairs with a single scan, returns the ports that were mapped
+    std::vector<uint16_t> addPidMappings(const portProtoVec& ports);
+
     // Tries to get the pid that listens to the port from the map, return -1 if not found
     pid_t getPid(uint16_t port) const;
 
+    // Save the map to the snapshot file if it changed since the last save (nothing to do for a fixed table)
+    bool saveSnapshot();
+
+    // Same on the save thread, only the copy of the map is taken here (the periodic save on the loop).
+    // A save still queued is replaced by the newer copy
+    void saveSnapshotAsync();
+
 private:
-    mutable std::shared_mutex mtx;// mutable allows const methods to lock, shared mutex allows multiple readers
-    std::unordered_map<uint16_t, pid_t> map;
+    // Full scan in the background after a warm start, replaces the snapshot entries with what the system has now
+    void reconcile();
+
+    // Store a mapping a scan found, recorded for the reconcile if its running
+    void storeMapping(uint16_t port, const PortMapping& mapping);
+
+    // Write table (the map at changes == version) unless that version is saved already
+    bool writeSnapshot(uint64_t version, const std::unordered_map<uint16_t, PortMapping>& table);
+
+    // Runs the queued saves until the dtor
+    void saveLoop();
+
+    ThreadSafeUnorderedMap<uint16_t, PortMapping> map;
+
+    std::string snapshotPath;         // empty for a fixed table
+    std::shared_ptr<MappingJournal> journal; // null for a fixed table
+    std::atomic<uint64_t> changes{0}; // bumped on every change, so saveSnapshot can skip an unchanged map
+    std::atomic<uint64_t> savedChanges{0}; // changes of the last saved map, written under writeMtx
+    std::mutex writeMtx;              // one save writes the file at a time (the save thread and the final save on exit)
+
+    struct SaveJob {
+        uint64_t version;
+        std::unordered_map<uint16_t, PortMapping> table;
+    };
+    std::thread saveThread;           // started by the first saveSnapshotAsync
+    std::mutex saveMtx;               // protects the fields below
+    std::condition_variable saveCv;
+    std::unique_ptr<SaveJob> queuedSave;
+    uint64_t queuedChanges = 0;       // version of the last queued save
+    bool saveStopping = false;
+    std::thread reconcileThread;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> reconciling{false};
+    std::mutex reconcileMtx;                     // only taken while reconciling, protects touchedPorts
+    std::unordered_set<uint16_t> touchedPorts;   // ports addPidMapping updated while the reconcile scan ran
 };
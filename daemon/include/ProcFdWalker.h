@@ -0,0 +1,68 @@
+#pragma once
+
+#include <sys/types.h>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// Finds the processes that own socket inodes by walking /proc/[pid]/fd.
+// Every lookup works relative to directory fds (openat/getdents64/readlinkat) into stack buffers,
+// so no path string is built per fd. The pids are split between a pool of worker threads that
+// grab them in small chunks, and the walk stops as soon as every requested inode was found.
+class ProcFdWalker {
+public:
+    // Starts the worker threads (0 = one per cpu, up to MAX_WORKERS)
+    explicit ProcFdWalker(unsigned workers = 0);
+    ~ProcFdWalker();
+
+    ProcFdWalker(const ProcFdWalker&) = delete;
+    ProcFdWalker& operator=(const ProcFdWalker&) = delete;
+
+    // Returns inode -> owning pid for every inode that was found (missing inodes arent in the result)
+    std::unordered_map<uint64_t, pid_t> findOwners(const std::vector<uint64_t>& inodes);
+
+    // Single inode lookup, -1 if no process owns it
+    pid_t findOwner(uint64_t inode);
+
+private:
+    static constexpr unsigned MAX_WORKERS = 8;
+    static constexpr size_t PIDS_PER_CHUNK = 16; // pids a worker takes from the shared list at once
+
+    // State of the walk currently running, shared by the caller and the workers
+    struct Job {
+        std::vector<pid_t> pids;             // every process in /proc
+        std::vector<uint64_t> targets;       // sorted, looked up with binary search
+        std::atomic<size_t> nextPid{0};      // next index in pids to hand out
+        std::atomic<bool> done{false};       // every target found, stop walking
+        std::mutex resultMtx;
+        std::unordered_map<uint64_t, pid_t> results;
+    };
+
+    // Worker thread, waits for a job and helps walking it
+    void workerThread();
+
+    // Walk chunks of pids until the job runs out of pids or is done
+    void walk(Job& job);
+
+    // Check every fd of one process, returns false if the job is done
+    bool walkProcess(Job& job, pid_t pid, char* linkBuf, char* direntBuf);
+
+    // List the numeric entries of /proc
+    void listPids(std::vector<pid_t>& pids) const;
+
+    int procFd; // /proc directory fd every lookup is relative to
+
+    std::vector<std::thread> workers;
+    std::mutex jobMtx;              // serializes findOwners callers
+    std::mutex poolMtx;             // protects the fields below
+    std::condition_variable jobReady;
+    std::condition_variable jobFinished;
+    Job* currentJob;
+    uint64_t generation;            // bumped for every job so workers run each job once
+    unsigned busyWorkers;
+    bool stopping;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "UnixSocketConfig.h" // ProcessInfo
+#include <sys/types.h>
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <chrono>
+
+// LRU cache of per process metadata (comm, exe, uid, cgroup, container id) so clients dont read /proc themselves.
+// Entries are keyed by pid and checked against the process start time on every hit, a pid that was
+// reused by a new process or a process that exited is never served from the cache.
+// Only used from the event loop thread, so it has no lock.
+class ProcessInfoCache {
+public:
+    explicit ProcessInfoCache(size_t capacity = 1024);
+
+    // Fill info for pid from the cache or /proc, false if the process doesnt exist anymore.
+    // An entry checked less than maxAge ago is trusted without reading /proc again (for per packet lookups)
+    bool lookup(pid_t pid, ProcessInfo& info, std::chrono::milliseconds maxAge = std::chrono::milliseconds(0));
+
+    // Drop the entries of processes that exited, returns how many were dropped
+    size_t expireExited();
+
+    size_t size() const;
+
+private:
+    // Read the metadata of a running process from /proc, false if it exited
+    static bool readProcessInfo(pid_t pid, uint64_t startTime, ProcessInfo& info);
+
+    struct Entry {
+        ProcessInfo info;
+        std::chrono::steady_clock::time_point checkedAt; // last time the start time was compared
+    };
+
+    size_t capacity;
+    std::list<Entry> entries; // most recently used first
+    std::unordered_map<pid_t, std::list<Entry>::iterator> index;
+};
@@ -1,11 +1,25 @@
 #pragma once
 
 #include <unordered_map> // for initilize the port-pid map
+#include <vector>
+#include <utility>
 #include <sys/types.h>
 #include <cstdint>
 #include <memory>// for shared vars (multiple threads)
 #include <syslog.h> // added for syslog
 
+// A port's owner, with the socket that ties them (used to validate the mapping later)
+struct PortMapping {
+    pid_t pid = -1;
+    uint64_t inode = 0; // socket inode
+    char proto = 0;     // 'T' or 'U'
+};
+
+// (socket inode, port) pairs from /proc/net/tcp or udp
+using sockInodePortVec = std::vector<std::pair<uint64_t, uint16_t>>;
+
+// (port, protocol) pairs to look up together
+using portProtoVec = std::vector<std::pair<uint16_t, char>>;
 
 // Functions use to scan the system files, to find the PID of the process that is using a specific port
 // well do that by first, find the inode of the socket using that port and then find the PID of the process using that inode
@@ -13,9 +27,19 @@
 // go over all of every process socket and check if its port matches the one we are looking for
 namespace ScanFiles {
     // Full scan on startup
-    void initializePortPidMap(std::unordered_map<uint16_t, pid_t>& map);
+    void initializePortPidMap(std::unordered_map<uint16_t, PortMapping>& map);
+
+    // Find port linked pid if its not already in the map (pid -1 if not found)
+    PortMapping scanForPidByPort(uint16_t port, char packetProtocol);
+
+    // Same for many ports at once: each protocol file is parsed once and all the inodes are found in one walk.
+    // Returns port -> mapping for the ports that were found (if a port is asked for both protocols tcp wins, like on startup)
+    std::unordered_map<uint16_t, PortMapping> scanForPidsByPorts(const portProtoVec& ports);
 
-    // Find port linked pid if its not already in the map
-    pid_t scanForPidByPort(uint16_t port, char packetProtocol);
+    // Sockets of a protocol ('T' or 'U'), only the ones bound to filterPort if its not 0
+    sockInodePortVec listSockets(char protocol, uint16_t filterPort = 0);
 
+    // Start time of a process in clock ticks since boot (field 22 of /proc/[pid]/stat), 0 if it doesnt exist.
+    // Together with the pid it identifies a process even after the pid is reused
+    uint64_t getProcessStartTime(pid_t pid);
 }
@@ -1,45 +1,81 @@
 #pragma once
 
 #include "UnixSocketConfig.h"  // needed headers and the socket file path
+#include "EventLoop.h" // clients are served from the daemon's event loop
 #include <syslog.h> // added for syslog
+#include <functional>
+#include <unordered_map>
 
 // Thought about making this singleton, but my solution with shared pointers is easier to manage with multythreading
-// Used to communicate with the packet_hunters, receive port and send pid from the map
+// Used to communicate with the packet_hunters, receive port and send pid from the map.
+// All sockets are non blocking and watched by the event loop, so any number of clients
+// can be connected at once without a thread per client.
 class UnixSocketServer {
 public:
-    // ctor takes the path to the socket file
-    UnixSocketServer();
+    // Called on the loop thread for every request a client sends (old bare port requests come as RawPidByPort).
+    // payload holds the requestPayloadLength(request.type) bytes that followed the request (nullptr if none)
+    using RequestHandler = std::function<void(int clientFd, const DaemonRequest& request, const char* payload)>;
+
+    // Called on the loop thread when a client is closed, for whoever keeps state per client
+    using DisconnectHandler = std::function<void(int clientFd)>;
+
+    // ctor creates the listening socket
+    explicit UnixSocketServer(const std::string& path = SOCKET_FILE_ADRESS);
     ~UnixSocketServer();
 
-    // Starts the server 
+    // Starts the server
     bool start();
 
-    // Stops the server from listening for new clients(closes client/server fds, unlinks socket path)
-    void stopListeningForNewClients();
+    // Watch the listening socket and every client on the loop, onRequest answers the requests
+    bool attach(EventLoop& loop, RequestHandler onRequest);
+
+    // Set the handler called whenever a client is closed (before its fd is reused)
+    void setDisconnectHandler(DisconnectHandler handler);
 
-    // Send a message to the connected client
-    bool sendPid(pid_t pid) const;
+    // Send a pid to the client (queued if the clients socket is full), the reply to a RawPidByPort request
+    bool sendPid(int clientFd, pid_t pid);
 
-    // Receive a message from a connected client
-    bool receivePort(uint16_t& port) const;
+    // Send a framed reply, a header and length bytes of payload
+    bool sendReply(int clientFd, DaemonRequestType type, ReplyStatus status, const void* payload, uint32_t length);
 
-    // Wait for client connection and connect
-    bool connectToClient();
+    // Disconnect a single client
+    void closeClient(int clientFd);
 
     // Returns the servers fd
     int getServerFd() const;
 
-    // Closes the socket
+    // Number of connected clients
+    size_t getClientCount() const;
+
+    // Closes every client and the socket, unlinks the socket path
     void closeSocket();
 
-    // Disconnects client to allow new client 
-    void closeClientFd();
+private:
+    // Bytes received but not yet parsed, and replies the socket didnt take yet
+    struct Client {
+        std::string inBuf;
+        std::string outBuf;
+    };
+
+    // Most bytes queued for a client that stopped reading before it is disconnected
+    static constexpr size_t MAX_PENDING_OUTPUT = 1024 * 1024;
 
-    int getClientFd() const;
+    // Accept every pending connection and watch it on the loop
+    void acceptClients();
+
+    // Read requests or flush replies for a client the loop reported ready
+    void handleClientEvents(int clientFd, uint32_t events);
+
+    // Write as much as possible now, keep the rest until the socket is writable
+    bool sendToClient(int clientFd, const void* data, size_t len);
+
+    // Write queued replies, stop watching for EPOLLOUT once they are all sent
+    void flushClient(int clientFd);
 
-private:
     std::string socketPath;  // Path to the unix socket file
-    int serverFd; 
-    int clientFd;
-    bool isShuttingDown; // Simple flag to prevent extra loggin when shutting down
+    int serverFd;
+    EventLoop* loop;         // set by attach
+    RequestHandler onRequest;
+    DisconnectHandler onDisconnect;
+    std::unordered_map<int, Client> clients;
 };
@@ -0,0 +1,69 @@
+#include "CgroupTraffic.h"
+#include <algorithm> // sort, min
+#include <cstring>   // memset
+
+CgroupTraffic::CgroupTraffic(std::shared_ptr<const PortToPidMap> portPidMap, ProcessInfoCache& processCache)
+    : portPidMap(std::move(portPidMap)), processCache(processCache) {
+    totals[""];// unattributed, always reported
+}
+
+// Count a packet on the cgroup of its ports owner
+void CgroupTraffic::onPacket(const pckt_info* pckt) {
+    pid_t pid = portPidMap->getPid(pckt->dst_port);
+    Totals& cgroup = pid == -1 ? totals[""] : totalsFor(pid, std::chrono::steady_clock::now());
+    cgroup.packets += pckt_weight(pckt);// a sampled record stands for several packets
+    cgroup.bytes += uint64_t(pckt->payload_size) * pckt_weight(pckt);
+}
+
+// Totals of the cgroup pid is in, unattributed if the process is gone or too many cgroups are tracked
+CgroupTraffic::Totals& CgroupTraffic::totalsFor(pid_t pid, std::chrono::steady_clock::time_point now) {
+    auto it = pidCgroups.find(pid);
+    if (it != pidCgroups.end() && now - it->second.checkedAt < PID_MAX_AGE) {
+        it->second.lastSeen = now;
+        return *it->second.totals;
+    }
+
+    // The process cache checks the start time, so a reused pid gets its new cgroup.
+    // A pid that exited (the map still has it until the port is scanned again) is unattributed for a while too
+    Totals* cgroup = &totals[""];
+    ProcessInfo info;
+    if (processCache.lookup(pid, info, std::chrono::duration_cast<std::chrono::milliseconds>(PID_MAX_AGE))) {
+        auto cgroupIt = totals.find(info.cgroup);
+        if (cgroupIt == totals.end() && totals.size() <= MAX_CGROUPS) {
+            cgroupIt = totals.emplace(info.cgroup, Totals{info.container, 0, 0}).first;
+        }
+        if (cgroupIt != totals.end()) cgroup = &cgroupIt->second;
+    }
+    pidCgroups[pid] = PidCgroup{cgroup, now, now};
+    return *cgroup;
+}
+
+// Forget the pid -> cgroup answers that werent used for a while (the cgroup totals stay)
+void CgroupTraffic::prune(std::chrono::steady_clock::time_point now) {
+    for (auto it = pidCgroups.begin(); it != pidCgroups.end();) {
+        if (now - it->second.lastSeen > PID_IDLE_TIMEOUT) {
+            it = pidCgroups.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Totals of every cgroup, most bytes first
+std::vector<CgroupTrafficEntry> CgroupTraffic::snapshot() const {
+    std::vector<CgroupTrafficEntry> entries;
+    entries.reserve(totals.size());
+    for (const auto& pair : totals) {
+        CgroupTrafficEntry entry;
+        std::memset(&entry, 0, sizeof(entry));
+        pair.first.copy(entry.cgroup, std::min(pair.first.size(), sizeof(entry.cgroup) - 1));
+        pair.second.container.copy(entry.container, std::min(pair.second.container.size(), sizeof(entry.container) - 1));
+        entry.packets = pair.second.packets;
+        entry.bytes = pair.second.bytes;
+        entries.push_back(entry);
+    }
+    std::sort(entries.begin(), entries.end(), [](const CgroupTrafficEntry& a, const CgroupTrafficEntry& b) {
+        return a.bytes > b.bytes;
+    });
+    return entries;
+}
@@ -0,0 +1,37 @@
+#include "DaemonOptions.h"
+#include <unistd.h> // getopt
+#include <iostream>
+
+// Print the supported flags (to the terminal, the daemon only logs to syslog once it runs)
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [-u socket] [-t table] [-j dir] [-v]\n"
+              << "  -u socket  unix socket clients connect to (default " << SOCKET_FILE_ADRESS << ")\n"
+              << "  -t table   serve a fixed table of \"port pid [T|U]\" lines, without the kernel module (load tests)\n"
+              << "  -j dir     keep the port mapping history in dir (default " << MAPPING_HISTORY_DIR << ")\n"
+              << "  -v         log every client query (LOG_DEBUG)\n";
+}
+
+// Parse the command line into options, prints usage and returns false on bad arguments
+bool parseDaemonOptions(int argc, char* argv[], DaemonOptions& options) {
+    int opt;
+    while ((opt = getopt(argc, argv, "u:t:j:vh")) != -1) {
+        switch (opt) {
+        case 'u':
+            options.socketPath = optarg;
+            break;
+        case 't':
+            options.portTablePath = optarg;
+            break;
+        case 'j':
+            options.historyDir = optarg;
+            break;
+        case 'v':
+            options.verbose = true;
+            break;
+        default:
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
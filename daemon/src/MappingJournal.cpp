@@ -0,0 +1,352 @@
+#include "MappingJournal.h"
+#include <algorithm>  // sort, upper_bound
+#include <cerrno>
+#include <cstring>    // strerror
+#include <cstdio>     // snprintf, sscanf
+#include <ctime>      // clock_gettime
+#include <fcntl.h>    // open
+#include <unistd.h>   // write, close, ftruncate
+#include <dirent.h>   // opendir
+#include <sys/stat.h> // mkdir
+#include <syslog.h>
+
+static constexpr uint32_t JOURNAL_MAGIC = 0x484B4A4E;// "HKJN"
+static constexpr uint16_t JOURNAL_VERSION = 1;
+static constexpr uint64_t NS_PER_SEC = 1000000000ULL;
+
+// Wall clock, queries ask about times people know (14:03), not about uptime
+static uint64_t realtimeNs() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return uint64_t(ts.tv_sec) * NS_PER_SEC + ts.tv_nsec;
+}
+
+// Write exactly len bytes
+static bool writeAll(int fd, const void* data, size_t len) {
+    const char* bytes = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t res = write(fd, bytes, len);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) return false;
+        bytes += res;
+        len -= res;
+    }
+    return true;
+}
+
+// Create dir if its missing, with its parent (only those two levels, like the snapshot dir)
+static void createDir(const std::string& dir) {
+    std::size_t slash = dir.rfind('/');
+    if (slash != std::string::npos && slash != 0) mkdir(dir.substr(0, slash).c_str(), 0755);
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        syslog(LOG_WARNING, "Failed to create history dir %s: %s", dir.c_str(), strerror(errno));
+    }
+}
+
+// Opens the history dir and continues from the state the latest segment ends with
+MappingJournal::MappingJournal(const std::string& dir) : dir(dir) {
+    createDir(dir);
+
+    // The segment names are the index, "<start seconds>.seg"
+    if (DIR* dirStream = opendir(dir.c_str())) {
+        while (dirent* entry = readdir(dirStream)) {
+            unsigned long long start;
+            char suffix[8];
+            if (std::sscanf(entry->d_name, "%llu.%7s", &start, suffix) == 2 && std::strcmp(suffix, "seg") == 0) {
+                segments.push_back(start);
+            }
+        }
+        closedir(dirStream);
+    }
+    std::sort(segments.begin(), segments.end());
+    if (segments.empty()) return;
+
+    // Replay the latest segment, its checkpoint and changes are the state the daemon stopped with
+    std::vector<MappingHistoryEntry> entries;
+    uint32_t checkpointCount;
+    uint64_t latest = segments.back();
+    if (!readSegment(latest, entries, checkpointCount)) return;
+    for (const MappingHistoryEntry& entry : entries) {
+        if (entry.change == MappingChange::Evict) {
+            writtenState.erase(entry.port);
+        } else {
+            writtenState[entry.port] = entry;
+        }
+    }
+    recordedState = writtenState;
+    syslog(LOG_INFO, "Mapping history: %zu segments, %zu ports mapped at the last change", segments.size(), writtenState.size());
+
+    // Keep appending to it if its still the current hour, cutting a change a crash left half written
+    if (latest == realtimeNs() / NS_PER_SEC / SEGMENT_SECONDS * SEGMENT_SECONDS) {
+        segmentFd = open(segmentPath(latest).c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (segmentFd >= 0) {
+            if (ftruncate(segmentFd, sizeof(SegmentHeader) + entries.size() * sizeof(MappingHistoryEntry)) < 0) {
+                syslog(LOG_WARNING, "Failed to trim history segment: %s", strerror(errno));
+            }
+            segmentStart = latest;
+        }
+    }
+}
+
+// Writes whatever is still pending, queries not started yet are dropped
+MappingJournal::~MappingJournal() {
+    stopQueries();
+    flush();
+    if (segmentFd >= 0) close(segmentFd);
+}
+
+// Record the owner a scan found for port
+void MappingJournal::recordMapping(uint16_t port, const PortMapping& mapping) {
+    std::lock_guard<std::mutex> lock(mtx);
+    recordLocked(port, &mapping, realtimeNs());
+}
+
+// Record the whole current table after a full scan, ports missing from it are evicted
+void MappingJournal::recordTable(const std::unordered_map<uint16_t, PortMapping>& table) {
+    std::lock_guard<std::mutex> lock(mtx);
+    uint64_t now = realtimeNs();
+    for (const auto& pair : table) recordLocked(pair.first, &pair.second, now);
+
+    std::vector<uint16_t> gone;
+    for (const auto& pair : recordedState) {
+        if (!table.count(pair.first)) gone.push_back(pair.first);
+    }
+    for (uint16_t port : gone) recordLocked(port, nullptr, now);
+}
+
+// Queue a change (mapping nullptr evicts the port), nothing if it wouldnt change the state
+void MappingJournal::recordLocked(uint16_t port, const PortMapping* mapping, uint64_t nowNs) {
+    auto it = recordedState.find(port);
+    MappingHistoryEntry entry{};
+    entry.timeNs = nowNs;
+    entry.port = port;
+
+    if (!mapping) {
+        if (it == recordedState.end()) return;
+        entry.pid = -1;
+        entry.proto = it->second.proto;
+        entry.change = MappingChange::Evict;
+        recordedState.erase(it);
+    } else {
+        if (it != recordedState.end() && it->second.pid == mapping->pid && it->second.inode == mapping->inode) return;
+        entry.inode = mapping->inode;
+        entry.pid = mapping->pid;
+        entry.proto = mapping->proto;
+        entry.change = it == recordedState.end() ? MappingChange::Assign : MappingChange::Reassign;
+        recordedState[port] = entry;
+    }
+    pending.push_back(entry);
+}
+
+// Append the pending changes to their segments
+bool MappingJournal::flush() {
+    std::vector<MappingHistoryEntry> changes;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        changes.swap(pending);
+    }
+    if (changes.empty()) return true;
+
+    // Changes go out in runs, a new hour closes the run and starts the next segment.
+    // After a failure the rest is only applied to the state, so later checkpoints stay right
+    bool ok = true;
+    size_t runStart = 0;
+    for (size_t i = 0; i <= changes.size(); i++) {
+        uint64_t hour = i < changes.size() ? changes[i].timeNs / NS_PER_SEC / SEGMENT_SECONDS * SEGMENT_SECONDS : 0;
+        bool newSegment = ok && i < changes.size() && (segmentFd < 0 || hour > segmentStart);
+        if (i == changes.size() || newSegment) {
+            if (ok && i > runStart && !writeAll(segmentFd, &changes[runStart], (i - runStart) * sizeof(MappingHistoryEntry))) {
+                syslog(LOG_ERR, "Failed to write mapping history: %s", strerror(errno));
+                ok = false;
+            }
+            runStart = i;
+            if (newSegment && !openSegment(hour)) ok = false;
+        }
+        if (i == changes.size()) break;
+
+        // The next checkpoint is the state after every written change
+        if (changes[i].change == MappingChange::Evict) {
+            writtenState.erase(changes[i].port);
+        } else {
+            writtenState[changes[i].port] = changes[i];
+        }
+    }
+    return ok;
+}
+
+// Close the open segment and start the one for startSeconds with a checkpoint of writtenState
+bool MappingJournal::openSegment(uint64_t startSeconds) {
+    if (segmentFd >= 0) close(segmentFd);
+    segmentStart = startSeconds;
+    std::string path = segmentPath(startSeconds);
+
+    // The clock went back and forth, the segment already has a checkpoint, keep adding to it
+    segmentFd = open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (segmentFd >= 0) return true;
+
+    segmentFd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (segmentFd < 0) {
+        syslog(LOG_ERR, "Failed to open history segment %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // The checkpoint keeps the time each mapping was made, as InEffect entries
+    std::vector<MappingHistoryEntry> checkpoint;
+    checkpoint.reserve(writtenState.size());
+    for (const auto& pair : writtenState) {
+        checkpoint.push_back(pair.second);
+        checkpoint.back().change = MappingChange::InEffect;
+    }
+
+    SegmentHeader header{};
+    header.magic = JOURNAL_MAGIC;
+    header.version = JOURNAL_VERSION;
+    header.entrySize = sizeof(MappingHistoryEntry);
+    header.startSeconds = startSeconds;
+    header.checkpointCount = checkpoint.size();
+    if (!writeAll(segmentFd, &header, sizeof(header)) ||
+        !writeAll(segmentFd, checkpoint.data(), checkpoint.size() * sizeof(MappingHistoryEntry))) {
+        syslog(LOG_ERR, "Failed to write history segment %s: %s", path.c_str(), strerror(errno));
+        close(segmentFd);
+        segmentFd = -1;
+        unlink(path.c_str());// a segment without its whole checkpoint would replay wrong
+        return false;
+    }
+
+    segments.push_back(startSeconds);
+    dropOldSegments();
+    return true;
+}
+
+// Delete the oldest segments past MAX_SEGMENTS
+void MappingJournal::dropOldSegments() {
+    while (segments.size() > MAX_SEGMENTS) {
+        unlink(segmentPath(segments.front()).c_str());
+        segments.erase(segments.begin());
+    }
+}
+
+// Flush on the loop, then read the segments on the query thread
+void MappingJournal::queryAsync(uint16_t port, const MappingHistoryQuery& range, QueryCallback done) {
+    flush();
+    std::vector<uint64_t> segmentList = segments;// segments is only touched on the loop
+    {
+        std::lock_guard<std::mutex> lock(queryMtx);
+        if (stopping) return;
+        if (!queryThread.joinable()) queryThread = std::thread(&MappingJournal::queryLoop, this);
+        queryJobs.push_back([this, port, range, segmentList = std::move(segmentList), done = std::move(done)]() {
+            bool truncated = false;
+            std::vector<MappingHistoryEntry> entries = readHistory(port, range, segmentList, truncated);
+            done(std::move(entries), truncated);
+        });
+    }
+    queryCv.notify_one();
+}
+
+// Drop the queries not started yet and wait for the running one
+void MappingJournal::stopQueries() {
+    {
+        std::lock_guard<std::mutex> lock(queryMtx);
+        stopping = true;
+        queryJobs.clear();
+    }
+    queryCv.notify_one();
+    if (queryThread.joinable()) queryThread.join();
+}
+
+// Run the queued queries until stopQueries
+void MappingJournal::queryLoop() {
+    std::unique_lock<std::mutex> lock(queryMtx);
+    while (true) {
+        queryCv.wait(lock, [this] { return stopping || !queryJobs.empty(); });
+        if (stopping) return;
+        std::function<void()> job = std::move(queryJobs.front());
+        queryJobs.pop_front();
+        lock.unlock();
+        job();
+        lock.lock();
+    }
+}
+
+// Answer a MappingHistory request: what held at fromNs, then every change until toNs.
+// A segment the loop deleted meanwhile (past the retention) is just skipped
+std::vector<MappingHistoryEntry> MappingJournal::readHistory(uint16_t port, const MappingHistoryQuery& range,
+                                                             const std::vector<uint64_t>& segmentList, bool& truncated) const {
+    std::vector<MappingHistoryEntry> result;
+    uint64_t fromNs = range.fromNs;
+    uint64_t toNs = std::max(range.toNs, range.fromNs);
+    truncated = false;
+    if (segmentList.empty()) return result;
+
+    // The last segment that starts before fromNs has the state at fromNs (its checkpoint plus its earlier changes)
+    auto first = std::upper_bound(segmentList.begin(), segmentList.end(), fromNs / NS_PER_SEC);
+    bool knownAtFrom = first != segmentList.begin();// before the oldest segment nothing is known
+    if (knownAtFrom) --first;
+
+    std::unordered_map<uint16_t, MappingHistoryEntry> inEffect;
+    std::vector<MappingHistoryEntry> changes;
+    for (auto it = first; it != segmentList.end() && *it * NS_PER_SEC <= toNs; ++it) {
+        std::vector<MappingHistoryEntry> entries;
+        uint32_t checkpointCount;
+        if (!readSegment(*it, entries, checkpointCount)) continue;
+
+        for (size_t i = 0; i < entries.size(); i++) {
+            const MappingHistoryEntry& entry = entries[i];
+            if (port != 0 && entry.port != port) continue;
+
+            if (i < checkpointCount) {// checkpoints only matter in the segment the range starts in
+                if (it == first && knownAtFrom) inEffect[entry.port] = entry;
+            } else if (entry.timeNs <= fromNs) {
+                if (entry.change == MappingChange::Evict) {
+                    inEffect.erase(entry.port);
+                } else {
+                    inEffect[entry.port] = entry;
+                    inEffect[entry.port].change = MappingChange::InEffect;
+                }
+            } else if (entry.timeNs <= toNs) {
+                if (changes.size() < MAX_QUERY_ENTRIES) {
+                    changes.push_back(entry);
+                } else {
+                    truncated = true;
+                }
+            }
+        }
+    }
+
+    for (const auto& pair : inEffect) result.push_back(pair.second);
+    std::sort(result.begin(), result.end(), [](const MappingHistoryEntry& a, const MappingHistoryEntry& b) {
+        return a.port < b.port;
+    });
+    result.insert(result.end(), changes.begin(), changes.end());
+    if (result.size() > MAX_QUERY_ENTRIES) {// the latest changes are left out
+        result.resize(MAX_QUERY_ENTRIES);
+        truncated = true;
+    }
+    return result;
+}
+
+// Read a segment, false if its missing or not a segment
+bool MappingJournal::readSegment(uint64_t startSeconds, std::vector<MappingHistoryEntry>& entries, uint32_t& checkpointCount) const {
+    int fd = open(segmentPath(startSeconds).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    SegmentHeader header;
+    struct stat st;
+    bool ok = read(fd, &header, sizeof(header)) == sizeof(header) && fstat(fd, &st) == 0 &&
+              header.magic == JOURNAL_MAGIC && header.version == JOURNAL_VERSION &&
+              header.entrySize == sizeof(MappingHistoryEntry);
+    if (ok) {
+        // A crash can leave the last change half written, only whole entries are read
+        size_t count = (static_cast<size_t>(st.st_size) - sizeof(header)) / sizeof(MappingHistoryEntry);
+        entries.resize(count);
+        size_t bytes = count * sizeof(MappingHistoryEntry);
+        ok = read(fd, entries.data(), bytes) == static_cast<ssize_t>(bytes) && header.checkpointCount <= count;
+        checkpointCount = header.checkpointCount;
+    }
+    close(fd);
+    return ok;
+}
+
+std::string MappingJournal::segmentPath(uint64_t startSeconds) const {
+    return dir + "/" + std::to_string(startSeconds) + ".seg";
+}
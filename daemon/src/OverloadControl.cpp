@@ -0,0 +1,78 @@
+#include "OverloadControl.h"
+#include "LatencyHistogram.h" // monotonicNs
+#include <syslog.h>
+
+OverloadControl::OverloadControl(MessageQueuePtr messageQueue, std::shared_ptr<const PortToPidMap> portPidMap,
+                                 DaemonMetrics& metrics, KernelSampleFunc setKernelSample)
+    : messageQueue(std::move(messageQueue)), portPidMap(std::move(portPidMap)), metrics(metrics),
+      setKernelSample(std::move(setKernelSample)), levelSince(std::chrono::steady_clock::now()) {}
+
+// Queue the packets of one netlink drain that the current level keeps, count the rest
+void OverloadControl::queuePackets(const pckt_info* records, size_t count) {
+    const pckt_info* queued = records;
+    size_t queuedCount = count;
+
+    if (current >= OVERLOAD_COALESCE) {
+        kept.clear();
+        drainKeys.clear();
+        for (size_t i = 0; i < count; i++) {
+            const pckt_info& pckt = records[i];
+            uint32_t key = (static_cast<uint32_t>(static_cast<unsigned char>(pckt.proto)) << 16) | pckt.dst_port;
+            if (!drainKeys.insert(key).second) continue;// the resolver scans a port once per batch anyway
+            if (current >= OVERLOAD_SKIP_KNOWN && portPidMap->getPid(pckt.dst_port) != -1) continue;// keep the mapping we have
+            kept.push_back(pckt);
+        }
+        metrics.shedPackets.fetch_add(count - kept.size(), std::memory_order_relaxed);
+        queued = kept.data();
+        queuedCount = kept.size();
+    }
+
+    size_t pushed = messageQueue->pushBatch(queued, queuedCount);// copied, the records are read in place from the netlink buffer
+    if (pushed < queuedCount) metrics.droppedPackets.fetch_add(queuedCount - pushed, std::memory_order_relaxed);
+}
+
+// Move the level from the current queue depth and wait
+void OverloadControl::update(std::chrono::steady_clock::time_point now) {
+    size_t depth = messageQueue->size();
+    uint64_t oldestNs = messageQueue->oldestEnqueuedNs();
+    auto wait = std::chrono::nanoseconds(oldestNs ? monotonicNs() - oldestNs : 0);
+    metrics.queueDepth.store(static_cast<uint32_t>(depth), std::memory_order_relaxed);
+
+    if (depth >= HIGH_WATER_DEPTH || wait >= HIGH_WATER_WAIT) {
+        calmSince = {};
+        if (current + 1 < OVERLOAD_LEVEL_COUNT && (current == OVERLOAD_NORMAL || now - levelSince >= STEP_UP_INTERVAL)) {
+            setLevel(static_cast<OverloadLevel>(current + 1), now);
+        }
+        return;
+    }
+    if (depth > LOW_WATER_DEPTH || wait > LOW_WATER_WAIT || current == OVERLOAD_NORMAL) {
+        calmSince = {};// between the marks, stay where we are
+        return;
+    }
+
+    // Calm, step down one stage per hold period (a stage that was needed may be needed again soon)
+    if (calmSince == std::chrono::steady_clock::time_point{}) calmSince = now;
+    if (now - calmSince >= RECOVER_HOLD) {
+        setLevel(static_cast<OverloadLevel>(current - 1), now);
+        calmSince = now;
+    }
+}
+
+OverloadLevel OverloadControl::level() const {
+    return current;
+}
+
+void OverloadControl::setLevel(OverloadLevel newLevel, std::chrono::steady_clock::time_point now) {
+    // The kernel samples only in the last stage, its records carry the weight so totals stay right
+    if (newLevel == OVERLOAD_KERNEL_SAMPLE && current != OVERLOAD_KERNEL_SAMPLE) {
+        if (!setKernelSample || !setKernelSample(KERNEL_SAMPLE_RATE)) syslog(LOG_WARNING, "Failed to ask the kernel module to sample");
+    } else if (current == OVERLOAD_KERNEL_SAMPLE && newLevel != OVERLOAD_KERNEL_SAMPLE) {
+        if (!setKernelSample || !setKernelSample(1)) syslog(LOG_WARNING, "Failed to ask the kernel module to stop sampling");
+    }
+
+    syslog(newLevel > current ? LOG_WARNING : LOG_INFO, "Overload level %s -> %s (queue %u packets)",
+           OVERLOAD_LEVEL_NAMES[current], OVERLOAD_LEVEL_NAMES[newLevel], metrics.queueDepth.load(std::memory_order_relaxed));
+    current = newLevel;
+    levelSince = now;
+    metrics.overloadLevel.store(newLevel, std::memory_order_relaxed);
+}
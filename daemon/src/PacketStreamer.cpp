@@ -0,0 +1,193 @@
+#include "PacketStreamer.h"
+#include <cstring> // memcpy
+#include <algorithm> // sort
+
+PacketStreamer::PacketStreamer(EventLoop& loop, UnixSocketServer& server, std::shared_ptr<const PortToPidMap> portPidMap, ProcessInfoCache& processCache, DaemonMetrics& metrics)
+    : loop(loop), server(server), portPidMap(std::move(portPidMap)), processCache(processCache), metrics(metrics),
+      metadataSubscribers(0), heldTotal(0), nextSeq(0), heldCount(0), holdTimer(-1) {
+    batch.reserve(MAX_BATCH_PACKETS);
+}
+
+PacketStreamer::~PacketStreamer() {
+    if (holdTimer != -1) loop.removeTimer(holdTimer);
+}
+
+// Start streaming to a client, acks the request with an empty reply
+void PacketStreamer::addSubscriber(int clientFd, uint16_t flags) {
+    if (subscribers.count(clientFd)) return;
+    subscribers[clientFd] = flags;
+    if (flags & REQUEST_FLAG_METADATA) metadataSubscribers++;
+    syslog(LOG_INFO, "Client (fd=%d) subscribed to packets", clientFd);
+    server.sendReply(clientFd, DaemonRequestType::SubscribePackets, ReplyStatus::Ok, nullptr, 0);
+}
+
+// Stop streaming to a client
+void PacketStreamer::removeSubscriber(int clientFd) {
+    auto it = subscribers.find(clientFd);
+    if (it == subscribers.end()) return;
+    if (it->second & REQUEST_FLAG_METADATA) metadataSubscribers--;
+    subscribers.erase(it);
+
+    // Nobody left to send to, drop what is waiting
+    if (subscribers.empty()) {
+        batch.clear();
+        held.clear();
+        heldOrder.clear();
+        heldTotal = 0;
+        heldCount = 0;
+        updateHoldTimer();
+    }
+}
+
+bool PacketStreamer::hasSubscribers() const {
+    return !subscribers.empty();
+}
+
+// Annotate a packet from the kernel, held if its port isnt mapped yet
+void PacketStreamer::onPacket(const pckt_info* pckt) {
+    if (subscribers.empty()) return;
+
+    AnnotatedPacket record{};
+    record.packet = *pckt;
+    uint16_t port = pckt->dst_port;
+
+    // Later packets of a port that is already waiting wait behind it, so a flow stays in order
+    if (!held.count(port)) {
+        record.pid = portPidMap->getPid(port);
+        if (record.pid != -1) {
+            emit(record);
+            if (batch.size() >= MAX_BATCH_PACKETS) flush();
+            return;
+        }
+    }
+
+    if (heldTotal >= MAX_HELD_PACKETS) {// too much waiting, give up on the oldest
+        skipReleased();
+        uint16_t oldestPort = heldOrder.front().first;
+        auto oldestPackets = held.find(oldestPort);
+        HeldPacket oldest = oldestPackets->second.front();
+        oldestPackets->second.pop_front();
+        if (oldestPackets->second.empty()) held.erase(oldestPackets);
+        heldOrder.pop_front();
+        heldTotal--;
+        oldest.record.pid = portPidMap->getPid(oldestPort);
+        emit(oldest.record);
+    }
+    record.pid = -1;
+    held[port].push_back(HeldPacket{record, std::chrono::steady_clock::now() + HOLD_TIMEOUT, nextSeq});
+    heldOrder.emplace_back(port, nextSeq++);
+    heldTotal++;
+    if (heldOrder.size() > 4 * MAX_HELD_PACKETS) compactHeldOrder();
+    heldCount = heldTotal;
+    updateHoldTimer();
+    if (batch.size() >= MAX_BATCH_PACKETS) flush();// held is consistent again, safe to send
+}
+
+// Add a record to the outgoing batch, with its comm and container if a subscriber wants them
+void PacketStreamer::emit(AnnotatedPacket& record) {
+    if (metadataSubscribers && record.pid != -1) {
+        ProcessInfo info;
+        if (processCache.lookup(record.pid, info, COMM_MAX_AGE)) {
+            std::memcpy(record.comm, info.comm, sizeof(record.comm));
+            std::memcpy(record.container, info.container, sizeof(record.container) - 1);// the short id
+            record.container[sizeof(record.container) - 1] = '\0';
+        }
+    }
+    batch.push_back(record);
+}
+
+// Send the packets annotated so far to every subscriber, one frame each
+void PacketStreamer::flush() {
+    if (batch.empty()) return;
+
+    // A subscriber that stopped reading is closed by the server while sending (the last one leaving clears batch),
+    // so send from a local batch and walk a copy of the subscribers
+    std::vector<AnnotatedPacket> sending;
+    sending.swap(batch);
+    batch.reserve(MAX_BATCH_PACKETS);
+    std::vector<int> targets;
+    targets.reserve(subscribers.size());
+    for (const auto& subscriber : subscribers) targets.push_back(subscriber.first);
+
+    for (int clientFd : targets) {
+        server.sendReply(clientFd, DaemonRequestType::SubscribePackets, ReplyStatus::Ok,
+                         sending.data(), sending.size() * sizeof(AnnotatedPacket));
+    }
+
+    uint64_t nowNs = monotonicNs();
+    for (const AnnotatedPacket& record : sending) {
+        metrics.latency[STAGE_STREAM_DELIVERY].recordSince(record.packet.tstamp_ns, nowNs);
+    }
+}
+
+// Called by the resolver thread after it tried to map port
+void PacketStreamer::notifyResolved(uint16_t port) {
+    if (heldCount.load(std::memory_order_relaxed) == 0) return;// the common case, nothing to wake the loop for
+    loop.post([this, port]() {
+        releasePort(port);
+        flush();
+    });
+}
+
+// Send the held packets of port with the pid the map has now (-1 if the resolver couldnt find it)
+void PacketStreamer::releasePort(uint16_t port) {
+    auto packets = held.find(port);
+    if (packets == held.end()) return;
+    std::deque<HeldPacket> released = std::move(packets->second);
+    held.erase(packets);// their heldOrder entries are skipped later
+    heldTotal -= released.size();
+    heldCount = heldTotal;
+
+    pid_t pid = portPidMap->getPid(port);
+    for (HeldPacket& packet : released) {// a local copy, sending may clear held meanwhile
+        packet.record.pid = pid;
+        emit(packet.record);
+        if (batch.size() >= MAX_BATCH_PACKETS) flush();
+    }
+    updateHoldTimer();
+}
+
+// A heldOrder entry is live only if it is the oldest packet still held for its port
+// (a port is released whole or oldest first, so older live packets of it would come first in heldOrder)
+void PacketStreamer::skipReleased() {
+    while (!heldOrder.empty()) {
+        auto packets = held.find(heldOrder.front().first);
+        if (packets != held.end() && packets->second.front().seq == heldOrder.front().second) return;
+        heldOrder.pop_front();
+    }
+}
+
+// Rebuild heldOrder from the packets still held, when released entries pile up behind a live one at the front
+void PacketStreamer::compactHeldOrder() {
+    std::vector<std::pair<uint64_t, uint16_t>> live;
+    live.reserve(heldTotal);
+    for (const auto& packets : held) {
+        for (const HeldPacket& packet : packets.second) live.emplace_back(packet.seq, packets.first);
+    }
+    std::sort(live.begin(), live.end());
+    heldOrder.clear();
+    for (const auto& entry : live) heldOrder.emplace_back(entry.second, entry.first);
+}
+
+// Send the held packets past their deadline, whatever pid is known by now
+void PacketStreamer::releaseExpired() {
+    auto now = std::chrono::steady_clock::now();
+    while (true) {// deadlines grow with heldOrder
+        skipReleased();
+        if (heldOrder.empty()) break;
+        uint16_t port = heldOrder.front().first;
+        if (held[port].front().deadline > now) break;
+        releasePort(port);// the rest of that port goes too, keeps it in order
+    }
+    flush();
+}
+
+// The deadline timer only runs while packets are held
+void PacketStreamer::updateHoldTimer() {
+    if (heldTotal && holdTimer == -1) {
+        holdTimer = loop.addTimer(HOLD_CHECK_INTERVAL, [this]() { releaseExpired(); });
+    } else if (!heldTotal && holdTimer != -1) {
+        loop.removeTimer(holdTimer);
+        holdTimer = -1;
+    }
+}
@@ -0,0 +1,193 @@
+#include "PortMapSnapshot.h"
+#include <fstream>
+#include <vector>
+#include <set>
+#include <cstring>    // memcpy, strerror
+#include <cerrno>
+#include <cstdio>     // rename
+#include <fcntl.h>    // open
+#include <unistd.h>   // write, fsync, close
+#include <sys/stat.h> // mkdir
+#include <syslog.h>
+#include "NetLinkConfig.h" // PROTO_TCP, PROTO_UDP
+
+static constexpr uint32_t SNAPSHOT_MAGIC = 0x484B504D;// "HKPM"
+static constexpr uint16_t SNAPSHOT_VERSION = 1;
+static constexpr size_t BOOT_ID_LEN = 36;// uuid text, like 6c1d3f4e-...
+static constexpr uint32_t MAX_ENTRIES = 65536;// one per port at most
+
+// File layout: a header followed by count entries, native byte order (the file never leaves the machine)
+struct SnapshotHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entrySize;
+    uint32_t count;
+    char bootId[BOOT_ID_LEN];
+};
+
+struct SnapshotEntry {
+    uint64_t inode;
+    uint64_t startTime;// clock ticks since boot, tells a reused pid apart
+    int32_t pid;
+    uint16_t port;
+    char proto;
+    uint8_t pad;
+};
+
+// Id of the current boot, pids and inodes from another boot mean nothing
+static std::string readBootId() {
+    std::ifstream file("/proc/sys/kernel/random/boot_id");
+    std::string bootId;
+    std::getline(file, bootId);
+    bootId.resize(BOOT_ID_LEN, '\0');
+    return bootId;
+}
+
+// Write exactly len bytes
+static bool writeAll(int fd, const void* data, size_t len) {
+    const char* bytes = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t res = write(fd, bytes, len);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) return false;
+        bytes += res;
+        len -= res;
+    }
+    return true;
+}
+
+// Create the snapshot dir if its missing (only the last level, like StateDirectory= does)
+static void createParentDir(const std::string& path) {
+    std::size_t slash = path.rfind('/');
+    if (slash == std::string::npos || slash == 0) return;
+    if (mkdir(path.substr(0, slash).c_str(), 0755) < 0 && errno != EEXIST) {
+        syslog(LOG_WARNING, "Failed to create snapshot dir for %s: %s", path.c_str(), strerror(errno));
+    }
+}
+
+namespace PortMapSnapshot {
+    // Write the table to path through a temp file and rename
+    bool save(const std::string& path, const std::unordered_map<uint16_t, PortMapping>& map) {
+        std::vector<SnapshotEntry> entries;
+        entries.reserve(map.size());
+        for (const auto& pair : map) {
+            uint64_t startTime = ScanFiles::getProcessStartTime(pair.second.pid);
+            if (startTime == 0) continue;// the process is gone, nothing to restore
+
+            SnapshotEntry entry{};
+            entry.inode = pair.second.inode;
+            entry.startTime = startTime;
+            entry.pid = pair.second.pid;
+            entry.port = pair.first;
+            entry.proto = pair.second.proto;
+            entries.push_back(entry);
+        }
+
+        SnapshotHeader header{};
+        header.magic = SNAPSHOT_MAGIC;
+        header.version = SNAPSHOT_VERSION;
+        header.entrySize = sizeof(SnapshotEntry);
+        header.count = entries.size();
+        std::memcpy(header.bootId, readBootId().data(), BOOT_ID_LEN);
+
+        createParentDir(path);
+        std::string tmpPath = path + ".tmp";
+        int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            syslog(LOG_WARNING, "Failed to create snapshot %s: %s", tmpPath.c_str(), strerror(errno));
+            return false;
+        }
+        // On disk before the rename, otherwise a crash can leave an empty file under the real name
+        bool written = writeAll(fd, &header, sizeof(header)) &&
+                       writeAll(fd, entries.data(), entries.size() * sizeof(SnapshotEntry)) &&
+                       fsync(fd) == 0;
+        if (!written) syslog(LOG_WARNING, "Failed to write snapshot %s: %s", tmpPath.c_str(), strerror(errno));
+        close(fd);
+        if (!written) {
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        if (rename(tmpPath.c_str(), path.c_str()) < 0) {
+            syslog(LOG_WARNING, "Failed to replace snapshot %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    // Load the entries that are still valid into map, returns how many were loaded
+    size_t load(const std::string& path, std::unordered_map<uint16_t, PortMapping>& map) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return 0;// first run, nothing saved yet
+
+        SnapshotHeader header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+            header.entrySize != sizeof(SnapshotEntry) || header.count > MAX_ENTRIES) {
+            syslog(LOG_WARNING, "Ignoring unreadable snapshot %s", path.c_str());
+            return 0;
+        }
+        if (std::memcmp(header.bootId, readBootId().data(), BOOT_ID_LEN) != 0) {
+            syslog(LOG_INFO, "Snapshot %s is from another boot, ignoring it", path.c_str());
+            return 0;
+        }
+
+        std::vector<SnapshotEntry> entries(header.count);
+        if (!file.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(SnapshotEntry))) {
+            syslog(LOG_WARNING, "Snapshot %s is truncated, ignoring it", path.c_str());
+            return 0;
+        }
+
+        // The sockets that are bound right now, one parse per protocol for the whole file
+        sockInodePortVec tcpSockets = ScanFiles::listSockets('T');
+        sockInodePortVec udpSockets = ScanFiles::listSockets('U');
+        std::set<std::pair<uint64_t, uint16_t>> tcpBound(tcpSockets.begin(), tcpSockets.end());
+        std::set<std::pair<uint64_t, uint16_t>> udpBound(udpSockets.begin(), udpSockets.end());
+
+        for (const SnapshotEntry& entry : entries) {
+            // The socket is still bound to the same port
+            const auto& bound = (entry.proto == 'T') ? tcpBound : udpBound;
+            if (!bound.count({entry.inode, entry.port})) continue;
+
+            // And the pid is still the process that was saved, not a new one that got the same pid
+            if (ScanFiles::getProcessStartTime(entry.pid) != entry.startTime) continue;
+
+            // Tcp wins when both protocols use the port, same as the full scan
+            auto it = map.find(entry.port);
+            if (it != map.end() && it->second.proto == 'T') continue;
+            map[entry.port] = PortMapping{entry.pid, entry.inode, entry.proto};
+        }
+        return map.size();
+    }
+
+    // Load a synthetic "port pid [T|U]" table for load tests
+    bool loadTable(const std::string& path, std::unordered_map<uint16_t, PortMapping>& map) {
+        std::ifstream file(path);
+        if (!file) {
+            syslog(LOG_ERR, "Failed to open port table %s", path.c_str());
+            return false;
+        }
+
+        std::string line;
+        size_t lineNumber = 0;
+        while (std::getline(file, line)) {
+            lineNumber++;
+            std::size_t hash = line.find('#');
+            if (hash != std::string::npos) line.resize(hash);
+
+            unsigned port;
+            int pid;
+            char proto = PROTO_TCP;
+            int fields = std::sscanf(line.c_str(), "%u %d %c", &port, &pid, &proto);
+            if (fields <= 0) continue;// blank line
+            if (fields < 2 || port == 0 || port > UINT16_MAX || (proto != PROTO_TCP && proto != PROTO_UDP)) {
+                syslog(LOG_ERR, "Bad line %zu in port table %s", lineNumber, path.c_str());
+                return false;
+            }
+            PortMapping mapping;
+            mapping.pid = pid;
+            mapping.proto = proto;
+            map[static_cast<uint16_t>(port)] = mapping;
+        }
+        return true;
+    }
+}
@@ -1,38 +1,172 @@
 #include "PortToPidMap.h"
 
 // Fills the map with the current port to pid relations in the system (pid listens to the port)
-PortToPidMap::PortToPidMap(){
+PortToPidMap::PortToPidMap(const std::string& snapshotPath, std::shared_ptr<MappingJournal> journal)
+    : snapshotPath(snapshotPath), journal(std::move(journal)) {
     
-    ScanFiles::initializePortPidMap(map);// Scan the files to fill map
+    // Warm start, serve the validated snapshot now and let a background scan fix the rest
+    std::unordered_map<uint16_t, PortMapping> initial;
+    size_t restored = PortMapSnapshot::load(snapshotPath, initial);
+    if (restored > 0) {
+        for (const auto& pair : initial) {
+            map.insertOrAssign(pair.first, pair.second);
+            if (this->journal) this->journal->recordMapping(pair.first, pair.second);// still the owners, the reconcile evicts the rest
+        }
+        syslog(LOG_INFO, "Restored %zu port mappings from %s, reconciling in the background", restored, snapshotPath.c_str());
+        reconciling = true;
+        reconcileThread = std::thread(&PortToPidMap::reconcile, this);
+        return;
+    }
+
+    ScanFiles::initializePortPidMap(initial);// Scan the files to fill map
+    for (const auto& pair : initial) map.insertOrAssign(pair.first, pair.second);
+    if (this->journal) this->journal->recordTable(initial);// ports the daemon knew before it stopped and are gone now are evicted
+    changes++;
     
     syslog(LOG_INFO, "Port Pid Mapping When Daemon Started:");
-    for(const auto& pair : map){// logging
-        syslog(LOG_INFO, "port %u pid %d", pair.first, pair.second);
+    for(const auto& pair : initial){// logging
+        syslog(LOG_INFO, "port %u pid %d", pair.first, pair.second.pid);
     }
     
 }
 
+// Serves a fixed table for load tests, nothing is scanned or saved
+PortToPidMap::PortToPidMap(const std::unordered_map<uint16_t, PortMapping>& table) {
+    for (const auto& pair : table) map.insertOrAssign(pair.first, pair.second);
+    syslog(LOG_INFO, "Serving a fixed table of %zu port mappings", table.size());
+}
+
+// Waits for the background reconcile and snapshot save if they are still running
+PortToPidMap::~PortToPidMap() {
+    stopping = true;
+    if (reconcileThread.joinable()) reconcileThread.join();
+    {
+        std::lock_guard<std::mutex> lock(saveMtx);
+        saveStopping = true;
+    }
+    saveCv.notify_one();
+    if (saveThread.joinable()) saveThread.join();
+}
+
+// Full scan without holding anything, then apply it keeping whatever addPidMapping found meanwhile (its newer)
+void PortToPidMap::reconcile() {
+    std::unordered_map<uint16_t, PortMapping> scanned;
+    ScanFiles::initializePortPidMap(scanned);
+
+    std::lock_guard<std::mutex> lock(reconcileMtx);
+    if (!stopping) {// shutting down, the snapshot entries were valid anyway
+        // Snapshot entries the scan didnt find are stale
+        std::vector<uint16_t> stale;
+        map.forEach([&](uint16_t port, const PortMapping&) {
+            if (!scanned.count(port) && !touchedPorts.count(port)) stale.push_back(port);
+        });
+        for (uint16_t port : stale) map.erase(port);
+
+        for (const auto& pair : scanned) {
+            if (!touchedPorts.count(pair.first)) map.insertOrAssign(pair.first, pair.second);
+        }
+        changes++;
+        if (journal) journal->recordTable(map.snapshot());
+        syslog(LOG_INFO, "Reconciled port mappings, %zu ports mapped", map.size());
+    }
+    touchedPorts.clear();
+    reconciling = false;// after the merge, a writer that sees false cant be overwritten by it
+}
+
 // Adds new port to pid mapping to map, return false if cant find pid for port
 bool PortToPidMap::addPidMapping(uint16_t port, char protocol){
-    std::unique_lock<std::shared_mutex> lock(mtx);// Unique lock for changing the map
-    
-    pid_t pid = ScanFiles::scanForPidByPort(port, protocol);// find the pid of the process using the port
-    if(pid == -1) {
+    // Scan without holding anything, so readers arent blocked while /proc is walked
+    PortMapping mapping = ScanFiles::scanForPidByPort(port, protocol);// find the pid of the process using the port
+    if(mapping.pid == -1) {
         syslog(LOG_ERR, "Failed to find PID for port %u packet type: %c", port, protocol);
         return false; // failed to find pid
     }
     
-    // update the port pid map with the new pid from files 
-    map[port] = pid;
+    storeMapping(port, mapping);
     return true;
 }
 
+// Adds the mappings of a batch of ports with one scan, returns the ports that were mapped
+std::vector<uint16_t> PortToPidMap::addPidMappings(const portProtoVec& ports) {
+    std::vector<uint16_t> mapped;
+    if (ports.empty()) return mapped;
+
+    // Scan without holding anything, so readers arent blocked while /proc is walked
+    std::unordered_map<uint16_t, PortMapping> found = ScanFiles::scanForPidsByPorts(ports);
+    for (const auto& port : ports) {
+        auto it = found.find(port.first);
+        if (it == found.end()) {
+            syslog(LOG_ERR, "Failed to find PID for port %u packet type: %c", port.first, port.second);
+            continue;
+        }
+        storeMapping(it->first, it->second);
+        mapped.push_back(it->first);
+        found.erase(it);// a port asked for both protocols is stored once
+    }
+    return mapped;
+}
+
+// Store a mapping a scan found (only its shard is locked)
+void PortToPidMap::storeMapping(uint16_t port, const PortMapping& mapping) {
+    if (reconciling) {// the reconcile scan may have seen an older owner, keep this one
+        std::lock_guard<std::mutex> lock(reconcileMtx);
+        touchedPorts.insert(port);
+        map.insertOrAssign(port, mapping);
+        if (journal) journal->recordMapping(port, mapping);
+    } else {
+        map.insertOrAssign(port, mapping);
+        if (journal) journal->recordMapping(port, mapping);
+    }
+    changes++;
+}
+
 // Tries to get the pid that listens to the port from the map, return -1 if not found
 pid_t PortToPidMap::getPid(uint16_t port) const {
-    std::shared_lock<std::shared_mutex> lock(mtx);// Lock that allows multyple reading
-    
-    if (map.find(port) != map.end()) {
-        return map.at(port);
+    std::optional<PortMapping> mapping = map.get(port);
+    return mapping ? mapping->pid : -1;
+}
+
+// Save the map to the snapshot file if it changed since the last save
+bool PortToPidMap::saveSnapshot() {
+    uint64_t version = changes;
+    if (version == savedChanges || snapshotPath.empty()) return true;// nothing new (or nowhere to save it)
+    return writeSnapshot(version, map.snapshot());
+}
+
+// Copy the map here and write it on the save thread, the write reads /proc once per port
+void PortToPidMap::saveSnapshotAsync() {
+    uint64_t version = changes;
+    if (version == savedChanges || snapshotPath.empty()) return;
+
+    std::lock_guard<std::mutex> lock(saveMtx);
+    if (version == queuedChanges) return;// already on its way
+    queuedSave = std::make_unique<SaveJob>(SaveJob{version, map.snapshot()});
+    queuedChanges = version;
+    if (!saveThread.joinable()) saveThread = std::thread(&PortToPidMap::saveLoop, this);
+    saveCv.notify_one();
+}
+
+// Write table unless a save of the same or a newer map got there first
+bool PortToPidMap::writeSnapshot(uint64_t version, const std::unordered_map<uint16_t, PortMapping>& table) {
+    std::lock_guard<std::mutex> lock(writeMtx);
+    if (version <= savedChanges) return true;
+    if (!PortMapSnapshot::save(snapshotPath, table)) return false;
+    savedChanges = version;
+    return true;
+}
+
+// Runs the queued saves, a save queued when the dtor runs is still written
+void PortToPidMap::saveLoop() {
+    std::unique_lock<std::mutex> lock(saveMtx);
+    while (true) {
+        saveCv.wait(lock, [this] { return saveStopping || queuedSave; });
+        if (!queuedSave) return;
+
+        std::unique_ptr<SaveJob> job = std::move(queuedSave);
+        lock.unlock();
+        bool saved = writeSnapshot(job->version, job->table);
+        if (!saved) syslog(LOG_WARNING, "Failed to save port map snapshot");
+        lock.lock();
+        if (!saved && queuedChanges == job->version) queuedChanges = 0;// try again on the next tick
     }
-    return -1;
-}
\ No newline at end of file
+}
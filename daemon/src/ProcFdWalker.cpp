@@ -0,0 +1,201 @@
+#include "ProcFdWalker.h"
+#include <fcntl.h>       // openat
+#include <dirent.h>      // DT_DIR
+#include <unistd.h>      // readlinkat, close
+#include <sys/syscall.h> // SYS_getdents64
+#include <algorithm>     // sort, binary_search
+#include <cstdio>        // snprintf
+#include <cstring>       // memcmp
+
+// Layout of the records getdents64 fills
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static constexpr size_t DIRENT_BUF_SIZE = 32 * 1024;
+static constexpr size_t LINK_BUF_SIZE = 64;// "socket:[18446744073709551615]" fits
+
+// Parse a decimal name (pid or fd number), false if it isnt a number
+static bool parseNumber(const char* name, uint64_t& value) {
+    if (*name == '\0') return false;
+    value = 0;
+    for (; *name; name++) {
+        if (*name < '0' || *name > '9') return false;
+        value = value * 10 + (*name - '0');
+    }
+    return true;
+}
+
+// Starts the worker threads
+ProcFdWalker::ProcFdWalker(unsigned workerCount)
+    : currentJob(nullptr), generation(0), busyWorkers(0), stopping(false) {
+    procFd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (workerCount == 0) workerCount = std::thread::hardware_concurrency();
+    workerCount = std::min(std::max(workerCount, 1u), MAX_WORKERS);
+
+    // The calling thread walks too, so it takes one of the slots
+    for (unsigned i = 1; i < workerCount; i++) {
+        workers.emplace_back(&ProcFdWalker::workerThread, this);
+    }
+}
+
+ProcFdWalker::~ProcFdWalker() {
+    {
+        std::lock_guard<std::mutex> lock(poolMtx);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    for (std::thread& worker : workers) worker.join();
+    if (procFd >= 0) close(procFd);
+}
+
+// Returns inode -> owning pid for every inode that was found
+std::unordered_map<uint64_t, pid_t> ProcFdWalker::findOwners(const std::vector<uint64_t>& inodes) {
+    if (inodes.empty() || procFd < 0) return {};
+    std::lock_guard<std::mutex> callerLock(jobMtx);// one walk at a time
+
+    Job job;
+    job.targets = inodes;
+    std::sort(job.targets.begin(), job.targets.end());
+    job.targets.erase(std::unique(job.targets.begin(), job.targets.end()), job.targets.end());
+    listPids(job.pids);
+
+    // Hand the job to the workers and walk with them
+    {
+        std::lock_guard<std::mutex> lock(poolMtx);
+        currentJob = &job;
+        generation++;
+        busyWorkers = workers.size();
+    }
+    jobReady.notify_all();
+
+    walk(job);
+
+    // The job lives on this stack, wait until no worker touches it anymore
+    std::unique_lock<std::mutex> lock(poolMtx);
+    jobFinished.wait(lock, [this] { return busyWorkers == 0; });
+    currentJob = nullptr;
+
+    return std::move(job.results);
+}
+
+// Single inode lookup, -1 if no process owns it
+pid_t ProcFdWalker::findOwner(uint64_t inode) {
+    std::unordered_map<uint64_t, pid_t> owners = findOwners({inode});
+    auto it = owners.find(inode);
+    return it == owners.end() ? -1 : it->second;
+}
+
+// Worker thread, waits for a job and helps walking it
+void ProcFdWalker::workerThread() {
+    uint64_t seenGeneration = 0;
+
+    while (true) {
+        Job* job;
+        {
+            std::unique_lock<std::mutex> lock(poolMtx);
+            jobReady.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if (stopping) return;
+            seenGeneration = generation;
+            job = currentJob;
+        }
+
+        walk(*job);
+
+        {
+            std::lock_guard<std::mutex> lock(poolMtx);
+            busyWorkers--;
+        }
+        jobFinished.notify_one();
+    }
+}
+
+// Walk chunks of pids until the job runs out of pids or is done
+void ProcFdWalker::walk(Job& job) {
+    // Per thread buffers, reused for every process
+    std::vector<char> direntBuf(DIRENT_BUF_SIZE);
+    char linkBuf[LINK_BUF_SIZE];
+
+    while (!job.done.load(std::memory_order_relaxed)) {
+        size_t start = job.nextPid.fetch_add(PIDS_PER_CHUNK, std::memory_order_relaxed);
+        if (start >= job.pids.size()) return;
+        size_t end = std::min(start + PIDS_PER_CHUNK, job.pids.size());
+
+        for (size_t i = start; i < end; i++) {
+            if (!walkProcess(job, job.pids[i], linkBuf, direntBuf.data())) return;
+        }
+    }
+}
+
+// Check every fd of one process, returns false if the job is done
+bool ProcFdWalker::walkProcess(Job& job, pid_t pid, char* linkBuf, char* direntBuf) {
+    char fdDirPath[32];
+    snprintf(fdDirPath, sizeof(fdDirPath), "%d/fd", pid);
+
+    // Fails for processes that exited or that we cant inspect, just skip them
+    int fdDirFd = openat(procFd, fdDirPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fdDirFd < 0) return true;
+
+    static const char SOCKET_PREFIX[] = "socket:[";
+    static const size_t PREFIX_LEN = sizeof(SOCKET_PREFIX) - 1;
+
+    while (true) {
+        long bytes = syscall(SYS_getdents64, fdDirFd, direntBuf, DIRENT_BUF_SIZE);
+        if (bytes <= 0) break;
+
+        for (long offset = 0; offset < bytes;) {
+            linux_dirent64* entry = reinterpret_cast<linux_dirent64*>(direntBuf + offset);
+            offset += entry->d_reclen;
+            if (entry->d_name[0] == '.') continue;
+
+            // fd links look like socket:[123456] for sockets
+            ssize_t len = readlinkat(fdDirFd, entry->d_name, linkBuf, LINK_BUF_SIZE - 1);
+            if (len <= static_cast<ssize_t>(PREFIX_LEN) + 1 || std::memcmp(linkBuf, SOCKET_PREFIX, PREFIX_LEN) != 0) continue;
+            linkBuf[len - 1] = '\0';// drop the closing ]
+
+            uint64_t inode;
+            if (!parseNumber(linkBuf + PREFIX_LEN, inode)) continue;
+            if (!std::binary_search(job.targets.begin(), job.targets.end(), inode)) continue;
+
+            // Found one of the inodes, finish early once all of them are found
+            std::lock_guard<std::mutex> lock(job.resultMtx);
+            job.results.emplace(inode, pid);
+            if (job.results.size() == job.targets.size()) {
+                job.done = true;
+                close(fdDirFd);
+                return false;
+            }
+        }
+    }
+
+    close(fdDirFd);
+    return !job.done.load(std::memory_order_relaxed);
+}
+
+// List the numeric entries of /proc (the processes, threads arent listed there)
+void ProcFdWalker::listPids(std::vector<pid_t>& pids) const {
+    int dirFd = openat(procFd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0) return;
+
+    std::vector<char> direntBuf(DIRENT_BUF_SIZE);
+    while (true) {
+        long bytes = syscall(SYS_getdents64, dirFd, direntBuf.data(), DIRENT_BUF_SIZE);
+        if (bytes <= 0) break;
+
+        for (long offset = 0; offset < bytes;) {
+            linux_dirent64* entry = reinterpret_cast<linux_dirent64*>(direntBuf.data() + offset);
+            offset += entry->d_reclen;
+
+            uint64_t pid;
+            if (entry->d_type == DT_DIR && parseNumber(entry->d_name, pid)) {
+                pids.push_back(static_cast<pid_t>(pid));
+            }
+        }
+    }
+    close(dirFd);
+}
@@ -0,0 +1,145 @@
+#include "ProcessInfoCache.h"
+#include "ScanFiles.h" // getProcessStartTime
+#include <fstream>
+#include <algorithm> // min
+#include <string>
+#include <unistd.h> // readlink
+#include <cstdio>   // snprintf
+#include <cstring>  // strlen
+
+// Copy a string into a fixed size field, truncating and nul terminating it
+static void copyField(char* field, size_t size, const std::string& value) {
+    size_t len = std::min(value.size(), size - 1);
+    value.copy(field, len);
+    field[len] = '\0';
+}
+
+// Container id in a cgroup path, empty if the process isnt in a container.
+// Runtimes name the container's cgroup after its 64 hex char id: /docker/<id>, /system.slice/docker-<id>.scope,
+// /kubepods.slice/.../cri-containerd-<id>.scope, crio-<id>.scope, libpod-<id>.scope. The deepest one wins
+static std::string containerIdFromCgroup(const std::string& path) {
+    static const char* const PREFIXES[] = {"docker-", "cri-containerd-", "crio-", "libpod-"};
+    static const std::string SCOPE_SUFFIX = ".scope";
+    static const size_t ID_LEN = CONTAINER_ID_LEN - 1;
+
+    size_t end = path.size();
+    while (end > 0) {
+        size_t start = path.rfind('/', end - 1);
+        start = (start == std::string::npos) ? 0 : start + 1;
+        std::string name = path.substr(start, end - start);
+        end = start > 0 ? start - 1 : 0;
+
+        if (name.size() > SCOPE_SUFFIX.size() && name.compare(name.size() - SCOPE_SUFFIX.size(), SCOPE_SUFFIX.size(), SCOPE_SUFFIX) == 0) {
+            name.resize(name.size() - SCOPE_SUFFIX.size());
+        }
+        for (const char* prefix : PREFIXES) {
+            size_t len = std::strlen(prefix);
+            if (name.compare(0, len, prefix) == 0) {
+                name.erase(0, len);
+                break;
+            }
+        }
+        if (name.size() == ID_LEN && name.find_first_not_of("0123456789abcdef") == std::string::npos) return name;
+    }
+    return std::string();
+}
+
+ProcessInfoCache::ProcessInfoCache(size_t capacity) : capacity(capacity) {
+    index.reserve(capacity);
+}
+
+// Fill info for pid from the cache or /proc, false if the process doesnt exist anymore
+bool ProcessInfoCache::lookup(pid_t pid, ProcessInfo& info, std::chrono::milliseconds maxAge) {
+    auto now = std::chrono::steady_clock::now();
+    auto it = index.find(pid);
+
+    // Checked recently enough, trust it
+    if (it != index.end() && now - it->second->checkedAt < maxAge) {
+        entries.splice(entries.begin(), entries, it->second);
+        info = it->second->info;
+        return true;
+    }
+
+    uint64_t startTime = ScanFiles::getProcessStartTime(pid);// one small read, cheaper than the 4 files
+    if (it != index.end()) {
+        if (startTime != 0 && it->second->info.startTime == startTime) {// still the same process
+            entries.splice(entries.begin(), entries, it->second);
+            it->second->checkedAt = now;
+            info = it->second->info;
+            return true;
+        }
+        entries.erase(it->second);// exited or the pid was reused
+        index.erase(it);
+    }
+    if (startTime == 0 || !readProcessInfo(pid, startTime, info)) return false;
+
+    if (entries.size() >= capacity) {// forget the least recently used process
+        index.erase(entries.back().info.pid);
+        entries.pop_back();
+    }
+    entries.push_front(Entry{info, now});
+    index[pid] = entries.begin();
+    return true;
+}
+
+// Drop the entries of processes that exited (or whose pid was reused), returns how many were dropped
+size_t ProcessInfoCache::expireExited() {
+    size_t dropped = 0;
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (ScanFiles::getProcessStartTime(it->info.pid) == it->info.startTime) {
+            ++it;
+            continue;
+        }
+        index.erase(it->info.pid);
+        it = entries.erase(it);
+        dropped++;
+    }
+    return dropped;
+}
+
+size_t ProcessInfoCache::size() const {
+    return entries.size();
+}
+
+// Read the metadata of a running process from /proc, false if it exited
+bool ProcessInfoCache::readProcessInfo(pid_t pid, uint64_t startTime, ProcessInfo& info) {
+    info = ProcessInfo();
+    info.pid = pid;
+    info.startTime = startTime;
+    std::string procDir = "/proc/" + std::to_string(pid);
+
+    // comm, the name the kernel shows in ps (up to 15 chars)
+    std::ifstream commFile(procDir + "/comm");
+    std::string line;
+    if (!std::getline(commFile, line)) return false;// exited in between
+    copyField(info.comm, sizeof(info.comm), line);
+
+    // exe, fails for kernel threads, left empty then
+    char exePath[PROCESS_PATH_LEN];
+    ssize_t len = readlink((procDir + "/exe").c_str(), exePath, sizeof(exePath) - 1);
+    if (len > 0) {
+        exePath[len] = '\0';
+        copyField(info.exe, sizeof(info.exe), exePath);
+    }
+
+    // real uid, the first number of the Uid: line
+    std::ifstream statusFile(procDir + "/status");
+    while (std::getline(statusFile, line)) {
+        if (line.compare(0, 4, "Uid:") == 0) {
+            info.uid = static_cast<uint32_t>(std::stoul(line.substr(4)));
+            break;
+        }
+    }
+
+    // cgroup, lines look like hierarchy:controllers:path, v2 is the 0:: line
+    std::ifstream cgroupFile(procDir + "/cgroup");
+    while (std::getline(cgroupFile, line)) {
+        std::size_t pathStart = line.find(':', line.find(':') + 1);
+        if (pathStart == std::string::npos) continue;
+        bool unified = line.compare(0, 3, "0::") == 0;
+        if (unified || info.cgroup[0] == '\0') copyField(info.cgroup, sizeof(info.cgroup), line.substr(pathStart + 1));
+        if (unified) break;
+    }
+    copyField(info.container, sizeof(info.container), containerIdFromCgroup(info.cgroup));
+    return true;
+}
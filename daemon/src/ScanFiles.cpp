@@ -1,6 +1,5 @@
 #include "ScanFiles.h"
 // Files handling 
-#include <filesystem>
 #include <fstream>
 // Extract information from the files
 #include <regex>
@@ -8,11 +7,10 @@
 #include <sstream>
 #include <vector>// Keep vector of (inode, port) pairs
 #include <cstddef> // For size_t
-#include <iostream>// debugging for now (maybe remove later)
+#include <algorithm> // all_of
+#include <unordered_set>
 
-// to clean the code a bit
-namespace fs = std::filesystem;
-using sockInodePortVec = std::vector<std::pair<std::string, uint16_t>>;
+#include "ProcFdWalker.h"// finds the pids owning socket inodes
 
 // Parse /proc/net/tcp or /proc/net/udp and extract, inode, port for sockets that are listening or bound.
 sockInodePortVec parseListeningSockets(const std::string& path, uint16_t filterPort = 0) {
@@ -47,10 +45,10 @@ sockInodePortVec parseListeningSockets(const std::string& path, uint16_t filterP
             std::string token;
             int field = 0;
             while (iss >> token) {// Go over each token in the line
-                if (field == 9) {// in the 10th socket creates the pair (token, port) in the result vector next available cell
+                if (field == 9) {// in the 10th socket creates the pair (inode, port) in the result vector next available cell
                     // Skip if inode is "0" or malformed
                     if (token != "0" && std::all_of(token.begin(), token.end(), ::isdigit)) {
-                        result.emplace_back(token, port);
+                        result.emplace_back(std::stoull(token), port);
                     } 
                     break;
                 }
@@ -62,118 +60,141 @@ sockInodePortVec parseListeningSockets(const std::string& path, uint16_t filterP
     return result;
 }
 
-// Given a socket inode ( a socket we now is active and tied to relevant port), return the PID that owns it by scanning /proc/[pid]/fd/* links
-pid_t findPidBySockInode(const std::string& sockInode) {
-    
-    std::string pidStr;// pid folder name (heave to be a number)
-    std::string fdPath;// pid folder + /fd, the file descriptor folder well look for the socket in
-    std::error_code ec;// error code for the read_symlink function
-    std::string link;// symlink to the socket
-    
-    // Go over proc directory (contains all the processes in the system)
-    for (const auto& dir : fs::directory_iterator("/proc")) {
-        
-        if (!dir.is_directory()) continue; // Ignore files (we want to search process folders)
-        
-        pidStr = dir.path().filename();// Get folder name, ignore if not a number 
-        if (!std::all_of(pidStr.begin(), pidStr.end(), ::isdigit)) continue;
-        
-        fdPath = dir.path().string() + "/fd";// get pid file descriptor folder, ignore if not exist (kernel tasks or zombies)
-        if (!fs::exists(fdPath)) continue;
-
-        // Go over each file descriptor in the pid/fd folder
-        for (const auto& fd : fs::directory_iterator(fdPath)) {
-            
-            link = fs::read_symlink(fd.path(), ec).string();// If fails, continue to next fd
-            if (ec) continue;
-
-            // We looking for symlinks in format: socket:[123456], continue if not found
-            std::size_t start = link.find("socket:[");
-            if (start == std::string::npos) continue;
-
-            // Get the inode of the socket from the symlink and compare it to the one we are looking for
-            if (link.substr(8, link.size() - 9) == sockInode) {
-                return std::stoi(pidStr);// If found, return the pid 
-            }
-        }
-    }
+// One walker for the daemon, its worker threads are started on first use and reused by every scan
+static ProcFdWalker& fdWalker() {
+    static ProcFdWalker walker;
+    return walker;
+}
 
-    return -1; // not found
+// Find the owners of all the sockets in one walk over /proc/[pid]/fd
+static std::unordered_map<uint64_t, pid_t> findSocketOwners(const sockInodePortVec& sockets) {
+    std::vector<uint64_t> inodes;
+    inodes.reserve(sockets.size());
+    for (const auto& socket : sockets) {
+        inodes.push_back(socket.first);
+    }
+    return fdWalker().findOwners(inodes);
 }
 
 namespace ScanFiles {
     // Intialize the map of ports to PIDs by scanning the system files
-    void initializePortPidMap(std::unordered_map<uint16_t, pid_t>& map) {
-        std::string inode;
-        uint16_t port;
-        pid_t pid;
-        
+    void initializePortPidMap(std::unordered_map<uint16_t, PortMapping>& map) {
         // Get all TCP sockets
         sockInodePortVec tcpSockets = parseListeningSockets("/proc/net/tcp");
 
         // Get all UDP sockets
         sockInodePortVec udpSockets = parseListeningSockets("/proc/net/udp");
 
-        // For each TCP socket, find its owning PID and map it
+        // Find the owners of every socket in a single walk
+        sockInodePortVec allSockets = tcpSockets;
+        allSockets.insert(allSockets.end(), udpSockets.begin(), udpSockets.end());
+        std::unordered_map<uint64_t, pid_t> owners = findSocketOwners(allSockets);
+
+        // For each TCP socket, map its owning PID
         for (const auto& socket : tcpSockets) {
-            inode = socket.first;
-            port = socket.second;
-        
-            // Find the pid of the process using the socket inode, and update the map
-            pid = findPidBySockInode(inode);
-            if (pid != -1) {
-                map[port] = pid;
+            auto owner = owners.find(socket.first);
+            if (owner != owners.end()) {
+                map[socket.second] = PortMapping{owner->second, socket.first, 'T'};
             }
         }
 
-        // For each UDP socket find PID only if not already mapped by TCP
+        // For each UDP socket map its PID only if not already mapped by TCP
         for (const auto& socket : udpSockets) {
-            inode = socket.first;
-            port = socket.second;
-
-            if (map.find(port) != map.end()) continue;// give priority to tcp port on first scan  
-            
-            // Find the pid of the process using the socket inode, and update the map
-            pid = findPidBySockInode(inode);
-            if (pid != -1) {
-                map[port] = pid;
+            if (map.find(socket.second) != map.end()) continue;// give priority to tcp port on first scan  
+
+            auto owner = owners.find(socket.first);
+            if (owner != owners.end()) {
+                map[socket.second] = PortMapping{owner->second, socket.first, 'U'};
             }
         }
     }
 
     // Find new port linked pid if its not already in the map
-    pid_t scanForPidByPort(uint16_t port, char protocol) {
-        // sockInodePortVec pair members
-        std::string inode;
-        pid_t pid;
-        
+    PortMapping scanForPidByPort(uint16_t port, char protocol) {
+        // search port in TCP or UDP sockets (a port can have several sockets, any owner will do)
+        sockInodePortVec sockets = listSockets(protocol, port);
+        if (sockets.empty()) return PortMapping();
+
+        for (const auto& socket : sockets) {
+            syslog(LOG_INFO, "found %s socket port %u for socket inode %llu", (protocol == 'T') ? "tcp" : "udp",
+                   socket.second, static_cast<unsigned long long>(socket.first));
+        }
 
-        if(protocol == 'T'){
-            // search port in TCP LISTEN sockets
-            sockInodePortVec tcpSockets = parseListeningSockets("/proc/net/tcp", port);
-            for (const auto& socket : tcpSockets) {
-                inode = socket.first;
-
-                syslog(LOG_INFO, "found tcp socket port %u for socket inode %s", socket.second, inode.c_str());
-                
-                // Find the pid of the process using the socket inode, and update the map
-                pid = findPidBySockInode(inode);
-                return pid;
-            }
-        }else{
-            // search port in UDP sockets
-            sockInodePortVec udpSockets = parseListeningSockets("/proc/net/udp", port);
-            for (const auto& socket : udpSockets) {
-                inode = socket.first;
-                
-                syslog(LOG_INFO, "found udp socket port %u for socket inode %s", socket.second, inode.c_str());
-                
-                // Find the pid of the process using the socket inode, and update the map
-                pid = findPidBySockInode(inode);
-                return pid;
+        // Find the pid of the process using one of the socket inodes, the walk stops at the first match per inode
+        std::unordered_map<uint64_t, pid_t> owners = findSocketOwners(sockets);
+        for (const auto& socket : sockets) {
+            auto owner = owners.find(socket.first);
+            if (owner != owners.end()) return PortMapping{owner->second, socket.first, protocol};
+        }
+
+        return PortMapping(); // not found
+    }
+
+    // Find the owners of many ports, one parse per protocol file and one walk for all of them
+    std::unordered_map<uint16_t, PortMapping> scanForPidsByPorts(const portProtoVec& ports) {
+        std::unordered_map<uint16_t, PortMapping> found;
+        if (ports.empty()) return found;
+        if (ports.size() == 1) {// nothing to share, let the file parse filter on the port
+            PortMapping mapping = scanForPidByPort(ports[0].first, ports[0].second);
+            if (mapping.pid != -1) found[ports[0].first] = mapping;
+            return found;
+        }
+
+        std::unordered_set<uint16_t> tcpPorts, udpPorts;
+        for (const auto& port : ports) {
+            (port.second == 'T' ? tcpPorts : udpPorts).insert(port.first);
+        }
+
+        // Keep only the sockets of the requested ports, a port can have several sockets
+        auto collect = [](char protocol, const std::unordered_set<uint16_t>& wanted) {
+            sockInodePortVec sockets;
+            if (wanted.empty()) return sockets;
+            for (const auto& socket : listSockets(protocol)) {
+                if (wanted.count(socket.second)) sockets.push_back(socket);
             }
+            return sockets;
+        };
+        sockInodePortVec tcpSockets = collect('T', tcpPorts);
+        sockInodePortVec udpSockets = collect('U', udpPorts);
+
+        sockInodePortVec allSockets = tcpSockets;
+        allSockets.insert(allSockets.end(), udpSockets.begin(), udpSockets.end());
+        std::unordered_map<uint64_t, pid_t> owners = findSocketOwners(allSockets);
+
+        // First owner found per port, tcp before udp
+        for (const auto& socket : tcpSockets) {
+            auto owner = owners.find(socket.first);
+            if (owner != owners.end()) found.emplace(socket.second, PortMapping{owner->second, socket.first, 'T'});
+        }
+        for (const auto& socket : udpSockets) {
+            auto owner = owners.find(socket.first);
+            if (owner != owners.end()) found.emplace(socket.second, PortMapping{owner->second, socket.first, 'U'});
         }
+        return found;
+    }
 
-        return -1; // not found
+    // Sockets of a protocol ('T' or 'U'), only the ones bound to filterPort if its not 0
+    sockInodePortVec listSockets(char protocol, uint16_t filterPort) {
+        return parseListeningSockets((protocol == 'T') ? "/proc/net/tcp" : "/proc/net/udp", filterPort);
+    }
+
+    // Start time of a process in clock ticks since boot, 0 if it doesnt exist
+    uint64_t getProcessStartTime(pid_t pid) {
+        std::ifstream statFile("/proc/" + std::to_string(pid) + "/stat");
+        std::string stat;
+        if (!std::getline(statFile, stat)) return 0;
+
+        // The command name (field 2) can hold spaces and parentheses, count fields after the last ')'
+        std::size_t commEnd = stat.rfind(')');
+        if (commEnd == std::string::npos) return 0;
+
+        std::istringstream fields(stat.substr(commEnd + 2));// starts at field 3 (state)
+        std::string field;
+        for (int i = 3; i < 22; i++) {
+            if (!(fields >> field)) return 0;
+        }
+        uint64_t startTime = 0;
+        fields >> startTime;
+        return startTime;
     }
 }
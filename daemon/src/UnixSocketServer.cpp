@@ -1,9 +1,10 @@
 #include "UnixSocketServer.h"
 #include <cstring> // Required for strerror
+#include <cerrno>
 
-// takes the path to the socket file as input
-UnixSocketServer::UnixSocketServer()
-    : socketPath(SOCKET_FILE_ADRESS), serverFd(-1), clientFd(-1){ start(); } // initialize the socket file path and server fd
+// initialize the socket file path and create the listening socket
+UnixSocketServer::UnixSocketServer(const std::string& path)
+    : socketPath(path), serverFd(-1), loop(nullptr) { start(); }
 
 // clean up socket if still open
 UnixSocketServer::~UnixSocketServer() {
@@ -12,19 +13,23 @@ UnixSocketServer::~UnixSocketServer() {
     }
 }
 
- // Closes the socket
- void UnixSocketServer::closeSocket(){
-    closeClientFd();// close the clientFd if open
-    // Close the socket
+// Closes every client and the socket
+void UnixSocketServer::closeSocket(){
+    while (!clients.empty()) {
+        closeClient(clients.begin()->first);
+    }
+    if (serverFd == -1) return;
+
+    if (loop) loop->removeFd(serverFd);
     close(serverFd);
     serverFd = -1; // common safe practive
     unlink(socketPath.c_str());  // Clean up the socket file
- }
+}
 
 // Starts the unix socket server. return true on success and false on failure
 bool UnixSocketServer::start() {
-    // Create a unix domain socket (sock_stream is rlieable, like tcp but local)
-    serverFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    // Create a unix domain socket (sock_stream is rlieable, like tcp but local), non blocking since the event loop drives it
+    serverFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (serverFd < 0) {
         syslog(LOG_ERR, "socket failed: %s", strerror(errno));
         return false;
@@ -54,72 +59,166 @@ bool UnixSocketServer::start() {
 
 }
 
-// Send a uint16_t value to a specific client
-bool UnixSocketServer::sendPid(pid_t pid) const {
-    ssize_t sent = write(clientFd, &pid, sizeof(pid));// It doest matter that pid is local since we only need the value
-    return sent == sizeof(pid);// If they arnt equal the was problem with sending the message
+// Watch the listening socket on the loop, clients are added as they connect
+bool UnixSocketServer::attach(EventLoop& eventLoop, RequestHandler handler) {
+    if (serverFd < 0) return false;
+    loop = &eventLoop;
+    onRequest = std::move(handler);
+    return loop->addFd(serverFd, EPOLLIN, [this](uint32_t) { acceptClients(); });
 }
 
-// Receive a port number from a specific client, check if message recieved or client disconnected (write to port memory)
-bool UnixSocketServer::receivePort(uint16_t& port) const {
-    ssize_t bytes = read(clientFd, &port, sizeof(port));// blocking call
-    
-    // Check if message recieved succecsfully
-    if (bytes == 0) {// If the message is 0 bytes, the client probably disconnected
-        return false;
+// Accept every pending connection and watch it on the loop
+void UnixSocketServer::acceptClients() {
+    while (true) {
+        int clientFd = accept4(serverFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientFd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                syslog(LOG_WARNING, "Client failed to connect: %s", strerror(errno));
+            }
+            return;
+        }
+
+        clients[clientFd] = Client();
+        loop->addFd(clientFd, EPOLLIN | EPOLLRDHUP, [this, clientFd](uint32_t events) {
+            handleClientEvents(clientFd, events);
+        });
+        syslog(LOG_INFO, "Client connected (fd=%d)", clientFd);
     }
-    if (bytes < 0) {// these are probably problems with the socket
-        syslog(LOG_ERR, "read failed: %s", strerror(errno));
-        return false;
+}
+
+// Read requests or flush replies for a client the loop reported ready
+void UnixSocketServer::handleClientEvents(int clientFd, uint32_t events) {
+    if (events & EPOLLOUT) flushClient(clientFd);
+    if (!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) return;
+
+    // Read everything the client sent so far
+    char buffer[4096];
+    bool disconnected = false;
+    while (true) {
+        ssize_t bytes = read(clientFd, buffer, sizeof(buffer));
+        if (bytes > 0) {
+            clients[clientFd].inBuf.append(buffer, bytes);
+            continue;
+        }
+        if (bytes == 0) {// the client disconnected
+            disconnected = true;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {// these are probably problems with the socket
+            syslog(LOG_ERR, "read failed: %s", strerror(errno));
+            disconnected = true;
+        }
+        break;
     }
-    if (bytes != sizeof(port)) {
-        syslog(LOG_ERR, "Bad message (fd=%d)", clientFd);
-        return false;
+
+    // Answer every whole request, a request split between reads waits for the rest
+    size_t offset = 0;
+    while (clients.count(clientFd)) {
+        const std::string& inBuf = clients[clientFd].inBuf;
+        if (inBuf.size() - offset < sizeof(uint16_t)) break;
+
+        // A bare port is the old request, port 0 starts a framed one (some types carry a payload after it)
+        DaemonRequest request;
+        const char* payload = nullptr;
+        uint16_t port;
+        std::memcpy(&port, inBuf.data() + offset, sizeof(port));
+        if (port != FRAMED_REQUEST_MARKER) {
+            request.type = DaemonRequestType::RawPidByPort;
+            request.port = port;
+            offset += sizeof(port);
+        } else {
+            if (inBuf.size() - offset < sizeof(request)) break;
+            std::memcpy(&request, inBuf.data() + offset, sizeof(request));
+            size_t payloadLength = requestPayloadLength(request.type);
+            if (inBuf.size() - offset < sizeof(request) + payloadLength) break;
+            if (payloadLength) payload = inBuf.data() + offset + sizeof(request);
+            offset += sizeof(request) + payloadLength;
+        }
+        onRequest(clientFd, request, payload);
     }
+    auto it = clients.find(clientFd);
+    if (it == clients.end()) return;// closed by the handler
+    it->second.inBuf.erase(0, offset);
 
-    return true;
+    if (disconnected) {
+        syslog(LOG_INFO, "Client disconnected (fd=%d)", clientFd);
+        closeClient(clientFd);
+    }
 }
 
-// Returns the servers fd
-int UnixSocketServer::getServerFd() const{
-    return this->serverFd;
+// Set the handler called whenever a client is closed
+void UnixSocketServer::setDisconnectHandler(DisconnectHandler handler) {
+    onDisconnect = std::move(handler);
 }
 
-// Wait for client connection and connect
-bool UnixSocketServer::connectToClient(){
-    clientFd = accept(serverFd, nullptr, nullptr);// blocking waiting for the app to connect to daemon using socket accept
-    if (clientFd < 0 || isShuttingDown) {
-        return false;// Failed to connecto to client
-    }
-    syslog(LOG_INFO, "Client connected (fd=%d)", clientFd);
-    return true;
+// Send a pid to the client
+bool UnixSocketServer::sendPid(int clientFd, pid_t pid) {
+    return sendToClient(clientFd, &pid, sizeof(pid));// It doest matter that pid is local since we only need the value
 }
 
-int UnixSocketServer::getClientFd() const{
-    return clientFd;
+// Send a framed reply, a header and length bytes of payload
+bool UnixSocketServer::sendReply(int clientFd, DaemonRequestType type, ReplyStatus status, const void* payload, uint32_t length) {
+    DaemonReplyHeader header{type, status, length};
+    if (!sendToClient(clientFd, &header, sizeof(header))) return false;
+    return length == 0 || sendToClient(clientFd, payload, length);
 }
 
-// Disconnects client to allow new client 
-void UnixSocketServer::closeClientFd(){
-    if(clientFd != -1){
-        close(clientFd);
-        clientFd = -1;
+// Write as much as possible now, keep the rest until the socket is writable
+bool UnixSocketServer::sendToClient(int clientFd, const void* data, size_t len) {
+    auto it = clients.find(clientFd);
+    if (it == clients.end()) return false;
+    Client& client = it->second;
+
+    size_t sent = 0;
+    if (client.outBuf.empty()) {// nothing queued before, so order is kept
+        ssize_t res = send(clientFd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (res < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return false;
+        if (res > 0) sent = res;
+    }
+    if (sent == len) return true;
+
+    // The client isnt reading, drop it instead of growing its queue forever
+    if (client.outBuf.size() + (len - sent) > MAX_PENDING_OUTPUT) {
+        syslog(LOG_WARNING, "Client (fd=%d) stopped reading, disconnecting", clientFd);
+        closeClient(clientFd);
+        return false;
     }
+    bool wasEmpty = client.outBuf.empty();
+    client.outBuf.append(static_cast<const char*>(data) + sent, len - sent);
+    if (wasEmpty) loop->modifyFd(clientFd, EPOLLIN | EPOLLRDHUP | EPOLLOUT);
+    return true;
 }
 
-// Stops the server from listening for new clients(closes client/server fds, unlinks socket path)
-// by sending a fake empty connection to break the accept block
-void UnixSocketServer::stopListeningForNewClients(){
-    this->isShuttingDown = true;
-    int tmpSock = socket(AF_UNIX, SOCK_STREAM, 0);// Opens temporary socket for dummy connection
-    if (tmpSock >= 0) {
-        // initilize socket to simulate client
-        sockaddr_un addr{};
-        addr.sun_family = AF_UNIX;
-        std::strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
-        
-        // connect to server to break block, then disconnect
-        connect(tmpSock, (sockaddr*)&addr, sizeof(addr));
-        close(tmpSock);  // one-time connection
+// Write queued replies, stop watching for EPOLLOUT once they are all sent
+void UnixSocketServer::flushClient(int clientFd) {
+    auto it = clients.find(clientFd);
+    if (it == clients.end()) return;
+    Client& client = it->second;
+
+    while (!client.outBuf.empty()) {
+        ssize_t res = send(clientFd, client.outBuf.data(), client.outBuf.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (res <= 0) {
+            if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;// wait for the next EPOLLOUT
+            closeClient(clientFd);
+            return;
+        }
+        client.outBuf.erase(0, res);
     }
-}
\ No newline at end of file
+    loop->modifyFd(clientFd, EPOLLIN | EPOLLRDHUP);
+}
+
+// Disconnect a single client
+void UnixSocketServer::closeClient(int clientFd) {
+    if (clients.erase(clientFd) == 0) return;
+    if (loop) loop->removeFd(clientFd);
+    if (onDisconnect) onDisconnect(clientFd);
+    close(clientFd);
+}
+
+// Returns the servers fd
+int UnixSocketServer::getServerFd() const{
+    return this->serverFd;
+}
+
+// Number of connected clients
+size_t UnixSocketServer::getClientCount() const {
+    return clients.size();
+}
@@ -1,6 +1,12 @@
 #include "PortToPidMap.h"// The map that will keep the pid for packets ports
 #include "UserSpaceConfig.h"// for useful headers and shared ptrs
 #include "UnixSocketServer.h" 
+#include "ProcessInfoCache.h"// metadata of the processes clients ask about
+#include "PacketStreamer.h"// streams annotated packets to subscribed clients
+#include "DaemonMetrics.h"// latency histograms for the stats request
+#include "CgroupTraffic.h"// traffic per cgroup / container
+#include "DaemonOptions.h"// command line options
+#include "OverloadControl.h"// sheds resolver work when it falls behind
 #include <unistd.h> // files functions (close, unlink, read, write)
 #include <sys/socket.h> // for socket functions like accept
 #include <syslog.h>// for log (no cout for daemons)
@@ -11,136 +17,268 @@ using PortToPidMapReadPtr = std::shared_ptr<const PortToPidMap>;// for the port
 using PortToPidMapPtr = std::shared_ptr<PortToPidMap>;// for the port to pid map
 using UnixSocketServerPtr = std::shared_ptr<UnixSocketServer>;
 
+// How often the port to pid map is saved for a warm restart
+constexpr int SNAPSHOT_INTERVAL_SECONDS = 30;
 
-// The thread for the client (packet hunter) daemon communication (using unix dumain socket), wait for client to connect, then listen for messages from client
-void clientConnectionThread(PortToPidMapReadPtr portPidMap, UnixSocketServerPtr unixServer, std::atomic<bool>& running);
+// How often the mapping changes are written to the history
+constexpr int JOURNAL_FLUSH_SECONDS = 1;
 
-// Listen to client and answer
-void handleClientConnection(PortToPidMapReadPtr portPidMap, UnixSocketServerPtr unixServer,std::atomic<bool>& running);
+// How often the process metadata of exited processes is dropped
+constexpr int PROCESS_CACHE_EXPIRE_SECONDS = 5;
 
-int main() {
-    
-    // Capture signals to end the program
-    std::signal(SIGINT, handleSignal); // For Ctrl+C
-    std::signal(SIGTERM, handleSignal);// For terminate (will be sent from main menu script) 
+// Most queued packets the resolver takes at once, their ports are resolved with a single /proc scan
+constexpr size_t RESOLVE_BATCH_SIZE = 256;
+
+// Packets waiting for the resolver past this are dropped (the overload stages should keep it far below)
+constexpr size_t MAX_QUEUED_PACKETS = 65536;
+
+// How often the overload level is checked against the queue
+constexpr auto OVERLOAD_CHECK_INTERVAL = std::chrono::milliseconds(100);
+
+
+// The thread that resolves the ports of queued packets (scanning /proc is too slow for the event loop thread)
+void resolvePacketsThread(PortToPidMapPtr portPidMap, MessageQueuePtr messageQueue, PacketStreamer& streamer, DaemonMetrics& metrics);
+
+// Answer a request from a client (packet hunter), runs on the event loop
+void handleClientRequest(PortToPidMapReadPtr portPidMap, ProcessInfoCache& processCache, const DaemonMetrics& metrics, UnixSocketServer& unixServer, int clientFd, const DaemonRequest& request);
 
+int main(int argc, char* argv[]) {
+    DaemonOptions options;
+    if (!parseDaemonOptions(argc, argv, options)) return -1;
+    bool fixedTable = !options.portTablePath.empty();// load test, no kernel module
     
     // Using syslog for logging, using log_daemon format, writes to /var/log/syslog app name portmon_daemon, print error to conlose
     openlog("portmon_daemon", LOG_PID | LOG_CONS, LOG_DAEMON);
+    setlogmask(LOG_UPTO(options.verbose ? LOG_DEBUG : LOG_INFO));// per query lines only with -v
  
     syslog(LOG_INFO, "Activated Port Monitor Terminal");
+
+    // Everything but the resolver runs on this loop: kernel messages, clients and signals
+    EventLoop loop;
+    if (!loop.isValid()) {
+        syslog(LOG_ERR, "Failed to create event loop");
+        return -1;
+    }
+
+    // Capture signals to end the program, SIGINT for Ctrl+C and SIGTERM from main menu script / systemd
+    // (blocks them before any thread starts, they are read from a signalfd on the loop)
+    loop.watchSignals({SIGINT, SIGTERM}, [&loop](int signum) {
+        syslog(LOG_INFO, "Received signal %d, stopping", signum);
+        loop.stop();
+    });
  
     // Initilize the global variables
-    NetLinkClientPtr client = std::make_shared<NetLinkClient>();// Create Netlink client
-    PortToPidMapPtr portPidMap = std::make_shared<PortToPidMap>(); // Initialize the database of ports and pids
-    MessageQueuePtr messageQueue = std::make_shared<MessageQueue>();// Create the message queue
-    UnixSocketServerPtr unixServer = std::make_shared<UnixSocketServer>();// initilize the server
+    NetLinkClientPtr client = fixedTable ? nullptr : std::make_shared<NetLinkClient>();// Create Netlink client
+    PortToPidMapPtr portPidMap;
+    std::shared_ptr<MappingJournal> journal;// history of the mappings, not kept for a fixed table
+    if (fixedTable) {
+        std::unordered_map<uint16_t, PortMapping> table;
+        if (!PortMapSnapshot::loadTable(options.portTablePath, table)) return -1;
+        portPidMap = std::make_shared<PortToPidMap>(table);
+    } else {
+        journal = std::make_shared<MappingJournal>(options.historyDir);
+        portPidMap = std::make_shared<PortToPidMap>(PORT_MAP_SNAPSHOT_PATH, journal); // Initialize the database of ports and pids (from the last snapshot if its still valid)
+    }
+    MessageQueuePtr messageQueue = std::make_shared<MessageQueue>(MAX_QUEUED_PACKETS);// Create the message queue
+    UnixSocketServerPtr unixServer = std::make_shared<UnixSocketServer>(options.socketPath);// initilize the server
+    
+    ProcessInfoCache processCache;// only touched on the loop thread
+    DaemonMetrics metrics;// recorded by the loop and the resolver
+    UnixSocketServer& server = *unixServer;// the server owns these callbacks, dont hold a shared_ptr to itself
+    PacketStreamer streamer(loop, server, portPidMap, processCache, metrics);
+    CgroupTraffic cgroupTraffic(portPidMap, processCache);// only touched on the loop thread
+    OverloadControl overload(messageQueue, portPidMap, metrics, [client](unsigned rate) {// only touched on the loop thread
+        return client && client->sendMessage("daemon_sample " + std::to_string(rate));
+    });
     
-    // start the thread that listen to new apps and connect them to daemon
-    std::thread clientConnection(clientConnectionThread, portPidMap, unixServer, std::ref(running));
+    // Bumped whenever a client fd is closed, a history reply computed off the loop is only sent if its fd
+    // still belongs to the client that asked (only touched on the loop thread)
+    std::unordered_map<int, uint64_t> clientGenerations;
+
+    // Serve any number of clients from the loop, subscribers get every packet with its pid
+    unixServer->attach(loop, [portPidMap, journal, &loop, &clientGenerations, &processCache, &metrics, &server, &streamer, &cgroupTraffic](int clientFd, const DaemonRequest& request, const char* payload) {
+        if (request.type == DaemonRequestType::SubscribePackets) {
+            streamer.addSubscriber(clientFd, request.flags);
+            return;
+        }
+        if (request.type == DaemonRequestType::CgroupTraffic) {
+            std::vector<CgroupTrafficEntry> entries = cgroupTraffic.snapshot();
+            server.sendReply(clientFd, request.type, ReplyStatus::Ok, entries.data(), entries.size() * sizeof(CgroupTrafficEntry));
+            return;
+        }
+        if (request.type == DaemonRequestType::MappingHistory) {
+            if (!journal) {
+                server.sendReply(clientFd, request.type, ReplyStatus::BadRequest, nullptr, 0);
+                return;
+            }
+            MappingHistoryQuery range;
+            std::memcpy(&range, payload, sizeof(range));
+            // The segments are read on the journals query thread, the reply is sent back on the loop
+            uint64_t generation = clientGenerations[clientFd];
+            journal->queryAsync(request.port, range, [&loop, &server, &clientGenerations, clientFd, generation, type = request.type](std::vector<MappingHistoryEntry> entries, bool truncated) {
+                loop.post([&server, &clientGenerations, clientFd, generation, type, entries = std::move(entries), truncated]() {
+                    if (clientGenerations[clientFd] != generation) return;// the client left, the fd may be someone else by now
+                    ReplyStatus status = truncated ? ReplyStatus::Truncated : entries.empty() ? ReplyStatus::NotFound : ReplyStatus::Ok;
+                    server.sendReply(clientFd, type, status, entries.data(), entries.size() * sizeof(MappingHistoryEntry));
+                });
+            });
+            return;
+        }
+        handleClientRequest(portPidMap, processCache, metrics, server, clientFd, request);
+    });
+    unixServer->setDisconnectHandler([&streamer, &clientGenerations](int clientFd) {
+        streamer.removeSubscriber(clientFd);
+        clientGenerations[clientFd]++;
+    });
 
     // subscribe to kernel module messages
-    if (!client->sendMessage("daemon_subscribe")) {
+    if (client && !client->sendMessage("daemon_subscribe")) {
         syslog(LOG_ERR, "Failed to send message to kernel");
         return -1;
     }
     
-    running = true;  // Force reinitialize in the child
-
-    // Start the receiver thread, send const pointer to the client (recv is const)
-    std::thread packetInfoListener(SharedUserFunctions::recvPacketInfoThread, NetLinkClientRecievePtr(client), messageQueue, std::ref(running));
-
-    // Main loop, poll the queue for messages
-    while (running) {
-        const pckt_info* pckt = messageQueue->pop();
-        if (!pckt) {
-            // If queue is empty, wait a bit before checking again (avoid busy looping)
-            std::this_thread::sleep_for(std::chrono::milliseconds(5));
-            continue;
-        }
-        // A packet was received, update port-PID map
-        if(portPidMap->addPidMapping(pckt->dst_port, pckt->proto)){// find the pid of the process using the port      
-            syslog(LOG_INFO, "Port: %u, PID: %d mapping added", pckt->dst_port, portPidMap->getPid(pckt->dst_port));
-        }
-    
-        // Free the packet info structure
-        client->freePacketInfo(pckt);// free the allocated memory for the message
+    // Start the resolver thread, it sleeps on the queue until packets arrive
+    std::thread resolver(resolvePacketsThread, portPidMap, messageQueue, std::ref(streamer), std::ref(metrics));
+
+    // Kernel messages are read as soon as the socket is readable and queued for the resolver,
+    // subscribers get a copy annotated with the pid (or held until the resolver maps its port)
+    if (client) {
+        client->setNonBlocking();
+        loop.addFd(client->getSocketFd(), EPOLLIN, [client, &streamer, &metrics, &cgroupTraffic, &overload](uint32_t) {
+            SharedUserFunctions::drainNetLink(client, [&streamer, &metrics, &cgroupTraffic, &overload](const pckt_info* records, size_t count) {
+                uint64_t now = monotonicNs();
+                for (size_t i = 0; i < count; i++) {
+                    metrics.latency[STAGE_KERNEL_TO_DAEMON].recordSince(records[i].tstamp_ns, now);
+                    streamer.onPacket(&records[i]);
+                    cgroupTraffic.onPacket(&records[i]);
+                }
+                overload.queuePackets(records, count);// all of them unless the resolver is falling behind
+                return true;
+            });
+            streamer.flush();
+        });
+    }
+
+    // Save the map every now and then, a crash only loses the last interval (written on the save thread,
+    // it reads /proc once per port)
+    loop.addTimer(std::chrono::seconds(SNAPSHOT_INTERVAL_SECONDS), [portPidMap]() {
+        portPidMap->saveSnapshotAsync();
+    });
+
+    // Write the mapping changes to the history
+    if (journal) {
+        loop.addTimer(std::chrono::seconds(JOURNAL_FLUSH_SECONDS), [journal]() { journal->flush(); });
     }
+
+    // Forget the metadata of processes that exited
+    loop.addTimer(std::chrono::seconds(PROCESS_CACHE_EXPIRE_SECONDS), [&processCache, &cgroupTraffic]() {
+        processCache.expireExited();
+        cgroupTraffic.prune(std::chrono::steady_clock::now());
+    });
+
+    // Shed resolver work while the queue is deep or old, recover once it drains
+    loop.addTimer(OVERLOAD_CHECK_INTERVAL, [&overload]() {
+        overload.update(std::chrono::steady_clock::now());
+    });
+
+    loop.run();// returns on SIGINT/SIGTERM
+    if (journal) journal->stopQueries();// their replies would be posted to a loop that doesnt run anymore
     
-    // Unsubscribe from kernel module and stop receiver thread
-    if (!client->sendMessage("daemon_unsubscribe")) {
+    // Unsubscribe from kernel module and stop the resolver thread
+    if (client && !client->sendMessage("daemon_unsubscribe")) {
         syslog(LOG_ERR, "Failed to send message to kernel");
-        return -1;
     }
-    packetInfoListener.join();
-   
-    // Free remainig messages in message queue
-    SharedUserFunctions::cleanMessageQueue(messageQueue, client);
+    messageQueue->close();
+    resolver.join();
     
-    // Close active connection if conncected 
-    if(unixServer->getClientFd() > 0){
-        shutdown(unixServer->getClientFd(), SHUT_RD);
-        unixServer->closeClientFd();
+    // Close active connections and the server socket
+    unixServer->closeSocket();
+
+    // Keep the final map for the next start, and its last changes in the history
+    if (journal) journal->flush();
+    if (!portPidMap->saveSnapshot()) {
+        syslog(LOG_WARNING, "Failed to save port map snapshot");
     }
-    
-    // Close server socket and join the app client connection thread
-    unixServer->stopListeningForNewClients();
-    clientConnection.join();    
 
     syslog(LOG_INFO, "Port Monitor Daemon terminated");
     return 0;
 }
 
-// The thread for connected app, wait for messages containing ports and returns pid from the port pid map 
-void clientConnectionThread(PortToPidMapReadPtr portPidMap, UnixSocketServerPtr unixServer, std::atomic<bool>& running) {
-   
-    while(running){   
-        // waiting for client to connect
-        syslog(LOG_INFO, "Waiting for client to connect");
-        
-        // Waiting for clients connection
-        if(!unixServer->connectToClient()){// blocking call
-            // Failed to connect
-            if(running){// If The program wasnt ended
-                syslog(LOG_WARNING, "Client failed to connect");
-            }
-            unixServer->closeClientFd();
-            continue;
+// Resolve the port of every queued packet, blocks on the queue while it is empty
+void resolvePacketsThread(PortToPidMapPtr portPidMap, MessageQueuePtr messageQueue, PacketStreamer& streamer, DaemonMetrics& metrics) {
+    std::vector<MessageQueue::Entry> batch;
+    portProtoVec ports;
+    std::unordered_set<uint32_t> seen;// (proto << 16) | port, so a burst for one port is scanned once
+    std::unordered_set<uint16_t> mappedPorts;
+    batch.reserve(RESOLVE_BATCH_SIZE);
+
+    while (messageQueue->waitPopBatch(batch, RESOLVE_BATCH_SIZE)) {// false once the queue is closed
+        uint64_t scanStartNs = monotonicNs();
+
+        // Every (protocol, port) of the batch once, in arrival order
+        ports.clear();
+        seen.clear();
+        for (const MessageQueue::Entry& entry : batch) {
+            metrics.latency[STAGE_QUEUE_WAIT].recordSince(entry.enqueuedNs, scanStartNs);
+            uint32_t key = (static_cast<uint32_t>(static_cast<unsigned char>(entry.pckt.proto)) << 16) | entry.pckt.dst_port;
+            if (seen.insert(key).second) ports.emplace_back(entry.pckt.dst_port, entry.pckt.proto);
         }
-        
-        // Client connected succecssfully, listen to client and answer
-        handleClientConnection(portPidMap, unixServer, running);// blocking call  
-        
-        // Remove the app from the connectedApps map
-        syslog(LOG_INFO, "Client disconnected (fd=%d)", unixServer->getClientFd());
 
-        // disconnect client to allow new one
-        unixServer->closeClientFd();
+        // Packets arrived, update port-PID map with one scan for the whole batch
+        std::vector<uint16_t> mapped = portPidMap->addPidMappings(ports);
+        uint64_t scanEndNs = monotonicNs();
+        metrics.latency[STAGE_PORT_SCAN].recordSince(scanStartNs, scanEndNs);
+
+        mappedPorts.clear();
+        for (uint16_t port : mapped) {
+            mappedPorts.insert(port);
+            syslog(LOG_INFO, "Port: %u, PID: %d mapping added", port, portPidMap->getPid(port));
+        }
+        for (const MessageQueue::Entry& entry : batch) {
+            if (mappedPorts.count(entry.pckt.dst_port)) {
+                metrics.latency[STAGE_KERNEL_TO_MAPPED].recordSince(entry.pckt.tstamp_ns, scanEndNs);
+            }
+        }
+        for (const auto& port : ports) {
+            streamer.notifyResolved(port.first);// release packets held for this port (found or not)
+        }
     }
-    
 }
 
-// Listen to client and answer
-void handleClientConnection(PortToPidMapReadPtr portPidMap, UnixSocketServerPtr unixServer,std::atomic<bool>& running){
-    if (unixServer->getClientFd() < 0) return; // if connection somehow isnt valid
-    
-    // Listen to client and and answer its port requests
-    uint16_t port;
-    pid_t pid;
-    while (running) {// On stopping main will close client fd, recieve port will break loop
-        if(!unixServer->receivePort(port)) break;// blocking, waiting to recieve message from client
-        
-        // Get the ports pid or nullptr if unknown and send to client
-        pid = portPidMap->getPid(port);
-        if(pid) {// send and logging
-            syslog(LOG_INFO, "Client (fd=%d) requested port %u, sent PID: %d", unixServer->getClientFd(), port, pid);
-            unixServer->sendPid(pid);
-        } else {
-            syslog(LOG_INFO, "Client (fd=%d) requested port %u,  sent PID: unknown", unixServer->getClientFd(), port);
-            unixServer->sendPid(-1);// send -1 to client
-        }
-        
+// Answer a request from a client with the pid from the map (-1 if unknown), and the process metadata if asked
+void handleClientRequest(PortToPidMapReadPtr portPidMap, ProcessInfoCache& processCache, const DaemonMetrics& metrics, UnixSocketServer& unixServer, int clientFd, const DaemonRequest& request) {
+    if (request.type == DaemonRequestType::Stats) {
+        DaemonStats stats;
+        metrics.fill(stats);
+        unixServer.sendReply(clientFd, request.type, ReplyStatus::Ok, &stats, sizeof(stats));
+        return;
+    }
+    if (request.type != DaemonRequestType::RawPidByPort && request.type != DaemonRequestType::PidByPort) {
+        syslog(LOG_WARNING, "Client (fd=%d) sent unknown request type %u", clientFd, static_cast<unsigned>(request.type));
+        unixServer.sendReply(clientFd, request.type, ReplyStatus::BadRequest, nullptr, 0);
+        return;
+    }
+
+    pid_t pid = portPidMap->getPid(request.port);
+    if(pid != -1) {// logging, debug only (filtered by the log mask before any syscall unless -v)
+        syslog(LOG_DEBUG, "Client (fd=%d) requested port %u, sent PID: %d", clientFd, request.port, pid);
+    } else {
+        syslog(LOG_DEBUG, "Client (fd=%d) requested port %u,  sent PID: unknown", clientFd, request.port);
+    }
+
+    if (request.type == DaemonRequestType::RawPidByPort) {
+        unixServer.sendPid(clientFd, pid);
+        return;
+    }
+
+    // Framed reply, the metadata comes from the cache (a process that exited meanwhile is reported as not found)
+    ProcessInfo info;
+    info.pid = pid;
+    if (pid != -1 && (request.flags & REQUEST_FLAG_METADATA) && !processCache.lookup(pid, info)) {
+        info = ProcessInfo();
     }
+    ReplyStatus status = (info.pid == -1) ? ReplyStatus::NotFound : ReplyStatus::Ok;
+    unixServer.sendReply(clientFd, request.type, status, &info, sizeof(info));
 }
 
 void daemonize() {
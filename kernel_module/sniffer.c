@@ -14,11 +14,31 @@
 #include <linux/udp.h>
 // needed for kmalloc and kfree
 #include <linux/slab.h>  
+// Sampling and per flow rate limiting
+#include <linux/moduleparam.h>
+#include <linux/jhash.h>
+#include <linux/spinlock.h>
+#include <linux/atomic.h>
+#include <linux/math64.h>
+// ktime_get_ns, packets are stamped with CLOCK_MONOTONIC
+#include <linux/timekeeping.h>
+// Per cpu event counters, read through debugfs
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+// Deferred sends, a per cpu work item drains what the hook staged
+#include <linux/workqueue.h>
+#include <linux/bottom_half.h>
+// The hook is registered from the netlink input, which may run for several senders at once
+#include <linux/mutex.h>
 // Netlink socket
 #include <net/sock.h>
 #include <linux/netlink.h>
 // Project netlink config
 #include "../shared/config/NetLinkConfig.h" 
+// Tracepoints, defined in this file
+#define CREATE_TRACE_POINTS
+#include "sniffer_trace.h"
 
 
 
@@ -30,6 +50,9 @@ MODULE_VERSION("0.1");
 
 
 static struct nf_hook_ops nfho;  // Netfilter hook options struct
+static bool hook_registered = false; // the hook is only registered while someone is subscribed
+// Protects hook_registered and the subscribed flags and pids below (the hook and send work only read those)
+static DEFINE_MUTEX(subscribe_mutex);
 struct sock *nl_sk = NULL; // Netlink socket struct, used to send messages to user space
 
 // Netlink clients subscribed to the kernel module, and thir PIDs
@@ -38,64 +61,363 @@ static int daemon_subscribed = 0;
 static u32 packet_hunter_pid = 0;
 static u32 daemon_pid = 0;
 
+// Sampling and rate limiting, adjustable at runtime in /sys/module/sniffer/parameters/ (no reload needed).
+// Every record carries sample_weight, the packets it stands for, so user space can scale its counts back up
+static unsigned int sample_rate = 1;
+module_param(sample_rate, uint, 0644);
+MODULE_PARM_DESC(sample_rate, "Forward 1 in N packets to every subscriber (1 = all)");
+
+static unsigned int flow_rate_limit = 0;
+module_param(flow_rate_limit, uint, 0644);
+MODULE_PARM_DESC(flow_rate_limit, "Packets per second forwarded per flow (0 = no limit)");
+
+static unsigned int flow_burst = 32;
+module_param(flow_burst, uint, 0644);
+MODULE_PARM_DESC(flow_burst, "Packets a flow may send at once before flow_rate_limit applies");
+
+static atomic_t sample_count = ATOMIC_INIT(0);
+
+// Per subscriber sampling on top of the global one, set with "<client>_sample N" (reset on subscribe)
+static unsigned int packet_hunter_sample = 1;
+static unsigned int daemon_sample = 1;
+static atomic_t packet_hunter_sample_count = ATOMIC_INIT(0);
+static atomic_t daemon_sample_count = ATOMIC_INIT(0);
+
+// Token bucket per flow. Flows are hashed into a fixed table, flows that collide share a bucket
+#define FLOW_BUCKETS 4096
+struct flow_bucket {
+    spinlock_t lock;
+    u64 tokens;   // NSEC_PER_SEC per packet, so refilling is elapsed_ns * rate
+    u64 last_ns;  // last refill, 0 for a bucket no flow used yet
+    u32 dropped;  // packets dropped since the last forwarded one, added to its weight
+};
+static struct flow_bucket flow_buckets[FLOW_BUCKETS];
+
+// Events of the hook and send paths, counted per cpu (no shared cache line is written per packet)
+// and summed when /sys/kernel/debug/sniffer/stats is read
+enum sniffer_stat {
+    STAT_SEEN,           // packets the hook was called for
+    STAT_TOO_SHORT,      // NULL or shorter than an ip header
+    STAT_UNSUPPORTED,    // not TCP or UDP
+    STAT_RATE_LIMITED,   // dropped by the per flow token bucket
+    STAT_SAMPLED_OUT,    // skipped by the global sample_rate
+    STAT_SENT,           // records sent to a subscriber
+    STAT_ALLOC_FAIL,     // nlmsg_new failed
+    STAT_PUT_FAIL,       // nlmsg_put failed
+    STAT_UNICAST_FAIL,   // netlink_unicast failed (usually the subscribers socket buffer is full)
+    STAT_STAGED,         // records the hook staged for the send work
+    STAT_STAGE_FULL,     // records dropped since the cpus staging buffer was full (the work fell behind)
+    STAT_HOOK_NS,        // total time spent in the hook, divide by seen for the average
+    STAT_COUNT
+};
+
+static const char *const sniffer_stat_names[STAT_COUNT] = {
+    [STAT_SEEN] = "seen",
+    [STAT_TOO_SHORT] = "too_short",
+    [STAT_UNSUPPORTED] = "unsupported_proto",
+    [STAT_RATE_LIMITED] = "rate_limited",
+    [STAT_SAMPLED_OUT] = "sampled_out",
+    [STAT_SENT] = "sent",
+    [STAT_ALLOC_FAIL] = "nlmsg_new_fail",
+    [STAT_PUT_FAIL] = "nlmsg_put_fail",
+    [STAT_UNICAST_FAIL] = "unicast_fail",
+    [STAT_STAGED] = "staged",
+    [STAT_STAGE_FULL] = "stage_full",
+    [STAT_HOOK_NS] = "hook_ns",
+};
+
+// Hook latency histogram, bucket i counts calls that took [2^(i-1), 2^i) ns
+#define HOOK_LATENCY_BUCKETS 32
+
+struct sniffer_stats {
+    u64 counters[STAT_COUNT];
+    u64 hook_latency[HOOK_LATENCY_BUCKETS];
+};
+static DEFINE_PER_CPU(struct sniffer_stats, sniffer_stats);
+static struct dentry *debugfs_dir;
+
+// this_cpu_add is safe from the hook (softirq) and from the netlink input (process context)
+static inline void stat_add(enum sniffer_stat stat, u64 value) {
+    this_cpu_add(sniffer_stats.counters[stat], value);
+}
+
+// One "name value" line per counter, summed over every cpu (a cpu may be counting meanwhile, each value is exact on its own)
+static int stats_show(struct seq_file *m, void *v) {
+    u64 totals[STAT_COUNT] = { 0 };
+    int cpu, i;
+
+    for_each_possible_cpu(cpu) {
+        const struct sniffer_stats *stats = per_cpu_ptr(&sniffer_stats, cpu);
+        for (i = 0; i < STAT_COUNT; i++)
+            totals[i] += READ_ONCE(stats->counters[i]);
+    }
+    for (i = 0; i < STAT_COUNT; i++)
+        seq_printf(m, "%s %llu\n", sniffer_stat_names[i], totals[i]);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
 
+// Count one hook call of ns nanoseconds
+static inline void hook_latency_add(u64 ns) {
+    stat_add(STAT_HOOK_NS, ns);
+    this_cpu_inc(sniffer_stats.hook_latency[min_t(unsigned int, fls64(ns), HOOK_LATENCY_BUCKETS - 1)]);
+}
 
-// Creat pckt info struct to send based of data from hook
-static struct pckt_info* create_message( u32 src_ip, u32 dst_ip, u16 src_port, u16 dst_port, char proto) {
-    struct pckt_info *msg = kmalloc(sizeof(*msg), GFP_ATOMIC);
-    if (!msg) {
-        pr_err("sniffer: Failed to allocate memory for packet info\n");
-        return NULL;
+// The hook latency histogram summed over every cpu, with the average and the buckets p50 and p99 fall in
+// (read it before and after a change, under the same load, to see what the change costs per packet)
+static int hook_latency_show(struct seq_file *m, void *v) {
+    u64 buckets[HOOK_LATENCY_BUCKETS] = { 0 };
+    u64 calls = 0, total_ns = 0, seen = 0;
+    u64 p50 = 0, p99 = 0;
+    int cpu, i;
+
+    for_each_possible_cpu(cpu) {
+        const struct sniffer_stats *stats = per_cpu_ptr(&sniffer_stats, cpu);
+        for (i = 0; i < HOOK_LATENCY_BUCKETS; i++)
+            buckets[i] += READ_ONCE(stats->hook_latency[i]);
+        total_ns += READ_ONCE(stats->counters[STAT_HOOK_NS]);
+    }
+    for (i = 0; i < HOOK_LATENCY_BUCKETS; i++)
+        calls += buckets[i];
+
+    // Percentiles are the upper bound of their bucket
+    for (i = 0; i < HOOK_LATENCY_BUCKETS; i++) {
+        seen += buckets[i];
+        if (!p50 && seen * 2 >= calls)
+            p50 = 1ULL << i;
+        if (!p99 && seen * 100 >= calls * 99)
+            p99 = 1ULL << i;
     }
 
-    // Fill the packet info struct with the packet's info
+    seq_printf(m, "calls %llu\n", calls);
+    seq_printf(m, "avg_ns %llu\n", calls ? div64_u64(total_ns, calls) : 0);
+    seq_printf(m, "p50_ns_below %llu\n", calls ? p50 : 0);
+    seq_printf(m, "p99_ns_below %llu\n", calls ? p99 : 0);
+    for (i = 0; i < HOOK_LATENCY_BUCKETS; i++)
+        if (buckets[i])
+            seq_printf(m, "below_%llu_ns %llu\n", 1ULL << i, buckets[i]);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(hook_latency);
+
+
+
+// Fill the pckt info struct to send based of data from hook (zeroed first, the padding goes to user space too)
+static void fill_packet_info(struct pckt_info *msg, u32 src_ip, u32 dst_ip, u16 src_port, u16 dst_port, u32 payload_size, char proto, u64 tstamp_ns) {
+    memset(msg, 0, sizeof(*msg));
     msg->src_ip = src_ip;
     msg->dst_ip = dst_ip;
     msg->src_port = src_port;
     msg->dst_port = dst_port;
+    msg->payload_size = payload_size;
     msg->proto = proto;
+    msg->sample_weight = 1;
+    msg->tstamp_ns = tstamp_ns;
+}
 
-    return msg;
-    
+// weight scaled by a sampling rate, in u64 and clamped so runtime rates cant wrap it to a small weight
+static u32 scale_weight(u32 weight, unsigned int rate) {
+    if (rate <= 1)
+        return weight;
+    return min_t(u64, (u64)weight * rate, U32_MAX);
 }
 
-// Sends a single pckt_info struct to a client using Netlink
-static void send_packet_info_to_user(u32 pid, const struct pckt_info *msg) {
+// 1 in rate sampling on a shared counter, true if this packet is forwarded
+static bool sample_take(atomic_t *count, unsigned int rate) {
+    if (rate <= 1)
+        return true;
+    return ((unsigned int)atomic_inc_return(count) % rate) == 0;
+}
+
+// Token bucket of the packets flow. Returns the weight of the packet if it is forwarded
+// (1 + the packets of its bucket dropped since the last forwarded one), 0 if it is dropped
+static u32 flow_rate_check(u32 src_ip, u32 dst_ip, u16 src_port, u16 dst_port, char proto, u64 now_ns) {
+    unsigned int limit = READ_ONCE(flow_rate_limit);
+    unsigned int burst = READ_ONCE(flow_burst);
+    struct flow_bucket *bucket;
+    u64 capacity, elapsed;
+    u32 weight = 0;
+
+    if (!limit)
+        return 1;
+    if (!burst)
+        burst = 1;
+    capacity = (u64)burst * NSEC_PER_SEC;
+
+    bucket = &flow_buckets[jhash_3words(src_ip, dst_ip, ((u32)src_port << 16) | dst_port, proto) & (FLOW_BUCKETS - 1)];
+    spin_lock(&bucket->lock);
+
+    // Refill for the time since the last packet, a new or long idle flow starts full
+    elapsed = now_ns - bucket->last_ns;
+    if (!bucket->last_ns || elapsed >= div_u64(capacity, limit))
+        bucket->tokens = capacity;
+    else
+        bucket->tokens = min_t(u64, capacity, bucket->tokens + elapsed * limit);
+    bucket->last_ns = now_ns;
+
+    if (bucket->tokens >= NSEC_PER_SEC) {
+        bucket->tokens -= NSEC_PER_SEC;
+        weight = 1 + bucket->dropped;
+        bucket->dropped = 0;
+    } else if (bucket->dropped < U32_MAX - 1) {
+        bucket->dropped++;// saturates, 1 + dropped must not wrap to 0 (dropped)
+    }
+
+    spin_unlock(&bucket->lock);
+    return weight;
+}
+
+// Sends count pckt_info records to a client in one Netlink message, a pckt_batch_hdr and then the records.
+// gfp is GFP_ATOMIC from the hook, the send work may sleep and uses GFP_KERNEL
+static void send_packets_to_user(u32 pid, const struct pckt_info *records, u16 count, gfp_t gfp) {
     
     struct sk_buff *nl_skb;
     struct nlmsghdr *nlh;
+    struct pckt_batch_hdr *hdr;
+    size_t len = sizeof(*hdr) + count * sizeof(*records);
 
     // Allocate a new skb for the Netlink message
-    nl_skb = nlmsg_new(sizeof(*msg), GFP_ATOMIC);
+    nl_skb = nlmsg_new(len, gfp);
     if (!nl_skb) {
-        pr_info("[sniffer] Failed to allocate skb for Netlink message\n");
+        stat_add(STAT_ALLOC_FAIL, 1);
+        trace_sniffer_send_failed(pid, count, -ENOMEM);
+        pr_err_ratelimited("[sniffer] Failed to allocate skb for Netlink message\n");
         return;
     }
 
     // Prepare the Netlink message header and payload
-    nlh = nlmsg_put(nl_skb, 0, 0, NLMSG_DONE, sizeof(*msg), 0);
+    nlh = nlmsg_put(nl_skb, 0, 0, NLMSG_DONE, len, 0);
     if (!nlh) {
-        pr_info("[sniffer] Failed to create Netlink header\n");
+        stat_add(STAT_PUT_FAIL, 1);
+        trace_sniffer_send_failed(pid, count, -EMSGSIZE);
+        pr_err_ratelimited("[sniffer] Failed to create Netlink header\n");
         kfree_skb(nl_skb);
         return;
     }
 
-    // Copy the packet info into the message payload
-    memcpy(nlmsg_data(nlh), msg, sizeof(*msg));
+    // The batch header tells user space the wire version and how to step over the records
+    hdr = nlmsg_data(nlh);
+    hdr->version = PCKT_BATCH_VERSION;
+    hdr->count = count;
+    hdr->record_size = sizeof(*records);
+    hdr->flags = 0;
+    if (count)
+        memcpy(hdr + 1, records, count * sizeof(*records));
 
     // Send the Netlink message to the user process
     int res = netlink_unicast(nl_sk, nl_skb, pid, MSG_DONTWAIT);
     if (res < 0) {
-        pr_info("[sniffer] Failed to send Netlink message, error: %d\n", res);
+        stat_add(STAT_UNICAST_FAIL, 1);
+        trace_sniffer_send_failed(pid, count, res);
+        pr_err_ratelimited("[sniffer] Failed to send Netlink message, error: %d\n", res);
         // nl_skb is freed automatically on error
+        return;
+    }
+    stat_add(STAT_SENT, count);
+    trace_sniffer_packet_sent(pid, count);
+}
+
+// Sends a single pckt_info struct to a client, a batch of one
+static void send_packet_info_to_user(u32 pid, const struct pckt_info *msg) {
+    send_packets_to_user(pid, msg, 1, GFP_ATOMIC);
+}
+
+// Deferred send path: the hook only copies the record into its cpus staging buffer, a work item bound
+// to the same cpu swaps the buffers and does the netlink sends outside the packet path.
+// The hook runs in softirq and the work swaps with bottom halves disabled, so neither side takes a lock
+static bool deferred_send = true;
+module_param(deferred_send, bool, 0644);
+MODULE_PARM_DESC(deferred_send, "Send from a per cpu work item instead of from the hook (0 = send inline, to compare)");
+
+#define STAGE_RECORDS 128 // per subscriber per buffer, one netlink message each (4KB of records)
+
+enum stage_target { STAGE_DAEMON, STAGE_HUNTER, STAGE_TARGETS };
+
+struct stage_buffer {
+    u16 count[STAGE_TARGETS];
+    struct pckt_info records[STAGE_TARGETS][STAGE_RECORDS];
+};
+
+struct cpu_stage {
+    struct stage_buffer buffers[2];
+    int active;              // the buffer the hook appends to, the work sends the other one
+    struct work_struct work;
+};
+static struct cpu_stage __percpu *cpu_stages; // allocated in init, too big for a static per cpu variable
+
+// Append a record for target to this cpus active buffer and make sure the send work is queued. From the hook only
+static void stage_record(enum stage_target target, const struct pckt_info *msg) {
+    struct cpu_stage *stage = this_cpu_ptr(cpu_stages);
+    struct stage_buffer *buf = &stage->buffers[stage->active];
+
+    if (buf->count[target] >= STAGE_RECORDS) {
+        stat_add(STAT_STAGE_FULL, 1);
+        trace_sniffer_packet_filtered(FILTER_STAGE_FULL, msg->src_port, msg->dst_port, msg->proto);
+        return;
     }
+    buf->records[target][buf->count[target]++] = *msg;
+    stat_add(STAT_STAGED, 1);
+    queue_work_on(smp_processor_id(), system_highpri_wq, &stage->work);// no-op if it is already pending
+}
+
+// Send the records a buffer holds for target to pid (if that subscriber is still there) and empty it
+static void stage_send(struct stage_buffer *buf, enum stage_target target, int subscribed, u32 pid) {
+    if (!buf->count[target])
+        return;
+    if (subscribed && pid != 0)
+        send_packets_to_user(pid, buf->records[target], buf->count[target], GFP_KERNEL);
+    buf->count[target] = 0;
+}
+
+// The send work, runs on the cpu whose buffers it drains
+static void stage_work(struct work_struct *work) {
+    struct cpu_stage *stage = container_of(work, struct cpu_stage, work);
+    struct stage_buffer *buf;
+
+    // Swap with bottom halves off, so the hook on this cpu is never halfway through an append
+    local_bh_disable();
+    buf = &stage->buffers[stage->active];
+    stage->active ^= 1;
+    local_bh_enable();
+
+    stage_send(buf, STAGE_DAEMON, READ_ONCE(daemon_subscribed), READ_ONCE(daemon_pid));
+    stage_send(buf, STAGE_HUNTER, READ_ONCE(packet_hunter_subscribed), READ_ONCE(packet_hunter_pid));
+}
+
+// Wait until nothing sends to a subscriber whose flags were just cleared: hooks already past the check finish
+// (netfilter hooks run under rcu, inline sends and staging are done after synchronize_net), then the send work
+// that read the old flags on any cpu finishes. The work doesnt take subscribe_mutex, so this is safe under it
+static void drain_senders(void) {
+    int cpu;
+
+    synchronize_net();
+    for_each_possible_cpu(cpu)
+        flush_work(&per_cpu_ptr(cpu_stages, cpu)->work);
 }
 
 // Create and send stop message, tells users to stop listening
 void send_stop_msg(u32 pid){
-    struct pckt_info* msg = create_message(0, 0, 0, 0, 0);// send empty packet to user to let make it terminate (simplest solution i found to free recv block)
-    send_packet_info_to_user(pid, msg);
-    kfree(msg);   
+    send_packets_to_user(pid, NULL, 0, GFP_ATOMIC);// an empty batch, wakes a blocked recv (simplest solution i found to free recv block)
+}
+
+// Register the hook while at least one client is subscribed and unregister it after the last one leaves,
+// so a loaded but idle module adds nothing to the packet path. Called with subscribe_mutex held, right after
+// the flags changed, so a concurrent subscribe and unsubscribe cant leave a subscriber without the hook
+static void update_hook_registration(void) {
+    bool wanted = daemon_subscribed || packet_hunter_subscribed;
+    int err;
+
+    lockdep_assert_held(&subscribe_mutex);
+    if (wanted && !hook_registered) {
+        err = nf_register_net_hook(&init_net, &nfho); // Register the hook with netfilter (init_net refers to the default network namespace)
+        if (err)
+            pr_err("sniffer: Failed to register the netfilter hook, error: %d\n", err);
+        else
+            hook_registered = true;
+    } else if (!wanted && hook_registered) {
+        nf_unregister_net_hook(&init_net, &nfho); // waits for hook calls still running
+        hook_registered = false;
+    }
 }
 
 // Netlink Receive function (called when a message is received from user space) to subscribe/unsubscribe
@@ -106,7 +428,7 @@ static void nl_recv_msg(struct sk_buff *skb)
     
     // Check if the skb is NULL
     if (!skb) {
-        pr_err("sniffer: Received NULL skb\n");
+        pr_err_ratelimited("sniffer: Received NULL skb\n");
         return;
     }
 
@@ -116,45 +438,87 @@ static void nl_recv_msg(struct sk_buff *skb)
     // Extract the actual message data
     user_msg = (char *)nlmsg_data(nlh);
 
-    pr_info("sniffer: received netlink message: %s\n", user_msg);
-
-    // Subscribe/unsubscribe netlink cliets according to messages (to the sender proccess)
-    if (strcmp(user_msg, "packet_hunter_subscribe") == 0 && packet_hunter_subscribed == 0) {
-        packet_hunter_subscribed = 1;
-        packet_hunter_pid = nlh->nlmsg_pid; // Get the PID of the sender process
-        pr_info("sniffer: packet_hunter_subscribed to packet notifications from PID: %u\n", packet_hunter_pid);
+    pr_debug("sniffer: received netlink message: %s\n", user_msg); // dynamic debug, the daemon sends sampling commands under load
+
+    // Subscribe/unsubscribe netlink cliets according to messages (to the sender proccess).
+    // The flags change and the hook follows under subscribe_mutex, the netlink input may run for both clients at once
+    if (strcmp(user_msg, "packet_hunter_subscribe") == 0) {
+        mutex_lock(&subscribe_mutex);
+        if (packet_hunter_subscribed == 0) {
+            WRITE_ONCE(packet_hunter_sample, 1);
+            WRITE_ONCE(packet_hunter_pid, nlh->nlmsg_pid); // Get the PID of the sender process
+            WRITE_ONCE(packet_hunter_subscribed, 1);
+            pr_info("sniffer: packet_hunter_subscribed to packet notifications from PID: %u\n", packet_hunter_pid);
+            update_hook_registration();
+        }
+        mutex_unlock(&subscribe_mutex);
         return;
 
     }
     if(strcmp(user_msg, "packet_hunter_unsubscribe") == 0){
-        send_stop_msg(packet_hunter_pid); // Tells the user to stop listen 
-        packet_hunter_subscribed = 0;
-        packet_hunter_pid = 0;
+        u32 pid;
+        mutex_lock(&subscribe_mutex);
+        pid = packet_hunter_pid;
+        WRITE_ONCE(packet_hunter_subscribed, 0);
+        WRITE_ONCE(packet_hunter_pid, 0);
+        drain_senders(); // no record can land after the stop message
+        send_stop_msg(pid); // Tells the user to stop listen 
         pr_info("sniffer: packet_hunter unsubscribed from packet notifications\n");
+        update_hook_registration();
+        mutex_unlock(&subscribe_mutex);
         return;   
     }
-    if (strcmp(user_msg, "daemon_subscribe") == 0 && daemon_subscribed == 0) {
-        daemon_subscribed = 1;
-        daemon_pid = nlh->nlmsg_pid; // Get the PID of the sender process
-        pr_info("sniffer: daemon_subscribed to packet notifications from PID: %u\n", daemon_pid);
+    if (strcmp(user_msg, "daemon_subscribe") == 0) {
+        mutex_lock(&subscribe_mutex);
+        if (daemon_subscribed == 0) {
+            WRITE_ONCE(daemon_sample, 1);
+            WRITE_ONCE(daemon_pid, nlh->nlmsg_pid); // Get the PID of the sender process
+            WRITE_ONCE(daemon_subscribed, 1);
+            pr_info("sniffer: daemon_subscribed to packet notifications from PID: %u\n", daemon_pid);
+            update_hook_registration();
+        }
+        mutex_unlock(&subscribe_mutex);
         return;
 
     }
     if(strcmp(user_msg, "daemon_unsubscribe") == 0){
-        send_stop_msg(daemon_pid); // Tells the user to stop listen
-        daemon_subscribed = 0;
-        daemon_pid = 0;
+        u32 pid;
+        mutex_lock(&subscribe_mutex);
+        pid = daemon_pid;
+        WRITE_ONCE(daemon_subscribed, 0);
+        WRITE_ONCE(daemon_pid, 0);
+        drain_senders(); // no record can land after the stop message
+        send_stop_msg(pid); // Tells the user to stop listen
         pr_info("sniffer: daemon nsubscribed from packet notifications\n");
+        update_hook_registration();
+        mutex_unlock(&subscribe_mutex);
         return;
 
     }
-    pr_info("sniffer: Unknown command: %s\n", user_msg);
+    // "<client>_sample N": forward 1 in N of the (globally sampled) packets to that client
+    if (strncmp(user_msg, "packet_hunter_sample ", 21) == 0) {
+        unsigned int rate;
+        if (kstrtouint(user_msg + 21, 10, &rate) == 0 && rate > 0) {
+            WRITE_ONCE(packet_hunter_sample, rate);
+            pr_info("sniffer: packet_hunter sampling 1 in %u\n", rate);
+            return;
+        }
+    }
+    if (strncmp(user_msg, "daemon_sample ", 14) == 0) {
+        unsigned int rate;
+        if (kstrtouint(user_msg + 14, 10, &rate) == 0 && rate > 0) {
+            WRITE_ONCE(daemon_sample, rate);
+            pr_info("sniffer: daemon sampling 1 in %u\n", rate);
+            return;
+        }
+    }
+    pr_err_ratelimited("sniffer: Unknown command: %s\n", user_msg);
     
 }
 
 
-// Retrive ip header from a packet in the socket buffer and pr_info the packet cought
-static unsigned int packet_sniffer_hook(void *priv, struct sk_buff *skb, const struct nf_hook_state *state){
+// Retrive ip header from a packet in the socket buffer and trace the packet cought, then stage or send it
+static void sniff_packet(struct sk_buff *skb, u64 tstamp_ns){
     
     // Frame headers structs
     struct iphdr *iph;
@@ -167,17 +531,23 @@ static unsigned int packet_sniffer_hook(void *priv, struct sk_buff *skb, const s
     u32 src_ip, dst_ip;
     u16 src_port, dst_port;
     char proto;
-    struct pckt_info *msg; // The message to send to user space
+    struct pckt_info msg; // The message to send to user space, copied into each subscribers skb
+    u32 weight;           // packets the message stands for
+    unsigned int rate;
+    bool deferred = READ_ONCE(deferred_send);
     
+    stat_add(STAT_SEEN, 1);
+
     // Check if the skb is NULL or too short (packets comes as sk_buff struct, skb = the packet)
     if (!skb || skb->len < sizeof(struct iphdr)) {
-        pr_info("[sniffer] Packet too short or skb is NULL. \n");
-        return NF_ACCEPT;
+        stat_add(STAT_TOO_SHORT, 1);
+        trace_sniffer_packet_filtered(FILTER_TOO_SHORT, 0, 0, 0);
+        return;
     }
     
     iph = ip_hdr(skb);
     if (!iph)// If failed to retrive ip header from packet (non ip packet or corrupted) using ip_hdr() macro
-        return NF_ACCEPT;
+        return;
     
     // Get the source and destination IP addresses
     src_ip = iph->saddr; // Convert to host byte order
@@ -203,47 +573,93 @@ static unsigned int packet_sniffer_hook(void *priv, struct sk_buff *skb, const s
     
     
     } else { // Our module only supports TCP and UDP packets
-        pr_info("[sniffer] Unsupported protocol: %d \n", iph->protocol);
-        return NF_ACCEPT;
+        stat_add(STAT_UNSUPPORTED, 1);
+        trace_sniffer_packet_filtered(FILTER_UNSUPPORTED, 0, 0, 0);
+        return;
     }
                 
     
-    // pr_info the packet info, for debugging
-    pr_info("[sniffer] Packet type %c Src IP: %pI4, Dst IP: %pI4, Src Port: %u, Dst Port: %u, Payload: %u bytes \n", proto, &src_ip, &dst_ip, src_port, dst_port, payload_size);
+    // Trace the packet info, for debugging (sniffer:sniffer_packet_seen, free while the event is off)
+    trace_sniffer_packet_seen(src_ip, dst_ip, src_port, dst_port, proto, payload_size);
  
     
-     // if the daemon is subscribed, create and send the packet's info to the daemon pid
+    // Per flow rate limit, then the global sampling, both scale the weight of the packets that pass
+    weight = flow_rate_check(src_ip, dst_ip, src_port, dst_port, proto, tstamp_ns);
+    if (!weight) {
+        stat_add(STAT_RATE_LIMITED, 1);
+        trace_sniffer_packet_filtered(FILTER_RATE_LIMITED, src_port, dst_port, proto);
+        return;
+    }
+    rate = READ_ONCE(sample_rate);
+    if (!sample_take(&sample_count, rate)) {
+        stat_add(STAT_SAMPLED_OUT, 1);
+        trace_sniffer_packet_filtered(FILTER_SAMPLED_OUT, src_port, dst_port, proto);
+        return;
+    }
+    weight = scale_weight(weight, rate);
+    fill_packet_info(&msg, src_ip, dst_ip, src_port, dst_port, payload_size, proto, tstamp_ns);
+ 
+     // if the daemon is subscribed (and samples this packet), send the packet's info to the daemon pid
      if( daemon_subscribed && daemon_pid != 0) {           
-        msg = create_message(src_ip, dst_ip, src_port, dst_port, proto);
-        if (!msg)
-            return NF_ACCEPT;
-        
-        // Send the packet info to the user process
-        send_packet_info_to_user(daemon_pid, msg);
-        kfree(msg);
-        pr_info("[sniffer] Packet info sent to user process PID: %u\n", daemon_pid);
+        rate = READ_ONCE(daemon_sample);
+        if (sample_take(&daemon_sample_count, rate)) {
+            msg.sample_weight = scale_weight(weight, rate);
+            if (deferred)
+                stage_record(STAGE_DAEMON, &msg);
+            else
+                send_packet_info_to_user(daemon_pid, &msg);
+        } else {
+            trace_sniffer_packet_filtered(FILTER_SUBSCRIBER_SAMPLE, src_port, dst_port, proto);
+        }
     }
     
-    // If the packet_hunter is subscribed, create and send the packet's info to the packet_hunter pid
+    // If the packet_hunter is subscribed (and samples this packet), send the packet's info to the packet_hunter pid
     if (packet_hunter_subscribed && packet_hunter_pid != 0) {           
-        msg = create_message(src_ip, dst_ip, src_port, dst_port, proto);
-        if (!msg)
-            return NF_ACCEPT;
-        
-        // Send the packet info to the user process
-        send_packet_info_to_user(packet_hunter_pid, msg);
-        kfree(msg);
-        pr_info("[sniffer] Packet info sent to user process PID: %u\n", packet_hunter_pid);
+        rate = READ_ONCE(packet_hunter_sample);
+        if (sample_take(&packet_hunter_sample_count, rate)) {
+            msg.sample_weight = scale_weight(weight, rate);
+            if (deferred)
+                stage_record(STAGE_HUNTER, &msg);
+            else
+                send_packet_info_to_user(packet_hunter_pid, &msg);
+        } else {
+            trace_sniffer_packet_filtered(FILTER_SUBSCRIBER_SAMPLE, src_port, dst_port, proto);
+        }
     }
-    
+}
 
+// The netfilter hook, times every call into the hook latency histogram
+static unsigned int packet_sniffer_hook(void *priv, struct sk_buff *skb, const struct nf_hook_state *state){
+    u64 tstamp_ns = ktime_get_ns(); // stamp first, so user space latency includes the hook itself
+
+    sniff_packet(skb, tstamp_ns);
+    hook_latency_add(ktime_get_ns() - tstamp_ns);
     return NF_ACCEPT;  // Let the packet continue normally
 }
 
 // init function (runs on module load)
 static int __init sniffer_init(void) {
+    int i, cpu;
     pr_info("[sniffer] Module loaded.\n");
 
+    for (i = 0; i < FLOW_BUCKETS; i++)
+        spin_lock_init(&flow_buckets[i].lock);
+
+    // Staging buffers and send work of every cpu (zeroed, so every buffer starts empty)
+    cpu_stages = alloc_percpu(struct cpu_stage);
+    if (!cpu_stages) {
+        pr_err("sniffer: Failed to allocate the staging buffers\n");
+        return -ENOMEM;
+    }
+    for_each_possible_cpu(cpu)
+        INIT_WORK(&per_cpu_ptr(cpu_stages, cpu)->work, stage_work);
+
+    // Netfilter hook initilaziation, set before the netlink socket exists, the first subscribe registers it (update_hook_registration)
+    nfho.hook = packet_sniffer_hook;       // The function to run when a packet hits the hook
+    nfho.hooknum = NF_INET_LOCAL_IN;    // Places the hook after basec proccessing, the skb header will be complete at this stage, wait for ipv4 packets
+    nfho.pf = PF_INET;                     // IPv4 packets only
+    nfho.priority = NF_IP_PRI_FIRST;       // Run before other hooks (highest priority)
+
     // Create a Netlink socket
     struct netlink_kernel_cfg cfg = {// Netlink socket configuration
         .input = nl_recv_msg, 
@@ -251,34 +667,42 @@ static int __init sniffer_init(void) {
     nl_sk = netlink_kernel_create(&init_net, NETLINK_USER, &cfg);// Creats the actual socket
     if (!nl_sk) {
         pr_err("sniffer: Failed to create Netlink socket\n");
+        free_percpu(cpu_stages);
         return -ENOMEM;
     }   
     pr_info("sniffer: Netlink socket created\n");
-    
 
+    // Counters in /sys/kernel/debug/sniffer/stats, the module works without them if debugfs is missing
+    debugfs_dir = debugfs_create_dir("sniffer", NULL);
+    debugfs_create_file("stats", 0444, debugfs_dir, NULL, &stats_fops);
+    debugfs_create_file("hook_latency", 0444, debugfs_dir, NULL, &hook_latency_fops);
 
-    // Netfilter hook initilaziation registration
-    nfho.hook = packet_sniffer_hook;       // The function to run when a packet hits the hook
-    nfho.hooknum = NF_INET_LOCAL_IN;    // Places the hook after basec proccessing, the skb header will be complete at this stage, wait for ipv4 packets
-    nfho.pf = PF_INET;                     // IPv4 packets only
-    nfho.priority = NF_IP_PRI_FIRST;       // Run before other hooks (highest priority)
-    nf_register_net_hook(&init_net, &nfho); // Register the hook with netfilter (init_net refers to the default network namespace)
-
-    
     return 0;
 }
 
 // exit function (runs on module unload)
 static void __exit sniffer_exit(void) {
+    int cpu;
    
-    // Unregister the hook (if the hook is not unregistered, it will remain active even after the module is unloaded) 
-    nf_unregister_net_hook(&init_net, &nfho); 
+    // Unregister the hook if a client is still subscribed (if the hook is not unregistered, it will remain active even after the module is unloaded) 
+    mutex_lock(&subscribe_mutex);
+    if (hook_registered)
+        nf_unregister_net_hook(&init_net, &nfho);
+    hook_registered = false;
+    mutex_unlock(&subscribe_mutex);
+
+    // Nothing stages anymore, wait for send work still running (staged records are dropped, the subscribers are going too)
+    for_each_possible_cpu(cpu)
+        cancel_work_sync(&per_cpu_ptr(cpu_stages, cpu)->work);
+
+    debugfs_remove_recursive(debugfs_dir);
 
     // Unregister the Netlink socket
     if (nl_sk) {
         netlink_kernel_release(nl_sk);
         pr_info("sniffer: Netlink socket released\n");
     }
+    free_percpu(cpu_stages);
     
     pr_info("[sniffer] Module unloaded.\n");
 }
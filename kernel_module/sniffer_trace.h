@@ -0,0 +1,137 @@
+// Tracepoints of the sniffer hook and send paths, in place of the old per packet pr_info.
+// Off they cost a patched out branch, on they go to the ftrace ring buffer:
+//   echo 1 > /sys/kernel/tracing/events/sniffer/enable && cat /sys/kernel/tracing/trace_pipe
+//   perf record -e 'sniffer:*' -a
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM sniffer
+
+#if !defined(_SNIFFER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SNIFFER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Why a packet wasnt forwarded (defined once, the header is read several times by define_trace.h)
+#ifndef SNIFFER_FILTER_REASONS
+#define SNIFFER_FILTER_REASONS
+enum sniffer_filter_reason {
+    FILTER_TOO_SHORT,        // NULL or shorter than an ip header
+    FILTER_UNSUPPORTED,      // not TCP or UDP
+    FILTER_RATE_LIMITED,     // dropped by the per flow token bucket
+    FILTER_SAMPLED_OUT,      // skipped by the global sample_rate
+    FILTER_SUBSCRIBER_SAMPLE,// skipped by one subscribers own sampling
+    FILTER_STAGE_FULL,       // the cpus staging buffer was full
+};
+#endif
+
+TRACE_DEFINE_ENUM(FILTER_TOO_SHORT);
+TRACE_DEFINE_ENUM(FILTER_UNSUPPORTED);
+TRACE_DEFINE_ENUM(FILTER_RATE_LIMITED);
+TRACE_DEFINE_ENUM(FILTER_SAMPLED_OUT);
+TRACE_DEFINE_ENUM(FILTER_SUBSCRIBER_SAMPLE);
+TRACE_DEFINE_ENUM(FILTER_STAGE_FULL);
+
+#define show_filter_reason(reason)                          \
+    __print_symbolic(reason,                                \
+        { FILTER_TOO_SHORT, "too_short" },                  \
+        { FILTER_UNSUPPORTED, "unsupported_proto" },        \
+        { FILTER_RATE_LIMITED, "rate_limited" },            \
+        { FILTER_SAMPLED_OUT, "sampled_out" },              \
+        { FILTER_SUBSCRIBER_SAMPLE, "subscriber_sample" },  \
+        { FILTER_STAGE_FULL, "stage_full" })
+
+// A TCP or UDP packet the hook parsed, before rate limiting and sampling (the addresses are kept in network order)
+TRACE_EVENT(sniffer_packet_seen,
+    TP_PROTO(u32 src_ip, u32 dst_ip, u16 src_port, u16 dst_port, char proto, u32 payload_size),
+    TP_ARGS(src_ip, dst_ip, src_port, dst_port, proto, payload_size),
+
+    TP_STRUCT__entry(
+        __array(u8, saddr, 4)
+        __array(u8, daddr, 4)
+        __field(u16, sport)
+        __field(u16, dport)
+        __field(char, proto)
+        __field(u32, payload_size)
+    ),
+
+    TP_fast_assign(
+        memcpy(__entry->saddr, &src_ip, 4);
+        memcpy(__entry->daddr, &dst_ip, 4);
+        __entry->sport = src_port;
+        __entry->dport = dst_port;
+        __entry->proto = proto;
+        __entry->payload_size = payload_size;
+    ),
+
+    TP_printk("proto=%c src=%pI4:%u dst=%pI4:%u payload=%u",
+        __entry->proto, __entry->saddr, __entry->sport, __entry->daddr, __entry->dport, __entry->payload_size)
+);
+
+// A packet the hook didnt forward, and why (ports and proto are 0 for packets it couldnt parse)
+TRACE_EVENT(sniffer_packet_filtered,
+    TP_PROTO(enum sniffer_filter_reason reason, u16 src_port, u16 dst_port, char proto),
+    TP_ARGS(reason, src_port, dst_port, proto),
+
+    TP_STRUCT__entry(
+        __field(int, reason)
+        __field(u16, sport)
+        __field(u16, dport)
+        __field(char, proto)
+    ),
+
+    TP_fast_assign(
+        __entry->reason = reason;
+        __entry->sport = src_port;
+        __entry->dport = dst_port;
+        __entry->proto = proto;
+    ),
+
+    TP_printk("reason=%s proto=%c sport=%u dport=%u",
+        show_filter_reason(__entry->reason), __entry->proto ? __entry->proto : '-', __entry->sport, __entry->dport)
+);
+
+// A batch of count records (0 for the stop message) handed to a subscriber
+TRACE_EVENT(sniffer_packet_sent,
+    TP_PROTO(u32 pid, u16 count),
+    TP_ARGS(pid, count),
+
+    TP_STRUCT__entry(
+        __field(u32, pid)
+        __field(u16, count)
+    ),
+
+    TP_fast_assign(
+        __entry->pid = pid;
+        __entry->count = count;
+    ),
+
+    TP_printk("pid=%u count=%u", __entry->pid, __entry->count)
+);
+
+// A batch that never reached the subscriber, err is -ENOMEM (nlmsg_new), -EMSGSIZE (nlmsg_put) or what netlink_unicast returned
+TRACE_EVENT(sniffer_send_failed,
+    TP_PROTO(u32 pid, u16 count, int err),
+    TP_ARGS(pid, count, err),
+
+    TP_STRUCT__entry(
+        __field(u32, pid)
+        __field(u16, count)
+        __field(int, err)
+    ),
+
+    TP_fast_assign(
+        __entry->pid = pid;
+        __entry->count = count;
+        __entry->err = err;
+    ),
+
+    TP_printk("pid=%u count=%u err=%d", __entry->pid, __entry->count, __entry->err)
+);
+
+#endif // _SNIFFER_TRACE_H
+
+// The header lives next to sniffer.c, not in include/trace/events (the Makefile adds -I$(src))
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE sniffer_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "NetLinkConfig.h" // for pckt_info
+#include "PacketFormatter.h" // record layout
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+// Streams captured packet records to disk while the hunter is running.
+// Records are formatted into one of two fixed size blocks, when the active block fills up
+// (or once a second) the blocks are swapped and a background thread writes the full one,
+// so capture never waits on the disk and memory use doesn't grow with the capture length.
+class CaptureWriter {
+public:
+    // rotateBytes/rotateSeconds of 0 disable that kind of rotation
+    CaptureWriter(const std::string& path, OutputFormat format, size_t rotateBytes, unsigned rotateSeconds);
+
+    // Flushes whatever is left and stops the writer thread
+    ~CaptureWriter();
+
+    // Opens the first capture file and starts the writer thread, false if the file cant be opened
+    bool start();
+
+    // Append a record for the packet (called from the capture thread).
+    // False once a block couldnt be written (the record is dropped), the caller should stop capturing
+    bool writeRecord(pid_t pid, const pckt_info* pckt, const char* comm = nullptr);
+
+    // Flush the remaining records and join the writer thread, false if records were lost on the way
+    bool stop();
+
+    // Path of the file currently written to
+    std::string getCurrentPath() const;
+
+private:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024; // size of each of the two buffers
+
+    // Buffer of whole records, the writer thread never splits a block between files
+    struct Block {
+        std::vector<char> data;
+        size_t used = 0;
+    };
+
+    // Background thread, waits for a full block (or the flush interval) and writes it
+    void writerThread();
+
+    // Write a whole block to the current file, rotating first if needed. False if it wasnt written
+    bool writeBlock(const Block& block);
+
+    // Close the current file and open the next one in the rotation
+    bool openNextFile();
+
+    std::string basePath;
+    OutputFormat format;
+    size_t rotateBytes;
+    std::chrono::seconds rotateInterval;
+
+    Block blocks[2];
+    Block* active;   // filled by the capture thread
+    Block* flushing; // written by the writer thread, empty when the writer is idle
+
+    mutable std::mutex mtx;
+    std::condition_variable blockReady; // wakes the writer thread
+    std::condition_variable blockFree;  // wakes the capture thread when both blocks are full
+    bool stopping;
+    bool failed;    // a block was lost (write error or the next file in the rotation couldnt be opened)
+
+    int fd;                 // current capture file
+    unsigned fileIndex;     // number of the current file in the rotation
+    size_t fileBytes;       // bytes written to the current file
+    std::chrono::steady_clock::time_point fileOpened;
+    std::string currentPath;
+
+    std::thread writer;
+};
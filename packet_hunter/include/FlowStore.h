@@ -0,0 +1,110 @@
+#pragma once
+
+#include "NetLinkConfig.h" // for pckt_info
+#include <unordered_map>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+// The 5-tuple that identifies a flow
+struct FlowKey {
+    uint32_t src_ip;
+    uint32_t dst_ip;
+    uint16_t src_port;
+    uint16_t dst_port;
+    char proto;
+
+    explicit FlowKey(const pckt_info* pckt)
+        : src_ip(pckt->src_ip), dst_ip(pckt->dst_ip),
+          src_port(pckt->src_port), dst_port(pckt->dst_port), proto(pckt->proto) {}
+
+    bool operator==(const FlowKey& other) const {
+        return src_ip == other.src_ip && dst_ip == other.dst_ip &&
+               src_port == other.src_port && dst_port == other.dst_port && proto == other.proto;
+    }
+};
+
+struct FlowKeyHash {
+    size_t operator()(const FlowKey& key) const {
+        uint64_t ips = (static_cast<uint64_t>(key.src_ip) << 32) | key.dst_ip;
+        uint64_t rest = (static_cast<uint64_t>(key.src_port) << 24) | (static_cast<uint64_t>(key.dst_port) << 8) |
+                        static_cast<unsigned char>(key.proto);
+        return std::hash<uint64_t>()(ips ^ (rest * 0x9E3779B97F4A7C15ULL));
+    }
+};
+
+// A tracked flow, info holds the first packet seen (used to print the flow)
+struct FlowEntry {
+    pckt_info info;
+    pid_t pid;
+    uint64_t packets;
+    uint64_t bytes;
+    std::chrono::steady_clock::time_point lastSeen;
+    uint32_t prev; // LRU links (slot indexes)
+    uint32_t next;
+};
+
+// Per pid totals, kept after the pid's flows are evicted
+struct PidAggregate {
+    uint64_t flows = 0;
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+};
+
+// Fixed capacity store of the flows the hunter already reported.
+// Flows live in preallocated slots linked in LRU order, when the store is full the least
+// recently seen flow is evicted and flows idle for longer than the timeout are dropped,
+// so memory stays within the budget and a flow that comes back after a gap is reported again.
+class FlowStore {
+public:
+    // The capacity is derived from the memory budget (in bytes)
+    FlowStore(size_t memoryBudget, std::chrono::seconds idleTimeout);
+
+    // Counts the packet on its flow and marks the flow as recently used, returns nullptr if the flow isnt tracked
+    const FlowEntry* touch(const pckt_info* pckt, std::chrono::steady_clock::time_point now);
+
+    // Start tracking a new flow owned by pid, evicts the least recently used flow if full
+    void insert(const pckt_info* pckt, pid_t pid, std::chrono::steady_clock::time_point now);
+
+    // Drop flows that werent seen for longer than the idle timeout, returns how many were dropped
+    size_t evictIdle(std::chrono::steady_clock::time_point now);
+
+    // Calls func(const FlowEntry&) for every tracked flow, most recently used first
+    template <typename Func>
+    void forEachFlow(Func func) const {
+        for (uint32_t slot = head; slot != NONE; slot = slots[slot].next) {
+            func(slots[slot]);
+        }
+    }
+
+    // Totals per pid, including flows that were already evicted
+    const std::unordered_map<pid_t, PidAggregate>& getPidAggregates() const;
+
+    size_t size() const;
+    size_t capacity() const;
+    uint64_t getEvictions() const;
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    // Unlink a slot from the LRU list
+    void unlink(uint32_t slot);
+
+    // Link a slot at the front (most recently used)
+    void pushFront(uint32_t slot);
+
+    // Forget the flow in the slot and return the slot to the free list
+    void release(uint32_t slot);
+
+    std::vector<FlowEntry> slots;                           // allocated once
+    std::unordered_map<FlowKey, uint32_t, FlowKeyHash> index; // flow -> slot, reserved once
+    std::unordered_map<pid_t, PidAggregate> pidAggregates;
+    std::chrono::seconds idleTimeout;
+
+    uint32_t head;     // most recently used
+    uint32_t tail;     // least recently used
+    uint32_t freeHead; // free slots, linked through next
+    size_t count;
+    uint64_t evictions;
+};
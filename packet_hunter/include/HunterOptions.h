@@ -0,0 +1,29 @@
+#pragma once
+
+#include "PacketFormatter.h" // for OutputFormat
+#include <string>
+#include <cstddef> // for size_t
+#include <cstdint>
+
+// Command line options of the packet hunter
+struct HunterOptions {
+    std::string capturePath;    // -w, stream records to this file while capturing (empty = ask on exit)
+    size_t rotateBytes = 0;     // -C, start a new capture file after this many bytes (0 = never)
+    unsigned rotateSeconds = 0; // -G, start a new capture file every this many seconds (0 = never)
+    OutputFormat format = OutputFormat::Text; // -o, layout of printed and captured records
+    size_t flowMemory = 16 * 1024 * 1024;     // -M, memory budget of the flow store in bytes
+    unsigned flowIdleSeconds = 60;            // -I, forget flows idle for this long (reported again when they return)
+    bool processInfo = false;                 // -m, ask the daemon for the owners metadata and print its name
+    bool viaDaemon = false;                   // -d, get packets already annotated from the daemon instead of the kernel
+    bool printStats = false;                  // -S, print the daemons stats and exit
+    bool printCgroups = false;                // -g, print the daemons traffic per cgroup / container and exit
+    unsigned sampleRate = 1;                  // -n, ask the kernel for 1 in N packets (counts are scaled back up)
+    bool topMode = false;                     // -t, live table of the busiest pids and flows instead of a line per flow
+    bool printHistory = false;                // -H, print who held a port at a time (or over a time range) and exit
+    uint16_t historyPort = 0;                 //     0 = every port
+    uint64_t historyFromNs = 0;               //     CLOCK_REALTIME
+    uint64_t historyToNs = 0;
+};
+
+// Parse the command line into options, prints usage and returns false on bad arguments
+bool parseHunterOptions(int argc, char* argv[], HunterOptions& options);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "NetLinkConfig.h" // for pckt_info
+#include <vector>
+#include <cstddef>
+
+// Layout of the records printed to the console and written to capture files
+enum class OutputFormat {
+    Text,  // PID: 2897 (resolved) | Proto: UDP | Src: 10.0.2.3:53 → Dst: 10.0.2.15:44280
+    Json   // one JSON object per line (NDJSON), for piping into other tools
+};
+
+namespace PacketFormatter {
+    // Upper bound of a single formatted record, callers must have this much room
+    constexpr size_t MAX_RECORD_SIZE = 256;
+
+    // Longest process name printed (the kernels comm is 15 chars)
+    constexpr size_t MAX_COMM_LEN = 15;
+
+    // Formats the packet record (including the trailing newline) into out, returns the record length.
+    // comm is the owners process name, left out if nullptr.
+    // Doesnt allocate or call inet_ntoa, the IPs and ports are written digit by digit
+    size_t formatPacket(char* out, pid_t pid, const pckt_info* pckt, OutputFormat format, const char* comm = nullptr);
+}
+
+// Collects formatted records in one reusable buffer and writes them to fd in large writes
+// instead of flushing a stream on every packet
+class BatchedOutput {
+public:
+    BatchedOutput(int fd, OutputFormat format, size_t capacity = 64 * 1024);
+    ~BatchedOutput();// flushes what is left
+
+    // Format the record into the buffer, flushes first if it may not fit
+    void append(pid_t pid, const pckt_info* pckt, const char* comm = nullptr);
+
+    // Write everything buffered so far (called when the capture goes idle and on exit)
+    void flush();
+
+    // True once a write failed (EPIPE when the reader went away), later records are dropped
+    bool isClosed() const;
+
+private:
+    int fd;
+    OutputFormat format;
+    std::vector<char> buffer; // allocated once
+    size_t used;
+    bool closed;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "NetLinkConfig.h"    // for pckt_info
+#include "UnixSocketClient.h" // to ask the daemon
+#include "EventLoop.h"        // retries run on a loop timer
+#include <unordered_map>
+#include <vector>
+#include <chrono>
+#include <functional>
+
+// Packets of new flows wait here, keyed by their destination port, until the daemon knows who owns the port.
+// Due ports are asked about in one pipelined batch (after every netlink drain and on a retry timer), a port the
+// daemon doesnt know yet is asked again with a growing backoff until its deadline, then its packets are
+// reported as unknown. The daemon socket is non blocking and its replies are read from the loop, one batch is in
+// flight at a time. Capture never sleeps waiting for the daemon.
+class PendingResolver {
+public:
+    // Called for every parked packet once its port resolved (pid -1 if it didnt in time), info is nullptr without metadata
+    using ReportFunc = std::function<void(const pckt_info* pckt, pid_t pid, const ProcessInfo* info)>;
+
+    // flushReports is called after a retry reported packets outside of a netlink drain
+    PendingResolver(EventLoop& loop, UnixSocketClient& client, bool metadata, ReportFunc report, std::function<void()> flushReports);
+    ~PendingResolver();
+
+    PendingResolver(const PendingResolver&) = delete;
+    PendingResolver& operator=(const PendingResolver&) = delete;
+
+    // Park a packet of a new flow, its port is asked about on the next resolveDue
+    void park(const pckt_info* pckt, std::chrono::steady_clock::time_point now);
+
+    // Ask the daemon about every port whose retry time came, in one batch (once the batch in flight was answered).
+    // False if the daemon stopped answering
+    bool resolveDue(std::chrono::steady_clock::time_point now);
+
+    // The daemon socket is ready (events from the loop): write what is queued and handle the replies that came.
+    // False if the daemon disconnected
+    bool handleSocketEvents(uint32_t events, std::chrono::steady_clock::time_point now);
+
+    // Report everything still parked as unknown (on exit)
+    void flushUnresolved();
+
+    size_t size() const; // parked packets
+
+private:
+    static constexpr auto FIRST_RETRY = std::chrono::milliseconds(10);  // doubled on every miss
+    static constexpr auto MAX_RETRY = std::chrono::milliseconds(320);
+    static constexpr auto DEADLINE = std::chrono::seconds(2);           // reported as unknown after this
+    static constexpr auto TIMER_INTERVAL = std::chrono::milliseconds(10);
+    static constexpr size_t MAX_PARKED = 4096;          // packets, past this new ones are reported unknown right away
+    static constexpr size_t MAX_PARKED_PER_PORT = 64;
+    static constexpr size_t MAX_BATCH_PORTS = 256;      // ports per pipelined batch
+    static constexpr auto QUERY_TIMEOUT = std::chrono::seconds(2); // a batch unanswered this long means the daemon is stuck
+
+    struct PendingPort {
+        std::vector<pckt_info> packets; // in arrival order
+        std::chrono::steady_clock::time_point nextQuery;
+        std::chrono::steady_clock::time_point deadline;
+        std::chrono::milliseconds backoff;
+    };
+
+    // Report and forget the parked packets of port
+    void release(uint16_t port, pid_t pid, const ProcessInfo* info);
+
+    // Apply the answers to the batch in flight
+    void applyReplies(std::chrono::steady_clock::time_point now);
+
+    // Start / stop the retry timer, it only runs while packets are parked
+    void updateTimer();
+
+    // Watch the socket for EPOLLOUT only while requests are queued
+    void updateWriteInterest();
+
+    EventLoop& loop;
+    UnixSocketClient& client;
+    bool metadata;
+    ReportFunc report;
+    std::function<void()> flushReports;
+
+    std::unordered_map<uint16_t, PendingPort> pending;
+    size_t parked;
+    int retryTimer; // -1 while nothing is parked
+
+    std::vector<uint16_t> inFlight;         // ports of the batch waiting for replies, in request order
+    std::vector<ProcessInfo> replies;       // answers to inFlight received so far
+    std::chrono::steady_clock::time_point sentAt;
+    bool watchingOutput;
+};
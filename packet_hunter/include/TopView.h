@@ -0,0 +1,83 @@
+#pragma once
+
+#include "NetLinkConfig.h" // for pckt_info
+#include "FlowStore.h"     // FlowKey
+#include <unordered_map>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+// Packets and bytes of one pid or flow over the last 1, 10 and 60 seconds.
+// Counts go into one second buckets in a ring, when a second completes its bucket is added to the
+// window sums and the bucket that fell out of each window is subtracted, so reading a rate is O(1)
+// and nothing is ever summed again.
+class RateWindow {
+public:
+    static constexpr unsigned WINDOW_COUNT = 3;
+    static constexpr unsigned WINDOW_SECONDS[WINDOW_COUNT] = {1, 10, 60};
+
+    // Count packets in the second they arrived (seconds since any fixed point, never going back)
+    void add(uint64_t second, uint64_t packets, uint64_t bytes);
+
+    // Close every second before now, call before reading
+    void advance(uint64_t second);
+
+    // Per second rates of window w over the last completed seconds
+    double packetRate(unsigned w) const { return double(windows[w].packets) / WINDOW_SECONDS[w]; }
+    double byteRate(unsigned w) const { return double(windows[w].bytes) / WINDOW_SECONDS[w]; }
+
+    // Nothing counted in the last minute (and nothing in the current second)
+    bool idle() const { return windows[WINDOW_COUNT - 1].packets == 0 && buckets[current % RING_SIZE].packets == 0; }
+
+private:
+    static constexpr uint64_t RING_SIZE = 64; // > the longest window, the bucket leaving it is still there
+
+    struct Counts {
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+    };
+
+    Counts buckets[RING_SIZE];
+    Counts windows[WINDOW_COUNT];
+    uint64_t current = 0; // second the current bucket counts
+};
+
+// Live view of which processes (and flows) move traffic right now, for -t.
+// Packets are counted as they are handled (a hash lookup and a few adds), the table is only
+// sorted and printed by render on the refresh timer.
+class TopView {
+public:
+    explicit TopView(size_t rows = 20);
+
+    // Count a packet on its pid (-1 for unknown) and flow, scaled by its sample weight
+    void record(const pckt_info* pckt, pid_t pid, std::chrono::steady_clock::time_point now);
+
+    // Name printed next to the pid
+    void setName(pid_t pid, const char* comm);
+
+    // Format the busiest pids and flows by their 10s byte rate into one string, clears the screen first on a terminal.
+    // Also forgets pids and flows idle for a minute
+    std::string render(std::chrono::steady_clock::time_point now, bool clearScreen);
+
+private:
+    static constexpr size_t MAX_FLOWS = 4096; // past this, new flows are only counted on their pid until idle ones go
+
+    struct PidRates {
+        RateWindow rates;
+        std::string comm;
+    };
+
+    struct FlowRates {
+        RateWindow rates;
+        pid_t pid;
+    };
+
+    // Seconds since the view was created, the buckets key
+    uint64_t secondOf(std::chrono::steady_clock::time_point now) const;
+
+    size_t rows;
+    std::chrono::steady_clock::time_point start;
+    std::unordered_map<pid_t, PidRates> pids;
+    std::unordered_map<FlowKey, FlowRates, FlowKeyHash> flows;
+};
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "UnixSocketConfig.h"
+#include <functional>
+#include <vector>
 
 
 // UnixSocketClient handles client-side communication with the daemon.
@@ -16,12 +18,51 @@ public:
     // Connects to the daemon server
     bool connectToServer();
 
-    // Sends a port number to the server
+    // Sends a port number to the server as a bare request (not port 0, that marks a framed request)
     bool sendPort(uint16_t port) const;
 
     // Receives the associated PID for the previously sent port
     bool receivePid(pid_t& pid) const;
 
+    // Pipelined lookup of several ports: every request goes out in one write, then the replies are read in order.
+    // infos[i] is the owner of ports[i] (pid -1 if unknown), with metadata only if asked. False if the connection failed.
+    // Blocks until every reply came, the event loop uses sendPortQueries / receivePortReplies instead
+    bool queryPorts(const std::vector<uint16_t>& ports, bool metadata, std::vector<ProcessInfo>& infos) const;
+
+    // Make the socket non blocking, for the loop (the one shot requests above need it blocking)
+    bool setNonBlocking();
+
+    // Queue a pipelined lookup of ports and write as much of it as the socket takes now, the rest goes out
+    // with flushOutput once the socket is writable. False if the connection failed
+    bool sendPortQueries(const std::vector<uint16_t>& ports, bool metadata);
+
+    // Write queued requests, false if the connection failed
+    bool flushOutput();
+
+    // True while some requests didnt fit in the socket yet (watch it for EPOLLOUT)
+    bool hasPendingOutput() const;
+
+    // Read the replies that arrived so far and append the owner of each to infos (in request order).
+    // Never blocks, false once the daemon disconnected or sent something that isnt a lookup reply
+    bool receivePortReplies(std::vector<ProcessInfo>& infos);
+
+    // Asks for the daemons counters and latency histograms
+    bool requestStats(DaemonStats& stats) const;
+
+    // Asks for the traffic the daemon attributed to each cgroup, most bytes first
+    bool requestCgroupTraffic(std::vector<CgroupTrafficEntry>& entries) const;
+
+    // Asks who held port (0 = every port) over a time range, see MappingHistoryQuery. entries is empty if nobody did
+    bool requestMappingHistory(uint16_t port, const MappingHistoryQuery& range, std::vector<MappingHistoryEntry>& entries) const;
+
+    // Subscribe to the daemons stream of packets annotated with their pid (REQUEST_FLAG_METADATA adds comm).
+    // Waits for the ack, the socket is non blocking from then on and only carries the stream
+    bool subscribePackets(uint16_t flags);
+
+    // Read whatever the daemon streamed so far and call handle for every whole record,
+    // returns false once the daemon disconnected
+    bool receivePackets(const std::function<void(const AnnotatedPacket&)>& handle);
+
     // Closes the socket
     void disconnect();
 
@@ -32,7 +73,15 @@ public:
     bool isServerAlive() const;
 
 private:
+    // Read exactly len bytes (a reply can arrive in pieces)
+    bool receiveAll(void* data, size_t len) const;
+
+    // Write exactly len bytes
+    bool sendAll(const void* data, size_t len) const;
+
     std::string socketPath; // Path to the socket
+    std::string streamBuf;  // streamed bytes or replies not parsed yet (a frame can arrive in pieces)
+    std::string outBuf;     // requests the non blocking socket didnt take yet
     int sockFd;             // File descriptor for the socket
     bool isConnected;       // Tracks connection status
 };
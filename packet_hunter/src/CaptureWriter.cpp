@@ -0,0 +1,147 @@
+#include "CaptureWriter.h"
+#include <fcntl.h>      // open
+#include <unistd.h>     // write, close
+#include <cerrno>
+#include <cstring>      // memcpy, strerror
+#include <iostream>
+
+CaptureWriter::CaptureWriter(const std::string& path, OutputFormat format, size_t rotateBytes, unsigned rotateSeconds)
+    : basePath(path), format(format), rotateBytes(rotateBytes), rotateInterval(rotateSeconds),
+      active(&blocks[0]), flushing(&blocks[1]), stopping(false), failed(false),
+      fd(-1), fileIndex(0), fileBytes(0) {
+    blocks[0].data.resize(BLOCK_SIZE);// allocated once, reused for the whole capture
+    blocks[1].data.resize(BLOCK_SIZE);
+}
+
+// Flushes whatever is left and stops the writer thread
+CaptureWriter::~CaptureWriter() {
+    stop();
+}
+
+// Opens the first capture file and starts the writer thread
+bool CaptureWriter::start() {
+    if (!openNextFile()) return false;
+    writer = std::thread(&CaptureWriter::writerThread, this);
+    return true;
+}
+
+// Flush the remaining records and join the writer thread, false if records were lost
+bool CaptureWriter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    blockReady.notify_one();
+    blockFree.notify_all();
+    if (writer.joinable()) writer.join();
+
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    return !failed;
+}
+
+// Path of the file currently written to
+std::string CaptureWriter::getCurrentPath() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return currentPath;
+}
+
+// Append a record for the packet, formatted outside the lock and copied into the active block
+bool CaptureWriter::writeRecord(pid_t pid, const pckt_info* pckt, const char* comm) {
+    char record[PacketFormatter::MAX_RECORD_SIZE];
+    size_t len = PacketFormatter::formatPacket(record, pid, pckt, format, comm);
+
+    std::unique_lock<std::mutex> lock(mtx);
+    if (failed) return false;
+    if (stopping) return true;
+
+    // Active block is full, hand it to the writer (waits only if the writer is still busy with the other one)
+    if (active->used + len > BLOCK_SIZE) {
+        blockFree.wait(lock, [this] { return flushing->used == 0 || stopping; });
+        if (stopping) return !failed;
+        std::swap(active, flushing);
+        blockReady.notify_one();
+    }
+
+    std::memcpy(active->data.data() + active->used, record, len);
+    active->used += len;
+    return !failed;
+}
+
+// Background thread, writes full blocks and flushes a partial block once a second
+// so a crash loses at most about a second of records
+void CaptureWriter::writerThread() {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    while (true) {
+        blockReady.wait_for(lock, std::chrono::seconds(1), [this] { return flushing->used != 0 || stopping; });
+
+        // Nothing full yet, take the partial active block
+        if (flushing->used == 0 && active->used != 0) {
+            std::swap(active, flushing);
+        }
+        if (flushing->used == 0) {
+            if (stopping) break;// everything written
+            continue;
+        }
+
+        // Write without holding the lock, the capture thread keeps filling the active block
+        Block* toWrite = flushing;
+        lock.unlock();
+        bool written = writeBlock(*toWrite);
+        lock.lock();
+        if (!written) failed = true;// reported by writeRecord and stop, the capture file is incomplete
+
+        toWrite->used = 0;
+        blockFree.notify_one();
+    }
+}
+
+// Write a whole block to the current file, rotating first if the block would cross the limits
+bool CaptureWriter::writeBlock(const Block& block) {
+    bool sizeLimit = rotateBytes && fileBytes && fileBytes + block.used > rotateBytes;
+    bool timeLimit = rotateInterval.count() && std::chrono::steady_clock::now() - fileOpened >= rotateInterval;
+    if ((sizeLimit || timeLimit) && !openNextFile()) return false;
+    if (fd == -1) return false;// a rotation failed before, nowhere to write
+
+    size_t written = 0;
+    while (written < block.used) {
+        ssize_t res = write(fd, block.data.data() + written, block.used - written);
+        if (res < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error: failed to write capture file: " << strerror(errno) << std::endl;
+            return false;
+        }
+        written += res;
+    }
+    fileBytes += written;
+    return true;
+}
+
+// Close the current file and open the next one, the first file uses the given path
+// and rotated files get a .1, .2 ... suffix
+bool CaptureWriter::openNextFile() {
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+        fileIndex++;
+    }
+
+    std::string path = basePath;
+    if (fileIndex) path += "." + std::to_string(fileIndex);
+
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error: failed to open capture file " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    fileBytes = 0;
+    fileOpened = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(mtx);
+    currentPath = path;
+    return true;
+}
@@ -0,0 +1,129 @@
+#include "FlowStore.h"
+
+// Rough cost of one tracked flow, the slot plus the index node and its bucket
+static constexpr size_t FLOW_COST = sizeof(FlowEntry) + sizeof(std::pair<const FlowKey, uint32_t>) + 4 * sizeof(void*);
+
+// The capacity is derived from the memory budget, everything is allocated here and reused
+FlowStore::FlowStore(size_t memoryBudget, std::chrono::seconds idleTimeout)
+    : idleTimeout(idleTimeout), head(NONE), tail(NONE), freeHead(NONE), count(0), evictions(0) {
+
+    size_t capacity = memoryBudget / FLOW_COST;
+    if (capacity < 1) capacity = 1;
+
+    slots.resize(capacity);
+    index.reserve(capacity);
+
+    // Chain all slots in the free list
+    for (uint32_t slot = 0; slot < capacity; slot++) {
+        slots[slot].next = (slot + 1 < capacity) ? slot + 1 : NONE;
+    }
+    freeHead = 0;
+}
+
+// Counts the packet on its flow and marks the flow as recently used
+const FlowEntry* FlowStore::touch(const pckt_info* pckt, std::chrono::steady_clock::time_point now) {
+    auto it = index.find(FlowKey(pckt));
+    if (it == index.end()) return nullptr;
+
+    // A sampled record stands for weight packets
+    uint32_t weight = pckt_weight(pckt);
+    FlowEntry& flow = slots[it->second];
+    flow.packets += weight;
+    flow.bytes += uint64_t(pckt->payload_size) * weight;
+    flow.lastSeen = now;
+
+    PidAggregate& totals = pidAggregates[flow.pid];
+    totals.packets += weight;
+    totals.bytes += uint64_t(pckt->payload_size) * weight;
+
+    // Move to the front of the LRU list
+    if (head != it->second) {
+        unlink(it->second);
+        pushFront(it->second);
+    }
+    return &flow;
+}
+
+// Start tracking a new flow owned by pid, evicts the least recently used flow if full
+void FlowStore::insert(const pckt_info* pckt, pid_t pid, std::chrono::steady_clock::time_point now) {
+    if (index.find(FlowKey(pckt)) != index.end()) return;// already tracked
+
+    if (freeHead == NONE) {
+        release(tail);
+        evictions++;
+    }
+
+    uint32_t slot = freeHead;
+    freeHead = slots[slot].next;
+
+    FlowEntry& flow = slots[slot];
+    flow.info = *pckt;
+    flow.pid = pid;
+    flow.packets = pckt_weight(pckt);
+    flow.bytes = uint64_t(pckt->payload_size) * flow.packets;
+    flow.lastSeen = now;
+    pushFront(slot);
+    index.emplace(FlowKey(pckt), slot);
+    count++;
+
+    PidAggregate& totals = pidAggregates[pid];
+    totals.flows++;
+    totals.packets += flow.packets;
+    totals.bytes += flow.bytes;
+}
+
+// Drop flows that werent seen for longer than the idle timeout, the oldest are at the tail
+size_t FlowStore::evictIdle(std::chrono::steady_clock::time_point now) {
+    size_t dropped = 0;
+    while (tail != NONE && now - slots[tail].lastSeen > idleTimeout) {
+        release(tail);
+        dropped++;
+    }
+    evictions += dropped;
+    return dropped;
+}
+
+// Totals per pid, including flows that were already evicted
+const std::unordered_map<pid_t, PidAggregate>& FlowStore::getPidAggregates() const {
+    return pidAggregates;
+}
+
+size_t FlowStore::size() const {
+    return count;
+}
+
+size_t FlowStore::capacity() const {
+    return slots.size();
+}
+
+uint64_t FlowStore::getEvictions() const {
+    return evictions;
+}
+
+// Unlink a slot from the LRU list
+void FlowStore::unlink(uint32_t slot) {
+    FlowEntry& flow = slots[slot];
+    if (flow.prev != NONE) slots[flow.prev].next = flow.next;
+    else head = flow.next;
+    if (flow.next != NONE) slots[flow.next].prev = flow.prev;
+    else tail = flow.prev;
+}
+
+// Link a slot at the front (most recently used)
+void FlowStore::pushFront(uint32_t slot) {
+    FlowEntry& flow = slots[slot];
+    flow.prev = NONE;
+    flow.next = head;
+    if (head != NONE) slots[head].prev = slot;
+    head = slot;
+    if (tail == NONE) tail = slot;
+}
+
+// Forget the flow in the slot and return the slot to the free list
+void FlowStore::release(uint32_t slot) {
+    unlink(slot);
+    index.erase(FlowKey(&slots[slot].info));
+    slots[slot].next = freeHead;
+    freeHead = slot;
+    count--;
+}
@@ -0,0 +1,173 @@
+#include "HunterOptions.h"
+#include <unistd.h> // getopt
+#include <cstdlib>  // strtoul
+#include <cstring>  // strcmp
+#include <ctime>    // strptime, mktime
+#include <string>
+#include <iostream>
+
+// Print the supported flags
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [-o text|json] [-w file] [-C megabytes] [-G seconds] [-M megabytes] [-I seconds] [-m] [-d] [-S] [-g] [-t] [-n rate] [-H port@time[,time]]\n"
+              << "  -o format    record layout, text (default) or json (one object per line)\n"
+              << "  -w file      stream captured records to file while running (no prompt on exit)\n"
+              << "  -C megabytes rotate the capture file once it reaches this size\n"
+              << "  -G seconds   rotate the capture file every this many seconds\n"
+              << "  -M megabytes memory budget of the flow table (default 16)\n"
+              << "  -I seconds   forget flows idle for this long (default 60)\n"
+              << "  -m           print the owning process name (metadata cached by the daemon), totals per container on exit\n"
+              << "  -d           stream packets from the daemon, already joined with their pid (no kernel subscription)\n"
+              << "  -S           print the daemons latency stats and exit\n"
+              << "  -g           print the daemons traffic per cgroup / container and exit\n"
+              << "  -n rate      sample 1 in rate packets in the kernel, totals are scaled back up (not with -d)\n"
+              << "  -t           top mode: refresh the busiest pids and flows every second (1s/10s/60s rates)\n"
+              << "  -H port@time[,time]  who held port (* for every port) at time, or every change between two times, and exit.\n"
+              << "               time is HH:MM[:SS] today, YYYY-MM-DD HH:MM[:SS] or unix seconds\n";
+}
+
+// Parse a positive number argument, returns false if its not a number
+static bool parseNumber(const char* arg, unsigned long& value) {
+    char* end = nullptr;
+    value = std::strtoul(arg, &end, 10);
+    return end != arg && *end == '\0';
+}
+
+// Parse a local time (HH:MM[:SS] today, YYYY-MM-DD HH:MM[:SS] / YYYY-MM-DDTHH:MM[:SS]) or unix seconds into CLOCK_REALTIME ns
+static bool parseTime(const std::string& text, uint64_t& ns) {
+    unsigned long seconds;
+    if (parseNumber(text.c_str(), seconds)) {
+        ns = uint64_t(seconds) * 1000000000ULL;
+        return true;
+    }
+
+    time_t now = time(nullptr);
+    struct tm when;
+    localtime_r(&now, &when);
+    when.tm_sec = 0;
+    const char* formats[] = {"%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%dT%H:%M", "%H:%M:%S", "%H:%M"};
+    for (const char* format : formats) {
+        struct tm parsed = when;
+        const char* end = strptime(text.c_str(), format, &parsed);
+        if (!end || *end != '\0') continue;
+        parsed.tm_isdst = -1;// let mktime work out daylight saving for that date
+        time_t seconds = mktime(&parsed);
+        if (seconds < 0) return false;
+        ns = uint64_t(seconds) * 1000000000ULL;
+        return true;
+    }
+    return false;
+}
+
+// Parse port@time[,time] of -H
+static bool parseHistoryQuery(const std::string& arg, HunterOptions& options) {
+    std::size_t at = arg.find('@');
+    if (at == std::string::npos) return false;
+
+    std::string port = arg.substr(0, at);
+    unsigned long value = 0;
+    if (port != "*" && (!parseNumber(port.c_str(), value) || value == 0 || value > 65535)) return false;
+    options.historyPort = static_cast<uint16_t>(value);
+
+    std::string times = arg.substr(at + 1);
+    std::size_t comma = times.find(',');
+    if (!parseTime(times.substr(0, comma), options.historyFromNs)) return false;
+    options.historyToNs = options.historyFromNs;
+    if (comma != std::string::npos && !parseTime(times.substr(comma + 1), options.historyToNs)) return false;
+    return options.historyToNs >= options.historyFromNs;
+}
+
+// Parse the command line into options, prints usage and returns false on bad arguments
+bool parseHunterOptions(int argc, char* argv[], HunterOptions& options) {
+    unsigned long value;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:w:C:G:M:I:n:H:mdSgth")) != -1) {
+        switch (opt) {
+        case 'o':
+            if (std::strcmp(optarg, "text") == 0) {
+                options.format = OutputFormat::Text;
+            } else if (std::strcmp(optarg, "json") == 0) {
+                options.format = OutputFormat::Json;
+            } else {
+                printUsage(argv[0]);
+                return false;
+            }
+            break;
+        case 'w':
+            options.capturePath = optarg;
+            break;
+        case 'C':
+            if (!parseNumber(optarg, value)) {
+                printUsage(argv[0]);
+                return false;
+            }
+            options.rotateBytes = value * 1024 * 1024;
+            break;
+        case 'G':
+            if (!parseNumber(optarg, value)) {
+                printUsage(argv[0]);
+                return false;
+            }
+            options.rotateSeconds = static_cast<unsigned>(value);
+            break;
+        case 'M':
+            if (!parseNumber(optarg, value) || value == 0) {
+                printUsage(argv[0]);
+                return false;
+            }
+            options.flowMemory = value * 1024 * 1024;
+            break;
+        case 'I':
+            if (!parseNumber(optarg, value) || value == 0) {
+                printUsage(argv[0]);
+                return false;
+            }
+            options.flowIdleSeconds = static_cast<unsigned>(value);
+            break;
+        case 'n':
+            if (!parseNumber(optarg, value) || value == 0) {
+                printUsage(argv[0]);
+                return false;
+            }
+            options.sampleRate = static_cast<unsigned>(value);
+            break;
+        case 'H':
+            if (!parseHistoryQuery(optarg, options)) {
+                printUsage(argv[0]);
+                return false;
+            }
+            options.printHistory = true;
+            break;
+        case 'm':
+            options.processInfo = true;
+            break;
+        case 'd':
+            options.viaDaemon = true;
+            break;
+        case 'S':
+            options.printStats = true;
+            break;
+        case 'g':
+            options.printCgroups = true;
+            break;
+        case 't':
+            options.topMode = true;
+            break;
+        default:
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+
+    // Rotation only makes sense when streaming to a file
+    if ((options.rotateBytes || options.rotateSeconds) && options.capturePath.empty()) {
+        std::cerr << "Error: -C and -G require a capture file (-w)\n";
+        return false;
+    }
+    // The daemons stream is sampled by the daemons own subscription
+    if (options.sampleRate > 1 && options.viaDaemon) {
+        std::cerr << "Error: -n can't be used with -d\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,167 @@
+#include "PacketFormatter.h"
+#include <unistd.h> // write
+#include <cerrno>
+#include <cstdio> // perror
+
+// Appends a string literal / C string to the cursor
+static inline char* appendStr(char* out, const char* str) {
+    while (*str) *out++ = *str++;
+    return out;
+}
+
+// Appends an unsigned number in decimal
+static inline char* appendUint(char* out, uint32_t value) {
+    char digits[10];
+    int count = 0;
+    do {
+        digits[count++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (count) *out++ = digits[--count];
+    return out;
+}
+
+// Appends a signed number in decimal (pids)
+static inline char* appendInt(char* out, int32_t value) {
+    if (value < 0) {
+        *out++ = '-';
+        return appendUint(out, static_cast<uint32_t>(-static_cast<int64_t>(value)));
+    }
+    return appendUint(out, static_cast<uint32_t>(value));
+}
+
+// Appends a dotted IPv4 address, the ip is in network byte order (first octet is the lowest byte in memory)
+static inline char* appendIpv4(char* out, uint32_t ip) {
+    const unsigned char* octets = reinterpret_cast<const unsigned char*>(&ip);
+    for (int i = 0; i < 4; i++) {
+        if (i) *out++ = '.';
+        out = appendUint(out, octets[i]);
+    }
+    return out;
+}
+
+// Appends a process name as a JSON string body, escaping quotes, backslashes and control chars
+static inline char* appendJsonComm(char* out, const char* comm) {
+    static const char HEX[] = "0123456789abcdef";
+    for (size_t i = 0; comm[i] && i < PacketFormatter::MAX_COMM_LEN; i++) {
+        unsigned char c = comm[i];
+        if (c == '"' || c == '\\') {
+            *out++ = '\\';
+            *out++ = c;
+        } else if (c < 0x20) {
+            out = appendStr(out, "\\u00");
+            *out++ = HEX[c >> 4];
+            *out++ = HEX[c & 0xf];
+        } else {
+            *out++ = c;
+        }
+    }
+    return out;
+}
+
+// Appends a process name for the text layout, non printable chars become '?'
+static inline char* appendTextComm(char* out, const char* comm) {
+    for (size_t i = 0; comm[i] && i < PacketFormatter::MAX_COMM_LEN; i++) {
+        unsigned char c = comm[i];
+        *out++ = (c < 0x20 || c == 0x7f) ? '?' : c;
+    }
+    return out;
+}
+
+// Full protocol name
+static inline const char* protoName(char proto) {
+    return (proto == PROTO_TCP) ? "TCP" :
+           (proto == PROTO_UDP) ? "UDP" : "Other";
+}
+
+namespace PacketFormatter {
+    // Formats the packet record (including the trailing newline) into out, returns the record length
+    size_t formatPacket(char* out, pid_t pid, const pckt_info* pckt, OutputFormat format, const char* comm) {
+        char* cursor = out;
+
+        if (format == OutputFormat::Json) {
+            cursor = appendStr(cursor, "{\"pid\":");
+            cursor = (pid != -1) ? appendInt(cursor, pid) : appendStr(cursor, "null");
+            if (comm && *comm) {
+                cursor = appendStr(cursor, ",\"comm\":\"");
+                cursor = appendJsonComm(cursor, comm);
+                *cursor++ = '"';
+            } else if (comm) {
+                cursor = appendStr(cursor, ",\"comm\":null");// asked for but unknown
+            }
+            cursor = appendStr(cursor, ",\"proto\":\"");
+            cursor = appendStr(cursor, protoName(pckt->proto));
+            cursor = appendStr(cursor, "\",\"src\":\"");
+            cursor = appendIpv4(cursor, pckt->src_ip);
+            cursor = appendStr(cursor, "\",\"sport\":");
+            cursor = appendUint(cursor, pckt->src_port);
+            cursor = appendStr(cursor, ",\"dst\":\"");
+            cursor = appendIpv4(cursor, pckt->dst_ip);
+            cursor = appendStr(cursor, "\",\"dport\":");
+            cursor = appendUint(cursor, pckt->dst_port);
+            cursor = appendStr(cursor, ",\"bytes\":");
+            cursor = appendUint(cursor, pckt->payload_size);
+            if (pckt_weight(pckt) > 1) {// sampled, the record stands for this many packets
+                cursor = appendStr(cursor, ",\"weight\":");
+                cursor = appendUint(cursor, pckt_weight(pckt));
+            }
+            cursor = appendStr(cursor, "}\n");
+        } else {
+            cursor = appendStr(cursor, "PID: ");
+            cursor = (pid != -1) ? appendInt(cursor, pid) : appendStr(cursor, "unknown");
+            if (comm && *comm) {
+                cursor = appendStr(cursor, " (");
+                cursor = appendTextComm(cursor, comm);
+                *cursor++ = ')';
+            }
+            cursor = appendStr(cursor, " | Proto: ");
+            cursor = appendStr(cursor, protoName(pckt->proto));
+            cursor = appendStr(cursor, " | Src: ");
+            cursor = appendIpv4(cursor, pckt->src_ip);
+            *cursor++ = ':';
+            cursor = appendUint(cursor, pckt->src_port);
+            cursor = appendStr(cursor, " → Dst: ");
+            cursor = appendIpv4(cursor, pckt->dst_ip);
+            *cursor++ = ':';
+            cursor = appendUint(cursor, pckt->dst_port);
+            *cursor++ = '\n';
+        }
+
+        return cursor - out;
+    }
+}
+
+BatchedOutput::BatchedOutput(int fd, OutputFormat format, size_t capacity)
+    : fd(fd), format(format), buffer(capacity), used(0), closed(false) {}
+
+// flushes what is left
+BatchedOutput::~BatchedOutput() {
+    flush();
+}
+
+// Format the record straight into the buffer, flushes first if it may not fit
+void BatchedOutput::append(pid_t pid, const pckt_info* pckt, const char* comm) {
+    if (closed) return;
+    if (used + PacketFormatter::MAX_RECORD_SIZE > buffer.size()) flush();
+    used += PacketFormatter::formatPacket(buffer.data() + used, pid, pckt, format, comm);
+}
+
+// Write everything buffered so far in as few writes as possible
+void BatchedOutput::flush() {
+    size_t written = 0;
+    while (written < used) {
+        ssize_t res = write(fd, buffer.data() + written, used - written);
+        if (res < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EPIPE) perror("write");// EPIPE is the reader going away (SIGPIPE is ignored), not an error
+            closed = true;// drop the batch, the caller stops the capture
+            break;
+        }
+        written += res;
+    }
+    used = 0;
+}
+
+bool BatchedOutput::isClosed() const {
+    return closed;
+}
@@ -0,0 +1,134 @@
+#include "PendingResolver.h"
+#include <iostream>
+#include <algorithm> // min
+
+static const ProcessInfo UNKNOWN_OWNER;// reported with metadata when the port didnt resolve
+
+PendingResolver::PendingResolver(EventLoop& loop, UnixSocketClient& client, bool metadata, ReportFunc report, std::function<void()> flushReports)
+    : loop(loop), client(client), metadata(metadata), report(std::move(report)), flushReports(std::move(flushReports)),
+      parked(0), retryTimer(-1), watchingOutput(false) {}
+
+PendingResolver::~PendingResolver() {
+    if (retryTimer != -1) loop.removeTimer(retryTimer);
+}
+
+// Park a packet of a new flow, its port is asked about on the next resolveDue
+void PendingResolver::park(const pckt_info* pckt, std::chrono::steady_clock::time_point now) {
+    auto it = pending.find(pckt->dst_port);
+    if (it == pending.end()) {
+        it = pending.emplace(pckt->dst_port, PendingPort{{}, now, now + DEADLINE, FIRST_RETRY}).first;
+    }
+
+    // Too much waiting, dont let a flood of unknown ports grow memory
+    if (parked >= MAX_PARKED || it->second.packets.size() >= MAX_PARKED_PER_PORT) {
+        report(pckt, -1, nullptr);
+        if (it->second.packets.empty()) pending.erase(it);
+        return;
+    }
+    it->second.packets.push_back(*pckt);
+    parked++;
+    updateTimer();
+}
+
+// Ask the daemon about every due port in one batch, the replies are handled by handleSocketEvents
+bool PendingResolver::resolveDue(std::chrono::steady_clock::time_point now) {
+    if (!inFlight.empty()) return now - sentAt < QUERY_TIMEOUT;// wait for the answers (the retry timer checks on it)
+
+    for (const auto& pair : pending) {
+        if (pair.second.nextQuery <= now) inFlight.push_back(pair.first);
+        if (inFlight.size() == MAX_BATCH_PORTS) break;// the rest go with the next batch
+    }
+    if (inFlight.empty()) return true;
+
+    sentAt = now;
+    if (!client.sendPortQueries(inFlight, metadata)) return false;
+    updateWriteInterest();
+    return true;
+}
+
+// Write what is queued and handle the replies that came
+bool PendingResolver::handleSocketEvents(uint32_t events, std::chrono::steady_clock::time_point now) {
+    if ((events & EPOLLOUT) && !client.flushOutput()) return false;
+    updateWriteInterest();
+
+    bool alive = client.receivePortReplies(replies);
+    if (replies.size() > inFlight.size()) {
+        std::cerr << "Port monitor daemon answered a query that wasnt asked" << std::endl;
+        return false;
+    }
+    if (!inFlight.empty() && replies.size() == inFlight.size()) {
+        applyReplies(now);
+        if (!resolveDue(now)) return false;// ports that came due while waiting
+    }
+    return alive;
+}
+
+// Apply the answers to the batch in flight
+void PendingResolver::applyReplies(std::chrono::steady_clock::time_point now) {
+    std::vector<uint16_t> ports = std::move(inFlight);
+    std::vector<ProcessInfo> infos = std::move(replies);
+    inFlight.clear();
+    replies.clear();
+
+    for (size_t i = 0; i < ports.size(); i++) {
+        auto it = pending.find(ports[i]);
+        if (it == pending.end()) continue;// already reported
+        PendingPort& port = it->second;
+        if (infos[i].pid != -1) {
+            release(ports[i], infos[i].pid, metadata ? &infos[i] : nullptr);
+        } else if (now >= port.deadline) {
+            release(ports[i], -1, metadata ? &UNKNOWN_OWNER : nullptr);// gave up
+        } else {
+            port.nextQuery = now + port.backoff;// the daemon may still be scanning for it
+            port.backoff = std::min<std::chrono::milliseconds>(port.backoff * 2, MAX_RETRY);
+        }
+    }
+    updateTimer();
+}
+
+// Report everything still parked as unknown
+void PendingResolver::flushUnresolved() {
+    while (!pending.empty()) {
+        release(pending.begin()->first, -1, metadata ? &UNKNOWN_OWNER : nullptr);
+    }
+    updateTimer();
+}
+
+size_t PendingResolver::size() const {
+    return parked;
+}
+
+// Report and forget the parked packets of port
+void PendingResolver::release(uint16_t port, pid_t pid, const ProcessInfo* info) {
+    auto it = pending.find(port);
+    if (it == pending.end()) return;
+
+    std::vector<pckt_info> packets = std::move(it->second.packets);
+    pending.erase(it);
+    parked -= packets.size();
+    for (const pckt_info& pckt : packets) report(&pckt, pid, info);
+}
+
+// The retry timer only runs while packets are parked
+void PendingResolver::updateTimer() {
+    if (!pending.empty() && retryTimer == -1) {
+        retryTimer = loop.addTimer(TIMER_INTERVAL, [this]() {
+            if (!resolveDue(std::chrono::steady_clock::now())) {
+                std::cerr << "Port monitor daemon stopped answering" << std::endl;
+                loop.stop();
+            }
+            flushReports();
+        });
+    } else if (pending.empty() && retryTimer != -1) {
+        loop.removeTimer(retryTimer);
+        retryTimer = -1;
+    }
+}
+
+// EPOLLOUT only while requests are queued, otherwise the loop would spin on a writable socket
+void PendingResolver::updateWriteInterest() {
+    bool wanted = client.hasPendingOutput();
+    if (wanted == watchingOutput) return;
+    loop.modifyFd(client.getSocketFd(), EPOLLIN | EPOLLRDHUP | (wanted ? EPOLLOUT : 0));
+    watchingOutput = wanted;
+}
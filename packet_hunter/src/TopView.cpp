@@ -0,0 +1,155 @@
+#include "TopView.h"
+#include <arpa/inet.h> // inet_ntop
+#include <algorithm>   // partial_sort, min
+#include <vector>
+#include <cstdio>      // snprintf
+
+// Count packets in the second they arrived
+void RateWindow::add(uint64_t second, uint64_t packets, uint64_t bytes) {
+    advance(second);
+    Counts& bucket = buckets[current % RING_SIZE];
+    bucket.packets += packets;
+    bucket.bytes += bytes;
+}
+
+// Close every second before now: its bucket joins each window and the one that fell out leaves
+void RateWindow::advance(uint64_t second) {
+    if (second <= current) return;
+
+    // Silent for longer than the ring, every window is empty anyway
+    if (second - current > RING_SIZE) {
+        for (Counts& bucket : buckets) bucket = Counts();
+        for (Counts& window : windows) window = Counts();
+        current = second;
+        return;
+    }
+
+    while (current < second) {
+        const Counts& closed = buckets[current % RING_SIZE];
+        for (unsigned w = 0; w < WINDOW_COUNT; w++) {
+            windows[w].packets += closed.packets;
+            windows[w].bytes += closed.bytes;
+            if (current >= WINDOW_SECONDS[w]) {
+                const Counts& left = buckets[(current - WINDOW_SECONDS[w]) % RING_SIZE];
+                windows[w].packets -= left.packets;
+                windows[w].bytes -= left.bytes;
+            }
+        }
+        current++;
+        buckets[current % RING_SIZE] = Counts();// the oldest second, no window needs it anymore
+    }
+}
+
+TopView::TopView(size_t rows) : rows(rows), start(std::chrono::steady_clock::now()) {}
+
+// Seconds since the view was created
+uint64_t TopView::secondOf(std::chrono::steady_clock::time_point now) const {
+    if (now < start) return 0;
+    return std::chrono::duration_cast<std::chrono::seconds>(now - start).count();
+}
+
+// Count a packet on its pid and flow
+void TopView::record(const pckt_info* pckt, pid_t pid, std::chrono::steady_clock::time_point now) {
+    uint64_t second = secondOf(now);
+    uint64_t packets = pckt_weight(pckt);
+    uint64_t bytes = packets * pckt->payload_size;
+    pids[pid].rates.add(second, packets, bytes);
+
+    FlowKey key(pckt);
+    auto it = flows.find(key);
+    if (it == flows.end()) {
+        if (flows.size() >= MAX_FLOWS) return;
+        it = flows.emplace(key, FlowRates{RateWindow(), pid}).first;
+    }
+    it->second.pid = pid;// an unknown pid may resolve later
+    it->second.rates.add(second, packets, bytes);
+}
+
+// Name printed next to the pid
+void TopView::setName(pid_t pid, const char* comm) {
+    if (comm && *comm) pids[pid].comm = comm;
+}
+
+// Rates in a short readable unit
+static void formatRate(char* out, size_t size, double rate) {
+    if (rate < 1000) snprintf(out, size, "%.0f", rate);
+    else if (rate < 1000 * 1000) snprintf(out, size, "%.1fK", rate / 1000);
+    else if (rate < 1000.0 * 1000 * 1000) snprintf(out, size, "%.1fM", rate / (1000 * 1000));
+    else snprintf(out, size, "%.1fG", rate / (1000.0 * 1000 * 1000));
+}
+
+// The 1s/10s/60s columns of one row
+static void appendRates(std::string& out, const RateWindow& rates) {
+    char cell[32];
+    char line[128];
+    size_t len = 0;
+    for (unsigned w = 0; w < RateWindow::WINDOW_COUNT; w++) {
+        formatRate(cell, sizeof(cell), rates.packetRate(w));
+        len += snprintf(line + len, sizeof(line) - len, "%8s", cell);
+    }
+    for (unsigned w = 0; w < RateWindow::WINDOW_COUNT; w++) {
+        formatRate(cell, sizeof(cell), rates.byteRate(w));
+        len += snprintf(line + len, sizeof(line) - len, "%9s", cell);
+    }
+    out.append(line, len);
+}
+
+// Sort entries of map by their 10s byte rate, keep the busiest
+template <typename Map>
+static std::vector<typename Map::const_iterator> busiest(const Map& map, size_t rows) {
+    std::vector<typename Map::const_iterator> order;
+    order.reserve(map.size());
+    for (auto it = map.begin(); it != map.end(); ++it) order.push_back(it);
+    size_t count = std::min(rows, order.size());
+    std::partial_sort(order.begin(), order.begin() + count, order.end(), [](const auto& a, const auto& b) {
+        return a->second.rates.byteRate(1) > b->second.rates.byteRate(1);
+    });
+    order.resize(count);
+    return order;
+}
+
+// Format the busiest pids and flows, forgets the ones idle for a minute
+std::string TopView::render(std::chrono::steady_clock::time_point now, bool clearScreen) {
+    uint64_t second = secondOf(now);
+    for (auto it = pids.begin(); it != pids.end();) {
+        it->second.rates.advance(second);
+        if (it->second.rates.idle()) it = pids.erase(it);
+        else ++it;
+    }
+    for (auto it = flows.begin(); it != flows.end();) {
+        it->second.rates.advance(second);
+        if (it->second.rates.idle()) it = flows.erase(it);
+        else ++it;
+    }
+
+    std::string out;
+    if (clearScreen) out += "\x1b[H\x1b[2J";// cursor home, clear screen
+    char line[160];
+
+    snprintf(line, sizeof(line), "%zu pids, %zu flows active in the last minute (rates per second over 1s/10s/60s)\n\n", pids.size(), flows.size());
+    out += line;
+    snprintf(line, sizeof(line), "%-8s %-16s%8s%8s%8s%9s%9s%9s\n", "PID", "COMM", "pkt 1s", "10s", "60s", "bytes 1s", "10s", "60s");
+    out += line;
+    for (auto it : busiest(pids, rows)) {
+        snprintf(line, sizeof(line), "%-8d %-16.15s", it->first, it->second.comm.c_str());
+        out += line;
+        appendRates(out, it->second.rates);
+        out += '\n';
+    }
+
+    snprintf(line, sizeof(line), "\n%-8s %-44s%8s%8s%8s%9s%9s%9s\n", "PID", "FLOW", "pkt 1s", "10s", "60s", "bytes 1s", "10s", "60s");
+    out += line;
+    for (auto it : busiest(flows, rows)) {
+        const FlowKey& key = it->first;
+        char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &key.src_ip, src, sizeof(src));
+        inet_ntop(AF_INET, &key.dst_ip, dst, sizeof(dst));
+        char flow[64];
+        snprintf(flow, sizeof(flow), "%s %s:%u > %s:%u", key.proto == PROTO_TCP ? "TCP" : "UDP", src, key.src_port, dst, key.dst_port);
+        snprintf(line, sizeof(line), "%-8d %-44s", it->second.pid, flow);
+        out += line;
+        appendRates(out, it->second.rates);
+        out += '\n';
+    }
+    return out;
+}
@@ -1,4 +1,6 @@
 #include "UnixSocketClient.h"
+#include <cerrno>
+#include <fcntl.h> // O_NONBLOCK
 
 // Ctor inilialize Unix clint socket, and connect to server
 UnixSocketClient::UnixSocketClient()
@@ -27,10 +29,11 @@ bool UnixSocketClient::connectToServer() {
     // Attempt to connect to the server
     if (connect(sockFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {// failed to connect
         perror("connect"); 
-        disconnect();
+        close(sockFd);// not connected yet, so disconnect() wouldnt close it
+        sockFd = -1;
         return false;
     }
-    std::cout << "Connected succeccfully to port monitor daemon"<< std::endl;
+    std::cerr << "Connected succeccfully to port monitor daemon"<< std::endl;// stderr, stdout only carries records
     isConnected = true;
     return true;
 }
@@ -38,8 +41,8 @@ bool UnixSocketClient::connectToServer() {
 // Send a uint16_t port to the daemon server
 bool UnixSocketClient::sendPort(uint16_t port) const {
     if (!isConnected) return false;// check if the socket is connected
+    if (port == FRAMED_REQUEST_MARKER) return false;// a bare 0 would start a framed request, use queryPorts
     
-    std::cout << "Sending PID reqest from port monitor daemon for port: "<< port << std::endl;
     // send raw uint16_t to server, if size sent matchers the size of uint16_t, sent succecfully
     ssize_t bytesSent = send(sockFd, &port, sizeof(port), 0);
     return bytesSent == sizeof(port);
@@ -54,6 +57,241 @@ bool UnixSocketClient::receivePid(pid_t& pid) const {
     return bytesReceived == sizeof(pid);
 }
 
+// Pipelined lookup of several ports, one write for all the requests then the replies in order
+bool UnixSocketClient::queryPorts(const std::vector<uint16_t>& ports, bool metadata, std::vector<ProcessInfo>& infos) const {
+    if (!isConnected) return false;
+    infos.assign(ports.size(), ProcessInfo());
+    if (ports.empty()) return true;
+
+    // Always framed, a bare request cant ask about port 0 (it is the framing marker)
+    std::vector<DaemonRequest> requests(ports.size());
+    for (size_t i = 0; i < ports.size(); i++) {
+        requests[i].type = DaemonRequestType::PidByPort;
+        requests[i].flags = metadata ? REQUEST_FLAG_METADATA : 0;
+        requests[i].port = ports[i];
+    }
+    if (!sendAll(requests.data(), requests.size() * sizeof(DaemonRequest))) return false;
+
+    for (ProcessInfo& info : infos) {
+        DaemonReplyHeader header;
+        if (!receiveAll(&header, sizeof(header)) || header.length != sizeof(info)) return false;
+        if (!receiveAll(&info, sizeof(info))) return false;
+        if (header.status != ReplyStatus::Ok) info.pid = -1;
+    }
+    return true;
+}
+
+// Make the socket non blocking, for the loop
+bool UnixSocketClient::setNonBlocking() {
+    int fdFlags = fcntl(sockFd, F_GETFL, 0);
+    return fdFlags >= 0 && fcntl(sockFd, F_SETFL, fdFlags | O_NONBLOCK) == 0;
+}
+
+// Queue a pipelined lookup of ports, framed like queryPorts, and write what the socket takes now
+bool UnixSocketClient::sendPortQueries(const std::vector<uint16_t>& ports, bool metadata) {
+    if (!isConnected) return false;
+    DaemonRequest request;
+    request.type = DaemonRequestType::PidByPort;
+    request.flags = metadata ? REQUEST_FLAG_METADATA : 0;
+    for (uint16_t port : ports) {
+        request.port = port;
+        outBuf.append(reinterpret_cast<const char*>(&request), sizeof(request));
+    }
+    return flushOutput();
+}
+
+// Write queued requests until the socket is full
+bool UnixSocketClient::flushOutput() {
+    while (!outBuf.empty()) {
+        ssize_t res = send(sockFd, outBuf.data(), outBuf.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (res < 0 && errno == EINTR) continue;
+        if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;// the rest once its writable
+        if (res <= 0) return false;
+        outBuf.erase(0, res);
+    }
+    return true;
+}
+
+bool UnixSocketClient::hasPendingOutput() const {
+    return !outBuf.empty();
+}
+
+// Read the lookup replies that arrived so far, a reply split between reads waits for the rest
+bool UnixSocketClient::receivePortReplies(std::vector<ProcessInfo>& infos) {
+    if (!isConnected) return false;
+
+    char buffer[16 * 1024];
+    bool alive = true;
+    while (true) {
+        ssize_t bytes = recv(sockFd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (bytes > 0) {
+            streamBuf.append(buffer, bytes);
+            continue;
+        }
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) alive = false;// the daemon went away
+        break;
+    }
+
+    size_t offset = 0;
+    DaemonReplyHeader header;
+    ProcessInfo info;
+    while (streamBuf.size() - offset >= sizeof(header)) {
+        std::memcpy(&header, streamBuf.data() + offset, sizeof(header));
+        if (header.type != DaemonRequestType::PidByPort || header.length != sizeof(info)) {
+            std::cerr << "Unexpected reply from the port monitor daemon" << std::endl;
+            return false;
+        }
+        if (streamBuf.size() - offset < sizeof(header) + sizeof(info)) break;
+        std::memcpy(&info, streamBuf.data() + offset + sizeof(header), sizeof(info));// copied out, the buffer isnt aligned for it
+        if (header.status != ReplyStatus::Ok) info.pid = -1;
+        infos.push_back(info);
+        offset += sizeof(header) + sizeof(info);
+    }
+    streamBuf.erase(0, offset);
+    return alive;
+}
+
+// Asks for the daemons counters and latency histograms
+bool UnixSocketClient::requestStats(DaemonStats& stats) const {
+    if (!isConnected) return false;
+
+    DaemonRequest request;
+    request.type = DaemonRequestType::Stats;
+    if (!sendAll(&request, sizeof(request))) return false;
+
+    DaemonReplyHeader header;
+    if (!receiveAll(&header, sizeof(header))) return false;
+    if (header.status != ReplyStatus::Ok || header.length != sizeof(stats)) {
+        std::cerr << "Port monitor daemon doesnt support this stats request" << std::endl;
+        return false;
+    }
+    return receiveAll(&stats, sizeof(stats));
+}
+
+// Asks for the traffic the daemon attributed to each cgroup, most bytes first
+bool UnixSocketClient::requestCgroupTraffic(std::vector<CgroupTrafficEntry>& entries) const {
+    if (!isConnected) return false;
+
+    DaemonRequest request;
+    request.type = DaemonRequestType::CgroupTraffic;
+    if (!sendAll(&request, sizeof(request))) return false;
+
+    DaemonReplyHeader header;
+    if (!receiveAll(&header, sizeof(header))) return false;
+    if (header.status != ReplyStatus::Ok || header.length % sizeof(CgroupTrafficEntry) != 0) {
+        std::cerr << "Port monitor daemon doesnt support the cgroup traffic request" << std::endl;
+        return false;
+    }
+    entries.resize(header.length / sizeof(CgroupTrafficEntry));
+    return receiveAll(entries.data(), header.length);
+}
+
+// Asks who held port over a time range, the request is followed by the range
+bool UnixSocketClient::requestMappingHistory(uint16_t port, const MappingHistoryQuery& range, std::vector<MappingHistoryEntry>& entries) const {
+    if (!isConnected) return false;
+
+    DaemonRequest request;
+    request.type = DaemonRequestType::MappingHistory;
+    request.port = port;
+    if (!sendAll(&request, sizeof(request)) || !sendAll(&range, sizeof(range))) return false;
+
+    DaemonReplyHeader header;
+    if (!receiveAll(&header, sizeof(header))) return false;
+    if ((header.status != ReplyStatus::Ok && header.status != ReplyStatus::NotFound && header.status != ReplyStatus::Truncated) ||
+        header.length % sizeof(MappingHistoryEntry) != 0) {
+        std::cerr << "Port monitor daemon doesnt keep a mapping history" << std::endl;
+        return false;
+    }
+    if (header.status == ReplyStatus::Truncated) {
+        std::cerr << "History too long for one reply, the latest changes are missing (ask for a shorter range)" << std::endl;
+    }
+    entries.resize(header.length / sizeof(MappingHistoryEntry));
+    return receiveAll(entries.data(), header.length);
+}
+
+// Write exactly len bytes
+bool UnixSocketClient::sendAll(const void* data, size_t len) const {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t res = send(sockFd, static_cast<const char*>(data) + sent, len - sent, MSG_NOSIGNAL);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) return false;
+        sent += res;
+    }
+    return true;
+}
+
+// Subscribe to the daemons stream of annotated packets, waits for the ack
+bool UnixSocketClient::subscribePackets(uint16_t flags) {
+    if (!isConnected) return false;
+
+    DaemonRequest request;
+    request.type = DaemonRequestType::SubscribePackets;
+    request.flags = flags;
+    if (send(sockFd, &request, sizeof(request), 0) != sizeof(request)) return false;
+
+    DaemonReplyHeader header;
+    if (!receiveAll(&header, sizeof(header))) return false;
+    if (header.type != DaemonRequestType::SubscribePackets || header.status != ReplyStatus::Ok || header.length != 0) {
+        std::cerr << "Port monitor daemon doesnt support packet streaming" << std::endl;
+        return false;
+    }
+
+    // The stream is read from the event loop
+    return setNonBlocking();
+}
+
+// Read whatever the daemon streamed so far and call handle for every whole record
+bool UnixSocketClient::receivePackets(const std::function<void(const AnnotatedPacket&)>& handle) {
+    if (!isConnected) return false;
+
+    char buffer[64 * 1024];
+    bool alive = true;
+    while (true) {
+        ssize_t bytes = recv(sockFd, buffer, sizeof(buffer), 0);
+        if (bytes > 0) {
+            streamBuf.append(buffer, bytes);
+            if (streamBuf.size() < 1024 * 1024) continue;// parse now and then so the buffer stays small
+        } else if (bytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            alive = false;// the daemon went away
+        } else if (errno == EINTR) {
+            continue;
+        }
+
+        // Hand out every whole frame, a partial one waits for the rest
+        size_t offset = 0;
+        DaemonReplyHeader header;
+        while (streamBuf.size() - offset >= sizeof(header)) {
+            std::memcpy(&header, streamBuf.data() + offset, sizeof(header));
+            if (streamBuf.size() - offset - sizeof(header) < header.length) break;
+            offset += sizeof(header);
+
+            AnnotatedPacket record;// copied out, the buffer isnt aligned for it
+            size_t end = offset + header.length;
+            for (; offset + sizeof(record) <= end; offset += sizeof(record)) {
+                std::memcpy(&record, streamBuf.data() + offset, sizeof(record));
+                handle(record);
+            }
+            offset = end;
+        }
+        streamBuf.erase(0, offset);
+        if (bytes <= 0) return alive;
+    }
+}
+
+// Read exactly len bytes (a reply can arrive in pieces)
+bool UnixSocketClient::receiveAll(void* data, size_t len) const {
+    size_t received = 0;
+    while (received < len) {
+        ssize_t res = recv(sockFd, static_cast<char*>(data) + received, len - received, 0);// blocking call
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) return false;
+        received += res;
+    }
+    return true;
+}
+
 // Disconnect from server, used in destructor
 void UnixSocketClient::disconnect() {
     if (isConnected) {
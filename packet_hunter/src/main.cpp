@@ -1,127 +1,289 @@
 #include "UserSpaceConfig.h"// for useful headers and shared pointers
 #include "UnixSocketClient.h"// for the client
-#include "PidToPacketsInfoMap.h"// for the map
+#include "FlowStore.h"// flows already reported and per pid totals
+#include "CaptureWriter.h"// to stream records to disk while capturing
+#include "HunterOptions.h"// command line options
+#include "PacketFormatter.h"// to print records in batches
+#include "PendingResolver.h"// packets waiting for the daemon to map their port
+#include "TopView.h"// live per pid / flow rates for -t
 #include <fstream> // to Save the map
+#include <iomanip> // stats table
+#include <sstream>
+#include <memory> // for unique_ptr
 #include <vector>
-// To print ip address
-#include <arpa/inet.h>
-#include <netinet/in.h>
+#include <map> // per container summary, sorted by id
+#include <unordered_map>
+#include <cstring> // strnlen
 
 // To find project folder for saving map
 #include <filesystem>
 namespace fs = std::filesystem;
 
-// Format and print the packet information
-void printPacketInfo(const pckt_info* pckt, pid_t pid);
+// Ask user to save the tracked flows and write them to a file (default: hut_karish/packets.log)
+void saveFlowsToFile(const FlowStore& flows, OutputFormat format);
 
-// Ask user to save the packet map and write it to a file (default: hut_karish/packets.log)
-void savePacketMapToFile(const PidToPacketsInfoMap& pidToPcktMap, NetLinkClientRecievePtr client);
+// Print the per pid totals of the whole capture
+void printPidSummary(const FlowStore& flows);
+
+// Print the per pid totals added up per container (pids not in pidContainers are host processes)
+void printContainerSummary(const FlowStore& flows, const std::unordered_map<pid_t, std::string>& pidContainers);
+
+// Print the traffic the daemon attributed to each cgroup
+void printCgroupTable(std::ostream& out, const std::vector<CgroupTrafficEntry>& entries);
+
+// Print the owners of a port over time, from the daemons mapping history
+void printMappingHistory(std::ostream& out, const std::vector<MappingHistoryEntry>& entries);
+
+// Print count, average, percentiles and max of each histogram
+void printLatencyTable(std::ostream& out, const char* const names[], const LatencyHistogramData data[], size_t count);
+
+// Latency the hunter measures itself, from the kernels stamp on the packet
+enum HunterStage { HUNTER_KERNEL_TO_HUNTER, HUNTER_KERNEL_TO_REPORT, HUNTER_STAGE_COUNT };
+static const char* const HUNTER_STAGE_NAMES[HUNTER_STAGE_COUNT] = {"kernel->hunter", "kernel->report"};
 
    
-int main() {
+int main(int argc, char* argv[]) {
     
-    // Capture signals to end the program
-    std::signal(SIGINT, handleSignal); // For Ctrl+C
-    std::signal(SIGTERM, handleSignal);// For terminate (will be sent from main menu script) 
+    HunterOptions options;
+    if (!parseHunterOptions(argc, argv, options)) return -1;
 
-    NetLinkClientPtr netLinkClient = std::make_shared<NetLinkClient>();// Create Netlink client
-    MessageQueuePtr messageQueue = std::make_shared<MessageQueue>();// Create the message queue
-    PidToPacketsInfoMap pidToPcktMap; // Map to store packets by PID
-    UnixSocketClient unixClient; // Create Unix socket client
-    pid_t pid; // Get the pid of the current packet
-    
+    // -S only asks the daemon for its stats
+    if (options.printStats) {
+        UnixSocketClient statsClient;
+        DaemonStats stats;
+        if (!statsClient.requestStats(stats)) return -1;
+        printLatencyTable(std::cout, LATENCY_STAGE_NAMES, stats.latency, LATENCY_STAGE_COUNT);
+        const char* level = stats.overloadLevel < OVERLOAD_LEVEL_COUNT ? OVERLOAD_LEVEL_NAMES[stats.overloadLevel] : "unknown";
+        std::cout << "overload: " << level << ", queue " << stats.queueDepth << " packets, shed " << stats.shedPackets
+                  << ", dropped " << stats.droppedPackets << '\n';
+        return 0;
+    }
 
-    // subscribe to kernel module messages
-    if (!netLinkClient->sendMessage("packet_hunter_subscribe")) {
-        std::cerr << "Failed to send message to kernel\n";
+    // -g only asks the daemon for its traffic per cgroup
+    if (options.printCgroups) {
+        UnixSocketClient cgroupClient;
+        std::vector<CgroupTrafficEntry> entries;
+        if (!cgroupClient.requestCgroupTraffic(entries)) return -1;
+        printCgroupTable(std::cout, entries);
+        return 0;
+    }
+
+    // -H only asks the daemon who held a port at a time (or over a range)
+    if (options.printHistory) {
+        UnixSocketClient historyClient;
+        std::vector<MappingHistoryEntry> entries;
+        MappingHistoryQuery range{options.historyFromNs, options.historyToNs};
+        if (!historyClient.requestMappingHistory(options.historyPort, range, entries)) return -1;
+        if (entries.empty()) {
+            std::cout << "No owner known for that time\n";
+            return 0;
+        }
+        printMappingHistory(std::cout, entries);
+        return 0;
+    }
+
+    // Everything runs on this loop: kernel messages, the daemon connection, timers and signals
+    EventLoop loop;
+    if (!loop.isValid()) return -1;
+
+    // Capture signals to end the program, SIGINT for Ctrl+C and SIGTERM from main menu script
+    // (blocked before the capture writer thread starts, they are read from a signalfd on the loop)
+    loop.watchSignals({SIGINT, SIGTERM}, [&loop](int) { loop.stop(); });
+    signal(SIGPIPE, SIG_IGN);// a closed stdout (| head) fails the write with EPIPE instead of killing us before we unsubscribe
+
+    // With -d the daemon is the only kernel subscriber and streams the packets to us
+    NetLinkClientPtr netLinkClient = options.viaDaemon ? nullptr : std::make_shared<NetLinkClient>();// Create Netlink client
+    FlowStore flows(options.flowMemory, std::chrono::seconds(options.flowIdleSeconds)); // Flows already reported, bounded by the memory budget
+    UnixSocketClient unixClient; // Create Unix socket client
+    BatchedOutput console(STDOUT_FILENO, options.format); // Records are printed in large writes, flushed when the capture goes idle
+    // Print what is buffered, nobody reading stdout anymore ends the capture like Ctrl+C
+    auto flushConsole = [&console, &loop]() {
+        console.flush();
+        if (console.isClosed()) loop.stop();
+    };
+    if (unixClient.getSocketFd() < 0) {
+        std::cerr << "Port monitor daemon is not running\n";
         return -1;
     }
     
-    // Start the receiver thread, std::ref meeded to pass reference to thread 
-    std::thread packetsListener(SharedUserFunctions::recvPacketInfoThread, NetLinkClientRecievePtr(netLinkClient), messageQueue, std::ref(running));
-
-    // Main loop: poll the queue for messages
-    while (running) {
-        
-        const pckt_info* pckt = messageQueue->pop();
-        if (!pckt) {
-            // If queue is empty, wait a bit before checking again (avoid busy looping)
-            std::this_thread::sleep_for(std::chrono::milliseconds(5));
-            // Check if daemon is still alive, if its not, close the packet_hunter
-            if(!unixClient.isServerAlive()) running = false;
-            continue;
+    // With -w records are streamed to disk while capturing instead of being saved on exit
+    std::unique_ptr<CaptureWriter> captureWriter;
+    if (!options.capturePath.empty()) {
+        captureWriter = std::make_unique<CaptureWriter>(options.capturePath, options.format, options.rotateBytes, options.rotateSeconds);
+        if (!captureWriter->start()) return -1;
+        std::cerr << "Streaming captured packets to: " << captureWriter->getCurrentPath() << std::endl;
+    }
+
+
+    // subscribe to kernel module messages, or to the daemons stream
+    if (options.viaDaemon) {
+        if (!unixClient.subscribePackets(options.processInfo ? REQUEST_FLAG_METADATA : 0)) {
+            std::cerr << "Failed to subscribe to the daemon\n";
+            return -1;
         }
-        if(pidToPcktMap.containsPacket(pckt)) continue;// Check if the packet already exists in the map, if so, skip it
-        
-        // Delay a bit to allow daemon to find pid, if the port is new for it
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        
-        //find packets dest pid and insert to map
-        if(!unixClient.sendPort(pckt->dst_port)) break; // Send the packets port to the deamon
-        if(!unixClient.receivePid(pid)) break; // Receive the pid from the deamon
-        
-        printPacketInfo(pckt, pid);
-
-        pidToPcktMap.insertPacketInfo(pid, pckt); // Insert the packet into the map    
-    }
-
-     // Unsubscribe from kernel module messages and join packet listener thread
-     if (!netLinkClient->sendMessage("packet_hunter_unsubscribe")) {
+    } else if (!netLinkClient->sendMessage("packet_hunter_subscribe")) {
         std::cerr << "Failed to send message to kernel\n";
         return -1;
+    } else if (options.sampleRate > 1 && !netLinkClient->sendMessage("packet_hunter_sample " + std::to_string(options.sampleRate))) {
+        std::cerr << "Failed to set the sample rate\n";
+        return -1;
     }
-    packetsListener.join();
- 
-    // Free all stored packets in messages queue
-    SharedUserFunctions::cleanMessageQueue(messageQueue, netLinkClient);
 
-    // Asks the user if he wants to save the captured packets
-    char saveChoice;
-    std::cout << "Do you want to save the packets hunted to a file? (y/n): ";
-    std::cin >> saveChoice;
+    LatencyHistogram latency[HUNTER_STAGE_COUNT];
+    std::unordered_map<pid_t, std::string> pidContainers;// short container id of every containerised pid reported (with -m)
+    std::unique_ptr<TopView> top;// with -t the table replaces the line per flow
+    if (options.topMode) top = std::make_unique<TopView>();
+
+    // Print and record a packet of a new flow, pid is -1 if it couldnt be resolved
+    auto reportPacket = [&](const pckt_info* pckt, pid_t pid, const char* comm, const char* container, std::chrono::steady_clock::time_point now) {
+        latency[HUNTER_KERNEL_TO_REPORT].recordSince(pckt->tstamp_ns, monotonicNs());
+        if (container && *container) pidContainers[pid].assign(container, strnlen(container, CONTAINER_SHORT_ID_LEN - 1));
+        if (top) {
+            top->record(pckt, pid, now);
+            top->setName(pid, comm);
+        } else {
+            console.append(pid, pckt, comm);
+        }
+        // Stream the record to the capture file, a capture that cant be written anymore ends like Ctrl+C
+        if (captureWriter && !captureWriter->writeRecord(pid, pckt, comm)) loop.stop();
+        if (pid != -1) flows.insert(pckt, pid, now); // Track the flow (unknown pids are asked again on the next packet)
+    };
+
+    // Handle a packet from the kernel, returns false if the daemon stopped answering
+    // Packets of new flows wait for the daemon to map their port, asked about in batches (with -m the daemon also sends the owners metadata)
+    PendingResolver resolver(loop, unixClient, options.processInfo,
+        [&](const pckt_info* pckt, pid_t pid, const ProcessInfo* info) {
+            auto now = std::chrono::steady_clock::now();
+            if (const FlowEntry* flow = flows.touch(pckt, now)) {// an earlier packet of the flow was reported already
+                if (top) top->record(pckt, flow->pid, now);
+                return;
+            }
+            reportPacket(pckt, pid, info ? info->comm : nullptr, info ? info->container : nullptr, now);
+        },
+        flushConsole);
+
+    auto handlePacket = [&](const pckt_info* pckt) {
+        auto now = std::chrono::steady_clock::now();
+        latency[HUNTER_KERNEL_TO_HUNTER].recordSince(pckt->tstamp_ns, monotonicNs());
+
+        // Known flow, only count the packet, otherwise wait for the pid of its port
+        if (const FlowEntry* flow = flows.touch(pckt, now)) {
+            if (top) top->record(pckt, flow->pid, now);
+        } else {
+            resolver.park(pckt, now);// the flow store and the resolver keep their own copies
+        }
+    };
+
+    // Handle a packet the daemon streamed, the pid is already attached
+    auto handleRecord = [&](const AnnotatedPacket& record) {
+        auto now = std::chrono::steady_clock::now();
+        latency[HUNTER_KERNEL_TO_HUNTER].recordSince(record.packet.tstamp_ns, monotonicNs());// through the daemon
+        if (flows.touch(&record.packet, now)) {// Known flow, only count the packet
+            if (top) top->record(&record.packet, record.pid, now);
+            return;
+        }
+        reportPacket(&record.packet, record.pid, options.processInfo ? record.comm : nullptr, options.processInfo ? record.container : nullptr, now);
+    };
 
-    if (saveChoice == 'y' || saveChoice == 'Y'){
-        savePacketMapToFile(pidToPcktMap, netLinkClient);
+    if (options.viaDaemon) {
+        // Streamed packets are handled as soon as they arrive, the daemon closing its end stops the capture
+        loop.addFd(unixClient.getSocketFd(), EPOLLIN | EPOLLRDHUP, [&](uint32_t) {
+            bool alive = unixClient.receivePackets(handleRecord);
+            flushConsole();
+            if (!alive) {
+                std::cerr << "Port monitor daemon disconnected" << std::endl;
+                loop.stop();
+            }
+        });
+    } else {
+        // Kernel messages are handled as soon as the socket is readable, the records are printed once it is drained
+        netLinkClient->setNonBlocking();
+        loop.addFd(netLinkClient->getSocketFd(), EPOLLIN, [&](uint32_t) {
+            SharedUserFunctions::drainNetLink(netLinkClient, [&](const pckt_info* records, size_t count) {
+                for (size_t i = 0; i < count; i++) handlePacket(&records[i]);
+                return true;
+            });
+
+            // Ask about every new port of this drain in one batch, answered on the daemon socket
+            if (!resolver.resolveDue(std::chrono::steady_clock::now())) {
+                std::cerr << "Port monitor daemon stopped answering" << std::endl;
+                loop.stop();
+            }
+            flushConsole();
+        });
+
+        // Port lookups are answered here, the daemon closing its end also wakes the loop
+        unixClient.setNonBlocking();
+        loop.addFd(unixClient.getSocketFd(), EPOLLIN | EPOLLRDHUP, [&](uint32_t events) {
+            bool alive = resolver.handleSocketEvents(events, std::chrono::steady_clock::now());
+            flushConsole();
+            if (!alive) {
+                std::cerr << "Port monitor daemon disconnected" << std::endl;
+                loop.stop();
+            }
+        });
     }
-    else{
-        // Free all stored packets in the map
-        for (const auto& pair : pidToPcktMap.getMap()) {
-            for (const pckt_info* pckt : pair.second) {
-                netLinkClient->freePacketInfo(pckt); // Free the allocated memory for the message
+
+    // Forget idle flows once a second, so they are reported again if they come back
+    loop.addTimer(std::chrono::seconds(1), [&flows]() {
+        flows.evictIdle(std::chrono::steady_clock::now());
+    });
+
+    // Redraw the top table once a second, the capture path only bumps counters
+    if (top) {
+        bool terminal = isatty(STDOUT_FILENO);
+        loop.addTimer(std::chrono::seconds(1), [&top, &loop, terminal]() {
+            std::string table = top->render(std::chrono::steady_clock::now(), terminal);
+            if (!terminal) table += '\n';// a log of snapshots when piped
+            if (write(STDOUT_FILENO, table.data(), table.size()) < 0) {
+                if (errno != EPIPE) perror("write");
+                loop.stop();// nobody reads the table anymore
             }
+        });
+    }
+
+    loop.run();// returns on SIGINT/SIGTERM or when the daemon goes away
+
+    // Unsubscribe from kernel module messages (the daemon stream ends with the connection)
+    if (netLinkClient && !netLinkClient->sendMessage("packet_hunter_unsubscribe")) {
+        std::cerr << "Failed to send message to kernel\n";
+    }
+
+    resolver.flushUnresolved();// whatever is still waiting is reported as unknown
+    console.flush();
+    if (captureWriter) {
+        // Records were already streamed, just flush the last block
+        if (captureWriter->stop()) {
+            std::cerr << "Capture saved to: " << captureWriter->getCurrentPath() << std::endl;
+        } else {
+            std::cerr << "Error: capture incomplete, records after " << captureWriter->getCurrentPath() << " were lost" << std::endl;
+        }
+    } else if (isatty(STDIN_FILENO)) {
+        // Asks the user if he wants to save the captured packets
+        char saveChoice;
+        std::cout << "Do you want to save the packets hunted to a file? (y/n): ";
+        std::cin >> saveChoice;
+
+        if (saveChoice == 'y' || saveChoice == 'Y'){
+            saveFlowsToFile(flows, options.format);
         }
     }
-    
-    std::cout << "Packet hunter terminated "<< std::endl;
-    return 0;
-}
+    printPidSummary(flows);
+    if (options.processInfo) printContainerSummary(flows, pidContainers);
 
-// Prints the full packets info of incoming packet
-void printPacketInfo(const pckt_info* pckt, pid_t pid) {
-    struct in_addr src, dst;// to properly print ip address
-    src.s_addr = pckt->src_ip;
-    dst.s_addr = pckt->dst_ip;
-    
-    // Write full protocol name
-    std::string proto;
-    if (pckt->proto == 'T'){
-        proto = "TCP";
-    } 
-    else if (pckt->proto == 'U') {
-        proto = "UDP";
-    }else{
-        proto = "other";
-    }
-
-    if (pid != -1) {
-        std::cout << "PID: " << pid << " | " << "Proto: " << proto << " | "<< "Src: " << inet_ntoa(src) << ":" << pckt->src_port << " → "<< "Dst: " << inet_ntoa(dst) << ":" << pckt->dst_port << std::endl;
-    } else {
-        std::cout << "PID: unknown  | " << "Proto: " << proto << " | "<< "Src: " << inet_ntoa(src) << ":" << pckt->src_port << " → "<< "Dst: " << inet_ntoa(dst) << ":" << pckt->dst_port << std::endl;
+    LatencyHistogramData latencyData[HUNTER_STAGE_COUNT];
+    for (size_t i = 0; i < HUNTER_STAGE_COUNT; i++) latencyData[i] = latency[i].snapshot();
+    if (latencyData[HUNTER_KERNEL_TO_HUNTER].count) {
+        std::cerr << "Latency from the kernel stamp:\n";
+        printLatencyTable(std::cerr, HUNTER_STAGE_NAMES, latencyData, HUNTER_STAGE_COUNT);
     }
+    
+    std::cerr << "Packet hunter terminated "<< std::endl;
+    return 0;
 }
 
-// Ask user to save the packet map and write it to a file (default: hut_karish/packets.log)
-void savePacketMapToFile(const PidToPacketsInfoMap& pidToPcktMap, NetLinkClientRecievePtr client) {
+// Ask user to save the tracked flows and write them to a file (default: hut_karish/packets.log)
+void saveFlowsToFile(const FlowStore& flows, OutputFormat format) {
     // This gives you the actual directory where the binary lives, so save log in project folder
     fs::path exePath = fs::canonical("/proc/self/exe");
     fs::path logPath = exePath.parent_path() // packet_hunter/
@@ -143,27 +305,100 @@ void savePacketMapToFile(const PidToPacketsInfoMap& pidToPcktMap, NetLinkClientR
         return;
     }
 
-    // Write packet data to file
-    for (const auto& pair : pidToPcktMap.getMap()) {
-        pid_t pid = pair.first;
-        for (const pckt_info* pckt : pair.second) {
-            struct in_addr src, dst;
-            src.s_addr = pckt->src_ip;
-            dst.s_addr = pckt->dst_ip;
-            std::string proto = (pckt->proto == 'T') ? "TCP" :
-                                (pckt->proto == 'U') ? "UDP" : "Other";
-
-            out << "PID: " << pid
-                << " | Proto: " << proto
-                << " | Src: " << inet_ntoa(src) << ":" << pckt->src_port
-                << " → Dst: " << inet_ntoa(dst) << ":" << pckt->dst_port
-                << std::endl;
-            
-            client->freePacketInfo(pckt);// Frees packet info using client (the same allocator tha allocate it for safety)
-        }
-        
-    }
+    // Write packet data to file, same layout as the printed records
+    char record[PacketFormatter::MAX_RECORD_SIZE];
+    flows.forEachFlow([&](const FlowEntry& flow) {
+        out.write(record, PacketFormatter::formatPacket(record, flow.pid, &flow.info, format));
+    });
 
     out.close();// Close file
     std::cout << "Saved packet map to: " << path << std::endl;
-}
\ No newline at end of file
+}
+
+// Print the per pid totals of the whole capture (evicted flows included) to stderr
+void printPidSummary(const FlowStore& flows) {
+    const auto& totals = flows.getPidAggregates();
+    if (totals.empty()) return;
+
+    std::cerr << "Traffic per PID (" << flows.size() << " flows tracked, " << flows.getEvictions() << " evicted):\n";
+    for (const auto& pair : totals) {
+        std::cerr << "PID: " << pair.first << " | Flows: " << pair.second.flows
+                  << " | Packets: " << pair.second.packets << " | Bytes: " << pair.second.bytes << "\n";
+    }
+}
+
+// Print the per pid totals added up per container (pids not in pidContainers are host processes)
+void printContainerSummary(const FlowStore& flows, const std::unordered_map<pid_t, std::string>& pidContainers) {
+    if (pidContainers.empty()) return;// nothing containerised was seen
+
+    std::map<std::string, PidAggregate> totals;
+    for (const auto& pair : flows.getPidAggregates()) {
+        auto it = pidContainers.find(pair.first);
+        PidAggregate& container = totals[it == pidContainers.end() ? "host" : it->second];
+        container.flows += pair.second.flows;
+        container.packets += pair.second.packets;
+        container.bytes += pair.second.bytes;
+    }
+
+    std::cerr << "Traffic per container:\n";
+    for (const auto& pair : totals) {
+        std::cerr << "Container: " << pair.first << " | Flows: " << pair.second.flows
+                  << " | Packets: " << pair.second.packets << " | Bytes: " << pair.second.bytes << "\n";
+    }
+}
+
+// Print the traffic the daemon attributed to each cgroup
+void printCgroupTable(std::ostream& out, const std::vector<CgroupTrafficEntry>& entries) {
+    out << std::left << std::setw(14) << "container" << std::setw(12) << "packets" << std::setw(14) << "bytes" << "cgroup\n";
+    for (const CgroupTrafficEntry& entry : entries) {
+        std::string container(entry.container, strnlen(entry.container, CONTAINER_SHORT_ID_LEN - 1));
+        out << std::left << std::setw(14) << (container.empty() ? "-" : container)
+            << std::setw(12) << entry.packets << std::setw(14) << entry.bytes
+            << (entry.cgroup[0] ? entry.cgroup : "(unattributed)") << "\n";
+    }
+}
+
+// Print the owners of a port over time, the mappings in effect at the start come first ("held", with the time they were made)
+void printMappingHistory(std::ostream& out, const std::vector<MappingHistoryEntry>& entries) {
+    static const char* const CHANGE_NAMES[] = {"assign", "reassign", "evict", "held"};
+    out << std::left << std::setw(22) << "time" << std::setw(10) << "change" << std::setw(9) << "port"
+        << std::setw(10) << "pid" << "inode\n";
+    for (const MappingHistoryEntry& entry : entries) {
+        time_t seconds = static_cast<time_t>(entry.timeNs / 1000000000ULL);
+        struct tm local;
+        localtime_r(&seconds, &local);
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &local);
+
+        unsigned change = static_cast<unsigned>(entry.change);
+        std::string port = std::to_string(entry.port) + "/" + (entry.proto ? entry.proto : '?');
+        out << std::left << std::setw(22) << when << std::setw(10) << (change < 4 ? CHANGE_NAMES[change] : "?")
+            << std::setw(9) << port << std::setw(10) << (entry.pid == -1 ? std::string("-") : std::to_string(entry.pid))
+            << (entry.inode ? std::to_string(entry.inode) : std::string("-")) << "\n";
+    }
+}
+
+// Nanoseconds in a short readable unit
+static std::string formatNs(uint64_t ns) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    if (ns < 1000) out << ns << "ns";
+    else if (ns < 1000000) out << ns / 1e3 << "us";
+    else if (ns < 1000000000) out << ns / 1e6 << "ms";
+    else out << ns / 1e9 << "s";
+    return out.str();
+}
+
+// Print count, average, percentiles (bucket upper bounds) and max of each histogram
+void printLatencyTable(std::ostream& out, const char* const names[], const LatencyHistogramData data[], size_t count) {
+    out << std::left << std::setw(18) << "stage" << std::right << std::setw(10) << "count"
+        << std::setw(10) << "avg" << std::setw(10) << "p50" << std::setw(10) << "p90"
+        << std::setw(10) << "p99" << std::setw(10) << "max" << "\n";
+    for (size_t i = 0; i < count; i++) {
+        const LatencyHistogramData& stage = data[i];
+        out << std::left << std::setw(18) << names[i] << std::right << std::setw(10) << stage.count
+            << std::setw(10) << formatNs(stage.averageNs()) << std::setw(10) << formatNs(stage.percentileNs(50))
+            << std::setw(10) << formatNs(stage.percentileNs(90)) << std::setw(10) << formatNs(stage.percentileNs(99))
+            << std::setw(10) << formatNs(stage.maxNs) << "\n";
+    }
+}
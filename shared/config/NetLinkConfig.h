@@ -4,7 +4,8 @@
 
 #ifdef __KERNEL__
 // for kernel space only
-#include <linux/types.h>   // for __u32, __u16
+#include <linux/types.h>   // for __u64, __u32, __u16
+typedef __u64 uint64_t;
 typedef __u32 uint32_t;
 typedef __u16 uint16_t;
 #else
@@ -27,6 +28,21 @@ struct pckt_info {
     uint16_t dst_port;
     uint32_t payload_size;
     char proto; // 'T' or 'U'
+    uint32_t sample_weight; // packets this record stands for (sampling and rate limiting), multiply counts by it
+    uint64_t tstamp_ns; // when the hook saw the packet, CLOCK_MONOTONIC (ktime_get_ns) so user space can compare
+};
+
+// Every message the module sends is a pckt_batch_hdr followed by count records, record_size bytes each.
+// Readers check the version and use record_size to step over fields they dont know yet, so the record can grow.
+// A batch with no records is the stop message sent on unsubscribe.
+// The header is 8 bytes, so records stay 8 byte aligned behind the netlink header.
+// sample_weight took padding that was always zeroed, older records read as weight 1 (pckt_weight), so it kept version 1
+#define PCKT_BATCH_VERSION 1
+struct pckt_batch_hdr {
+    uint16_t version;     // PCKT_BATCH_VERSION of the sender
+    uint16_t count;       // records following the header
+    uint16_t record_size; // sizeof(struct pckt_info) of the sender
+    uint16_t flags;       // none yet, 0
 };
 
 
@@ -38,4 +54,11 @@ struct pckt_info {
 #define NETLINK_USER 31
 #define MAX_PAYLOAD 1024 // maximum payload size
 
+#ifndef __KERNEL__
+// Packets a record stands for, 0 (never sent) is read as 1
+static inline uint32_t pckt_weight(const struct pckt_info* pckt) {
+    return pckt->sample_weight ? pckt->sample_weight : 1;
+}
+#endif
+
 #endif // NETLINK_CONFIG_H
@@ -8,7 +8,152 @@
 #include <unistd.h>// files functions (close, unlink, read, write) 
 #include <cstdint> // for uint16_t
 #include <sys/types.h> // for pid_t
+#include "NetLinkConfig.h" // pckt_info, streamed to subscribers
+#include "LatencyHistogram.h" // latency stats sent to clients
 
 // The stardard location for unix domain sockets used by daemons
 // cleaned on boot if not cleaned by the daemon
-#define SOCKET_FILE_ADRESS "/var/run/hut_karish-daemon.sock"
\ No newline at end of file
+#define SOCKET_FILE_ADRESS "/var/run/hut_karish-daemon.sock"
+
+// Request protocol
+// The original request is a bare uint16_t port answered with a bare pid_t (-1 if unknown), its still supported.
+// A request that starts with port 0 (never a mapped port) is a framed DaemonRequest instead, answered with
+// a DaemonReplyHeader followed by length bytes of payload. So port 0 itself can only be asked about framed
+// (packets to port 0 do reach the hook), clients send every lookup framed.
+
+// Marks a framed request, sent where the old protocol has the port
+constexpr uint16_t FRAMED_REQUEST_MARKER = 0;
+
+enum class DaemonRequestType : uint16_t {
+    RawPidByPort = 0, // the old 2 byte request, the server reports it with this type and answers with a bare pid_t
+    PidByPort = 1,    // ProcessInfo of the port owner (only the pid unless REQUEST_FLAG_METADATA)
+    SubscribePackets = 2, // stream every packet the daemon receives, already annotated with its pid.
+                          // Acked with an empty reply, then each reply of this type carries a batch of AnnotatedPackets
+    Stats = 3,            // DaemonStats
+    CgroupTraffic = 4,    // a CgroupTrafficEntry per cgroup that received packets, most bytes first
+    MappingHistory = 5,   // followed by a MappingHistoryQuery, answered with MappingHistoryEntry records
+};
+
+// Ask for the owners comm, exe, uid and cgroup along with the pid (only comm for SubscribePackets)
+constexpr uint16_t REQUEST_FLAG_METADATA = 1 << 0;
+
+struct DaemonRequest {
+    uint16_t marker = FRAMED_REQUEST_MARKER;
+    DaemonRequestType type = DaemonRequestType::PidByPort;
+    uint16_t flags = 0;
+    uint16_t port = 0;
+};
+
+// Kinds of port mapping changes in the daemons journal
+enum class MappingChange : uint8_t {
+    Assign = 0,   // an unmapped port got an owner
+    Reassign = 1, // another process (or socket) owns the port now
+    Evict = 2,    // the port isnt owned anymore
+    InEffect = 3, // not a change, the mapping that held at the entrys time (start of a queried range)
+};
+
+// Payload of a MappingHistory request, times are CLOCK_REALTIME ns.
+// fromNs == toNs asks who held the port at that instant, otherwise the mapping at fromNs and every change until toNs.
+// The requests port picks the port, 0 for every port
+struct MappingHistoryQuery {
+    uint64_t fromNs;
+    uint64_t toNs;
+};
+
+// One entry of a MappingHistory reply (also the record the journal keeps on disk)
+struct MappingHistoryEntry {
+    uint64_t timeNs; // CLOCK_REALTIME
+    uint64_t inode;  // socket inode, 0 for Evict
+    int32_t pid;     // -1 for Evict
+    uint16_t port;
+    char proto;      // 'T' or 'U'
+    MappingChange change;
+};
+
+// Bytes that follow a framed request of this type
+inline size_t requestPayloadLength(DaemonRequestType type) {
+    return type == DaemonRequestType::MappingHistory ? sizeof(MappingHistoryQuery) : 0;
+}
+
+enum class ReplyStatus : uint16_t {
+    Ok = 0,
+    NotFound = 1,   // no owner known for the port
+    BadRequest = 2, // unknown request type
+    Truncated = 3,  // MappingHistory: more entries than fit in one reply, the latest changes were left out
+};
+
+struct DaemonReplyHeader {
+    DaemonRequestType type;
+    ReplyStatus status;
+    uint32_t length; // payload bytes after the header
+};
+
+constexpr size_t PROCESS_COMM_LEN = 16; // TASK_COMM_LEN
+constexpr size_t PROCESS_PATH_LEN = 256;
+constexpr size_t CONTAINER_ID_LEN = 65;       // 64 hex chars (docker, containerd, cri-o, podman)
+constexpr size_t CONTAINER_SHORT_ID_LEN = 13; // the 12 char prefix docker ps shows
+
+// Owner of a port, strings are nul terminated (and truncated if longer)
+struct ProcessInfo {
+    int32_t pid = -1;
+    uint32_t uid = UINT32_MAX;   // real uid, UINT32_MAX if unknown
+    uint64_t startTime = 0;      // clock ticks since boot, with the pid it identifies the process
+    char comm[PROCESS_COMM_LEN] = {};
+    char exe[PROCESS_PATH_LEN] = {};
+    char cgroup[PROCESS_PATH_LEN] = {}; // cgroup v2 path (or the first hierarchy on v1)
+    char container[CONTAINER_ID_LEN] = {}; // container id found in the cgroup path, empty for host processes
+};
+
+// A packet streamed to subscribers, joined with the pid that owns its destination port
+struct AnnotatedPacket {
+    pckt_info packet;
+    int32_t pid;                  // -1 if the daemon couldnt resolve it in time
+    char comm[PROCESS_COMM_LEN];  // only filled while some subscriber asked for metadata
+    char container[CONTAINER_SHORT_ID_LEN]; // short container id, filled along with comm
+};
+
+// Traffic the daemon attributed to one cgroup, through the pid that owns each packets destination port.
+// The entry with an empty cgroup counts packets whose port wasnt mapped yet (or past the tracked cgroups)
+struct CgroupTrafficEntry {
+    char cgroup[PROCESS_PATH_LEN];
+    char container[CONTAINER_ID_LEN]; // empty for host cgroups
+    uint64_t packets;
+    uint64_t bytes;
+};
+
+// Stages of a packets way through the daemon, each with a latency histogram in DaemonStats.
+// Times are measured from the kernels stamp (pckt_info::tstamp_ns) unless said otherwise
+enum LatencyStage : uint32_t {
+    STAGE_KERNEL_TO_DAEMON, // stamp -> read from netlink by the daemon
+    STAGE_QUEUE_WAIT,       // pushed to the resolver queue -> popped by the resolver
+    STAGE_PORT_SCAN,        // time the resolver spent mapping the port (/proc scan)
+    STAGE_KERNEL_TO_MAPPED, // stamp -> the port mapping was updated (how stale an attribution can be)
+    STAGE_STREAM_DELIVERY,  // stamp -> sent to subscribers, holding for an unmapped port included
+    LATENCY_STAGE_COUNT
+};
+
+inline const char* const LATENCY_STAGE_NAMES[LATENCY_STAGE_COUNT] = {
+    "kernel->daemon", "queue wait", "port scan", "kernel->mapped", "stream delivery"
+};
+
+// How much the daemon sheds while the resolver cant keep up, each stage adds to the ones before
+enum OverloadLevel : uint32_t {
+    OVERLOAD_NORMAL,        // every packet is queued for the resolver
+    OVERLOAD_COALESCE,      // a (protocol, port) is queued once per netlink drain
+    OVERLOAD_SKIP_KNOWN,    // packets of ports that are already mapped arent queued
+    OVERLOAD_KERNEL_SAMPLE, // the kernel module is asked to send 1 in N packets
+    OVERLOAD_LEVEL_COUNT
+};
+
+inline const char* const OVERLOAD_LEVEL_NAMES[OVERLOAD_LEVEL_COUNT] = {
+    "normal", "coalesce", "skip known ports", "kernel sampling"
+};
+
+// Reply to a Stats request
+struct DaemonStats {
+    LatencyHistogramData latency[LATENCY_STAGE_COUNT];
+    uint32_t overloadLevel;  // OverloadLevel
+    uint32_t queueDepth;     // packets waiting for the resolver
+    uint64_t shedPackets;    // not queued for the resolver because of the overload level
+    uint64_t droppedPackets; // not queued because the queue was full
+};
@@ -3,6 +3,7 @@
 // and Unix domain config
 #include "NetLinkClient.h"
 #include "MessageQueue.h"
+#include "EventLoop.h" // epoll reactor both programs run on
 #include <thread>
 #include <csignal> // for end program singnal
 #include <atomic> // for multythread bool (running) 
@@ -13,38 +14,27 @@
 // Shared pointers to share data through threads, safe to use end easier to manage the global vars
 using MessageQueuePtr = std::shared_ptr<MessageQueue>;
 using NetLinkClientPtr = std::shared_ptr<NetLinkClient>;// not const because send messages not const
-using NetLinkClientRecievePtr = std::shared_ptr<const NetLinkClient>;
 
 
-// Tells the threads when to stop
-static std::atomic<bool> running{true};
-// Handle signal from main manu script (use to safely end the program)
-static void handleSignal(int signum){
-    running = false;
-}
-
 // functions shared between packet_hunter and daemon
 namespace SharedUserFunctions{
-    // The thread thall listen and receive messages from the kernel module
-    static void recvPacketInfoThread(NetLinkClientRecievePtr client, MessageQueuePtr messageQueue, std::atomic<bool>& running) {
-        while (running) {
-            const pckt_info* pckt = client->receivePacketInfo();// allocate memory for the packet!!!!!
-            if (pckt) {
-                // If recieved terminate message from kernel module
-                if(!pckt->dst_ip && !pckt->src_ip && !pckt->src_port && !pckt->dst_port) break;
-                messageQueue->push(pckt);
-            }
-        }
-    }
+    // Most packets handled per readable event, so one busy fd cant starve the rest of the loop
+    inline constexpr int MAX_PACKETS_PER_EVENT = 256;
 
-    // Free all remaing packets in the message queue
-    static void cleanMessageQueue(MessageQueuePtr messageQueue, NetLinkClientPtr client){
+    // Called by the event loop when the (non blocking) netlink socket is readable, passes every span of
+    // packets received to handle(const pckt_info* records, size_t count). The records live in the clients
+    // receive buffers until the next read, so copy whatever has to outlive the call. handle returns false to stop reading
+    template <typename Handler>
+    inline void drainNetLink(NetLinkClientPtr client, Handler handle) {
+        int handled = 0;
+        while (handled < MAX_PACKETS_PER_EVENT) {
+            const std::vector<PacketSpan>& spans = client->receivePacketSpans();
+            if (spans.empty()) return;// nothing left (the loop calls again if more is pending)
 
-        while (!messageQueue->empty()){
-            const pckt_info* pckt = messageQueue->pop();
-            if (pckt) {
-                client->freePacketInfo(pckt);// free the allocated memory for the message
+            for (const PacketSpan& span : spans) {
+                if (!handle(span.records, span.count)) return;
+                handled += span.count;
             }
         }
     }
-}
\ No newline at end of file
+}
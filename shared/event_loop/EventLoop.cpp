@@ -0,0 +1,183 @@
+#include "EventLoop.h"
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <signal.h>  // sigset, pthread_sigmask
+#include <unistd.h>  // read, write, close
+#include <cerrno>
+#include <cstdio>    // perror
+
+// Creates the epoll instance and the wakeup eventfd
+EventLoop::EventLoop() : epollFd(-1), wakeFd(-1), signalFd(-1), running(true) {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        perror("epoll_create1");
+        return;
+    }
+
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd < 0) {
+        perror("eventfd");
+        return;
+    }
+    addFd(wakeFd, EPOLLIN, [this](uint32_t) { runPostedTasks(); });
+}
+
+EventLoop::~EventLoop() {
+    // Timers and the signalfd are owned by the loop, other fds belong to the callers
+    for (int timerFd : timerFds) close(timerFd);
+    if (signalFd != -1) close(signalFd);
+    if (wakeFd != -1) close(wakeFd);
+    if (epollFd != -1) close(epollFd);
+}
+
+// False if the epoll instance or the eventfd couldnt be created
+bool EventLoop::isValid() const {
+    return epollFd != -1 && wakeFd != -1;
+}
+
+// Watch fd for events, callback gets the ready events
+bool EventLoop::addFd(int fd, uint32_t events, FdCallback callback) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl add");
+        return false;
+    }
+    handlers[fd] = std::make_shared<FdCallback>(std::move(callback));
+    return true;
+}
+
+// Change the events watched for an fd that was already added
+bool EventLoop::modifyFd(int fd, uint32_t events) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    return epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+// Stop watching fd, the callback object stays alive until its current call returns
+void EventLoop::removeFd(int fd) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    handlers.erase(fd);
+}
+
+// Call callback every interval, the timer id is the timerfd
+int EventLoop::addTimer(std::chrono::milliseconds interval, TimerCallback callback) {
+    int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerFd < 0) {
+        perror("timerfd_create");
+        return -1;
+    }
+
+    itimerspec spec{};
+    spec.it_interval.tv_sec = interval.count() / 1000;
+    spec.it_interval.tv_nsec = (interval.count() % 1000) * 1000000;
+    spec.it_value = spec.it_interval;
+    timerfd_settime(timerFd, 0, &spec, nullptr);
+
+    bool added = addFd(timerFd, EPOLLIN, [timerFd, callback](uint32_t) {
+        uint64_t expirations;
+        if (read(timerFd, &expirations, sizeof(expirations)) > 0) callback();
+    });
+    if (!added) {
+        close(timerFd);
+        return -1;
+    }
+    timerFds.insert(timerFd);
+    return timerFd;
+}
+
+// Stop and close a timer returned by addTimer
+void EventLoop::removeTimer(int timerId) {
+    if (timerFds.erase(timerId) == 0) return;
+    removeFd(timerId);
+    close(timerId);
+}
+
+// Block the signals and deliver them to callback through a signalfd
+bool EventLoop::watchSignals(std::initializer_list<int> signals, SignalCallback callback) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int signum : signals) sigaddset(&mask, signum);
+
+    // Blocked signals stay pending for the signalfd instead of running a handler
+    if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0) return false;
+
+    signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signalFd < 0) {
+        perror("signalfd");
+        return false;
+    }
+
+    return addFd(signalFd, EPOLLIN, [this, callback](uint32_t) {
+        signalfd_siginfo info;
+        while (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+            callback(static_cast<int>(info.ssi_signo));
+        }
+    });
+}
+
+// Run task on the loop thread
+void EventLoop::post(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(tasksMtx);
+        tasks.push_back(std::move(task));
+    }
+    wakeup();
+}
+
+// Dispatch events until stop() is called
+void EventLoop::run() {
+    epoll_event events[64];
+
+    while (running) {
+        int ready = epoll_wait(epollFd, events, 64, -1);// sleeps until something happens
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < ready && running; i++) {
+            auto it = handlers.find(events[i].data.fd);
+            if (it == handlers.end()) continue;// removed by an earlier callback in this batch
+
+            std::shared_ptr<FdCallback> callback = it->second;
+            (*callback)(events[i].events);
+        }
+    }
+}
+
+// Make run() return after the current dispatch
+void EventLoop::stop() {
+    running = false;
+    wakeup();
+}
+
+// False once stop() was called
+bool EventLoop::isRunning() const {
+    return running;
+}
+
+// Wake epoll_wait from another thread
+void EventLoop::wakeup() {
+    uint64_t one = 1;
+    ssize_t res = write(wakeFd, &one, sizeof(one));
+    (void)res;// counter overflow is the only failure, the loop is awake anyway
+}
+
+// Runs on the loop thread when the eventfd fires, executes posted tasks
+void EventLoop::runPostedTasks() {
+    uint64_t count;
+    ssize_t res = read(wakeFd, &count, sizeof(count));
+    (void)res;
+
+    std::vector<Task> pending;
+    {
+        std::lock_guard<std::mutex> lock(tasksMtx);
+        pending.swap(tasks);
+    }
+    for (Task& task : pending) task();
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <initializer_list>
+#include <cstdint>
+#include <sys/epoll.h> // EPOLLIN, EPOLLOUT ... for callers
+
+// Single threaded reactor over epoll, used by the daemon and packet_hunter instead of
+// polling the message queue with sleeps. Fds are registered with a callback that runs on
+// the loop thread once the fd is ready, timers are timerfds, signals arrive through a
+// signalfd and other threads wake the loop through an eventfd (stop() and post()).
+// The thread sleeps in epoll_wait while nothing happens, so an idle loop costs no cpu.
+class EventLoop {
+public:
+    using FdCallback = std::function<void(uint32_t events)>;
+    using TimerCallback = std::function<void()>;
+    using SignalCallback = std::function<void(int signum)>;
+    using Task = std::function<void()>;
+
+    // Creates the epoll instance and the wakeup eventfd
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // False if the epoll instance or the eventfd couldnt be created
+    bool isValid() const;
+
+    // Watch fd for events (EPOLLIN, EPOLLOUT, EPOLLRDHUP...), callback gets the ready events
+    bool addFd(int fd, uint32_t events, FdCallback callback);
+
+    // Change the events watched for an fd that was already added
+    bool modifyFd(int fd, uint32_t events);
+
+    // Stop watching fd (doesnt close it), safe to call from inside a callback
+    void removeFd(int fd);
+
+    // Call callback every interval, returns the timer id (-1 on failure)
+    int addTimer(std::chrono::milliseconds interval, TimerCallback callback);
+
+    // Stop and close a timer returned by addTimer
+    void removeTimer(int timerId);
+
+    // Block the signals for the process and deliver them to callback on the loop thread,
+    // call before starting other threads so they inherit the blocked mask
+    bool watchSignals(std::initializer_list<int> signals, SignalCallback callback);
+
+    // Run task on the loop thread (thread safe)
+    void post(Task task);
+
+    // Dispatch events until stop() is called
+    void run();
+
+    // Make run() return after the current dispatch (thread safe)
+    void stop();
+
+    // False once stop() was called
+    bool isRunning() const;
+
+private:
+    // Wake epoll_wait from another thread
+    void wakeup();
+
+    // Runs on the loop thread when the eventfd fires, executes posted tasks
+    void runPostedTasks();
+
+    int epollFd;
+    int wakeFd;   // eventfd, written by stop() and post()
+    int signalFd; // -1 until watchSignals()
+
+    // shared_ptr so a callback can remove its own fd while running
+    std::unordered_map<int, std::shared_ptr<FdCallback>> handlers;
+    std::unordered_set<int> timerFds; // owned by the loop, closed on destruction
+
+    std::mutex tasksMtx; // protects tasks, the only state touched by other threads
+    std::vector<Task> tasks;
+    std::atomic<bool> running;
+};
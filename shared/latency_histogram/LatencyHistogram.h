@@ -0,0 +1,86 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <time.h> // clock_gettime
+
+// Latency histogram with power of two buckets: bucket 0 holds 0ns, bucket i holds [2^(i-1), 2^i) ns
+// and the last one everything longer (~4.5 minutes and up). Recording is a few relaxed atomic adds,
+// so a stage can record on its own thread while another thread reads a snapshot.
+constexpr size_t LATENCY_BUCKETS = 40;
+
+// Plain copy of a histogram, also the layout sent over the daemon socket
+struct LatencyHistogramData {
+    uint64_t count;
+    uint64_t sumNs;
+    uint64_t maxNs;
+    uint64_t buckets[LATENCY_BUCKETS];
+
+    // Upper bound of the bucket the p-th percentile (0-100) falls in (never above the max), 0 if nothing was recorded
+    uint64_t percentileNs(double p) const {
+        if (count == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(count * p / 100.0);
+        if (rank >= count) rank = count - 1;
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+            seen += buckets[i];
+            if (seen > rank) {
+                uint64_t upperBound = (uint64_t(1) << i) - 1;
+                return (i == LATENCY_BUCKETS - 1 || upperBound > maxNs) ? maxNs : upperBound;
+            }
+        }
+        return maxNs;
+    }
+
+    uint64_t averageNs() const {
+        return count ? sumNs / count : 0;
+    }
+};
+
+// CLOCK_MONOTONIC in nanoseconds, the same clock as the kernel's ktime_get_ns() stamps
+inline uint64_t monotonicNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+class LatencyHistogram {
+public:
+    LatencyHistogram() {
+        for (auto& bucket : buckets) bucket.store(0, std::memory_order_relaxed);
+    }
+
+    void record(uint64_t ns) {
+        size_t bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+        if (bucket >= LATENCY_BUCKETS) bucket = LATENCY_BUCKETS - 1;
+
+        buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sumNs.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t currentMax = maxNs.load(std::memory_order_relaxed);
+        while (ns > currentMax && !maxNs.compare_exchange_weak(currentMax, ns, std::memory_order_relaxed)) {}
+    }
+
+    // Time since a CLOCK_MONOTONIC stamp, stamps from the future (or missing ones) are ignored
+    void recordSince(uint64_t startNs, uint64_t nowNs) {
+        if (startNs == 0 || nowNs < startNs) return;
+        record(nowNs - startNs);
+    }
+
+    // Copy of the counters (not atomic as a whole, fine for monitoring)
+    LatencyHistogramData snapshot() const {
+        LatencyHistogramData data{};
+        data.count = count.load(std::memory_order_relaxed);
+        data.sumNs = sumNs.load(std::memory_order_relaxed);
+        data.maxNs = maxNs.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++) data.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+        return data;
+    }
+
+private:
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sumNs{0};
+    std::atomic<uint64_t> maxNs{0};
+    std::atomic<uint64_t> buckets[LATENCY_BUCKETS];
+};
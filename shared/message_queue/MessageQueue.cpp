@@ -1,20 +1,75 @@
 #include "MessageQueue.h"
+#include "LatencyHistogram.h" // monotonicNs
+#include <algorithm> // min
 
-void MessageQueue::push(const pckt_info* pckt) {
-    std::lock_guard<std::mutex> lock(mtx); // Lock while modifying queue
-    queue.push(pckt);
-}// Automatically unlocks when going out of scope
+MessageQueue::MessageQueue(size_t maxSize) : maxSize(maxSize) {}
 
-const pckt_info* MessageQueue::pop(){
-    std::lock_guard<std::mutex> lock(mtx); // Lock while accessing queue
-    if (queue.empty()) return nullptr;
+bool MessageQueue::push(const pckt_info& pckt) {
+    return pushBatch(&pckt, 1) == 1;
+}
 
-    const pckt_info* pckt = queue.front();
-    queue.pop();
-    return pckt;
+// Add a span of packets under one lock, they share the enqueue time. Whatever doesnt fit is dropped
+size_t MessageQueue::pushBatch(const pckt_info* records, size_t count) {
+    if (count == 0) return 0;
+    uint64_t now = monotonicNs();
+    size_t pushed = 0;
+    {
+        std::lock_guard<std::mutex> lock(mtx); // Lock while modifying queue
+        if (maxSize != 0) count = std::min(count, maxSize - std::min(maxSize, queue.size()));
+        for (; pushed < count; pushed++) queue.push(Entry{records[pushed], now});
+    }// Automatically unlocks when going out of scope
+    if (pushed) notEmpty.notify_one();// a single resolver thread pops them
+    return pushed;
 }
 
 bool MessageQueue::empty() {
     std::lock_guard<std::mutex> lock(mtx);
     return queue.empty();
 }
+
+size_t MessageQueue::size() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return queue.size();
+}
+
+// When the oldest queued packet was pushed, 0 if the queue is empty
+uint64_t MessageQueue::oldestEnqueuedNs() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return queue.empty() ? 0 : queue.front().enqueuedNs;
+}
+
+// Blocks until a packet is available, returns false once the queue was closed
+// (packets still queued are dropped with the queue)
+bool MessageQueue::waitPop(pckt_info& pckt, uint64_t* enqueuedNs) {
+    std::unique_lock<std::mutex> lock(mtx);
+    notEmpty.wait(lock, [this] { return !queue.empty() || closed; });
+    if (closed) return false;
+
+    pckt = queue.front().pckt;
+    if (enqueuedNs) *enqueuedNs = queue.front().enqueuedNs;
+    queue.pop();
+    return true;
+}
+
+// Blocks until a packet is available, then takes up to maxCount of them under one lock
+bool MessageQueue::waitPopBatch(std::vector<Entry>& out, size_t maxCount) {
+    out.clear();
+    std::unique_lock<std::mutex> lock(mtx);
+    notEmpty.wait(lock, [this] { return !queue.empty() || closed; });
+    if (closed) return false;
+
+    while (!queue.empty() && out.size() < maxCount) {
+        out.push_back(queue.front());
+        queue.pop();
+    }
+    return true;
+}
+
+// Wake every thread blocked in waitPop, no more packets will be pushed
+void MessageQueue::close() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+    }
+    notEmpty.notify_all();
+}
@@ -2,16 +2,47 @@
 
 #include <queue>
 #include <mutex>
+#include <condition_variable>
 #include "NetLinkConfig.h"
+#include <cstdint>
+#include <cstddef>
+#include <vector>
 
-// Thread safe queue for pckt_info* packtets, to hold them before find pid and insert to map 
+// Thread safe queue of pckt_info packtets (copies, the netlink buffers are reused), to hold them before find pid and insert to map 
 class MessageQueue {
 public:
-    void push(const pckt_info* pckt);         // Add packet to queue used in recv thread
-    const pckt_info* pop();                  // Pop packet from queue used in main thread)
+    // A packet and the CLOCK_MONOTONIC time it was pushed
+    struct Entry {
+        pckt_info pckt;
+        uint64_t enqueuedNs;
+    };
+
+    // maxSize bounds the queue, packets pushed past it are dropped (0 = unbounded)
+    explicit MessageQueue(size_t maxSize = 0);
+
+    bool push(const pckt_info& pckt);         // Add packet to queue used in recv thread, false if it was full
+    size_t pushBatch(const pckt_info* records, size_t count); // Add a span of packets under one lock, returns how many fit
     bool empty();                      
+    size_t size();
+
+    // When the oldest queued packet was pushed (CLOCK_MONOTONIC), 0 if the queue is empty
+    uint64_t oldestEnqueuedNs();
+
+    // Blocks until a packet is available, returns false once the queue was closed.
+    // enqueuedNs (if given) gets the CLOCK_MONOTONIC time the packet was pushed, to measure the wait
+    bool waitPop(pckt_info& pckt, uint64_t* enqueuedNs = nullptr);
+
+    // Blocks until a packet is available, then moves up to maxCount queued packets into out (cleared first)
+    // under one lock. Returns false once the queue was closed
+    bool waitPopBatch(std::vector<Entry>& out, size_t maxCount);
+
+    // Wake every thread blocked in waitPop, no more packets will be pushed
+    void close();
 
 private:
-    std::queue<const pckt_info*> queue;
+    std::queue<Entry> queue;
+    size_t maxSize;
     std::mutex mtx;                   // Mutex protects access to the queue
+    std::condition_variable notEmpty; // Signals waitPop, so consumers sleep instead of polling
+    bool closed = false;
 };
@@ -2,12 +2,26 @@
 #include <sys/socket.h> // socket, bind
 #include <cstring> // memset, strncpy
 #include <unistd.h> // getpid, close
+#include <fcntl.h> // fcntl, O_NONBLOCK
+#include <cerrno>
 #include <cstdlib> // malloc, free
+#include <cstdint> // uintptr_t
+#include <cstdio> // perror
 #include <iostream>// Printing, debugging
 
 
 // Constructor create socket and bind to this process (src_addr)
-NetLinkClient::NetLinkClient() {
+NetLinkClient::NetLinkClient()
+    : recvBuffers(new uint64_t[RECV_DATAGRAMS * RECV_BUFFER_SIZE / sizeof(uint64_t)]), versionWarned(false) {
+
+    // recvmmsg fills one buffer per datagram, the headers are set up once and reused
+    for (unsigned i = 0; i < RECV_DATAGRAMS; i++) {
+        recvIov[i].iov_base = reinterpret_cast<char*>(recvBuffers.get()) + i * RECV_BUFFER_SIZE;
+        recvIov[i].iov_len = RECV_BUFFER_SIZE;
+        recvMsgs[i].msg_hdr = msghdr{};
+        recvMsgs[i].msg_hdr.msg_iov = &recvIov[i];
+        recvMsgs[i].msg_hdr.msg_iovlen = 1;
+    }
     
     // Create a Netlink socket: nrtlink socket family, raw socket type, NETLINK_USER protocol
     sock_fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_USER);
@@ -89,32 +103,79 @@ bool NetLinkClient::sendMessage(const std::string& msg) {
     return true;
 }
 
-// Receives a reply from the kernel, allocate memory
-const pckt_info* NetLinkClient::receivePacketInfo() const {
-    char buffer[MAX_PAYLOAD];
-    struct nlmsghdr* nlh = reinterpret_cast<struct nlmsghdr*>(buffer);
+// Receives every pending datagram and walks the messages in each of them, the records are read in place
+const std::vector<PacketSpan>& NetLinkClient::receivePacketSpans() {
+    spans.clear();
+    converted.clear();
+    if (sock_fd < 0) return spans;
+
+    // MSG_WAITFORONE: a blocking socket waits for the first datagram only, then takes whatever else is pending
+    int received = recvmmsg(sock_fd, recvMsgs, RECV_DATAGRAMS, MSG_WAITFORONE, nullptr);
+    if (received < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("recvmmsg");// nothing pending isnt an error
+        return spans;
+    }
 
-    int len = recv(sock_fd, nlh, MAX_PAYLOAD, 0);// blocking call
-    if (len < 0) {
-        perror("recv");
-        return nullptr;
+    for (int i = 0; i < received; i++) {
+        if (recvMsgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            std::cerr << "Netlink datagram larger than the receive buffer, dropped" << std::endl;
+            continue;
+        }
+
+        // A datagram can carry several messages, NLMSG_OK stops at a cut or malformed one
+        int len = recvMsgs[i].msg_len;
+        for (nlmsghdr* nlh = static_cast<nlmsghdr*>(recvIov[i].iov_base); NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type == NLMSG_ERROR || nlh->nlmsg_type == NLMSG_NOOP) continue;
+            addBatch(static_cast<const char*>(NLMSG_DATA(nlh)), nlh->nlmsg_len - NLMSG_HDRLEN);
+        }
     }
+    return spans;
+}
 
-    size_t payloadLen = nlh->nlmsg_len - NLMSG_HDRLEN;
-    if (payloadLen != sizeof(pckt_info)) {
-        std::cerr << "Unexpected payload size: " << payloadLen << std::endl;
-        return nullptr;
+// Add the records of one batch message to spans, copies them only if they arent usable in place
+void NetLinkClient::addBatch(const char* payload, size_t payloadLen) {
+    pckt_batch_hdr header;
+    if (payloadLen < sizeof(header)) return;
+    std::memcpy(&header, payload, sizeof(header));
+
+    // A newer module is read too, record_size steps over the fields we dont know
+    if (header.version < 1) {
+        if (!versionWarned) {
+            std::cerr << "Kernel module sends wire version " << header.version << ", expected at least 1" << std::endl;
+            versionWarned = true;
+        }
+        return;
+    }
+    if (header.count == 0) return;// the stop message
+    if (header.record_size < sizeof(pckt_info) || payloadLen - sizeof(header) < size_t(header.count) * header.record_size) {
+        std::cerr << "Malformed packet batch: " << header.count << " records of " << header.record_size << " bytes" << std::endl;
+        return;
     }
 
-    //   This copy is negligible for small packets like pckt_info.
-    //   For large or structured messages, ill need to consider queueing the full Netlink
-    //   buffer and parsing later in the main thread (to make sure this thread returns to listen quickly).  
-    pckt_info* pckt = new pckt_info;
-    std::memcpy(pckt, NLMSG_DATA(nlh), sizeof(pckt_info));
-    return pckt;
+    // Same layout as ours, hand out the records where they are
+    const char* records = payload + sizeof(header);
+    if (header.record_size == sizeof(pckt_info) && reinterpret_cast<uintptr_t>(records) % alignof(pckt_info) == 0) {
+        spans.push_back(PacketSpan{reinterpret_cast<const pckt_info*>(records), header.count});
+        return;
+    }
+
+    // A newer module with a longer record (or an odd offset), copy the fields we know
+    converted.emplace_back(header.count);
+    std::vector<pckt_info>& copies = converted.back();
+    for (size_t i = 0; i < header.count; i++) {
+        std::memcpy(&copies[i], records + i * header.record_size, sizeof(pckt_info));
+    }
+    spans.push_back(PacketSpan{copies.data(), copies.size()});
 }
 
-// Free the packet info structure
-void NetLinkClient::freePacketInfo(const pckt_info* pckt) const {
-    delete pckt;
-}
\ No newline at end of file
+// Socket fd, to watch it in an event loop
+int NetLinkClient::getSocketFd() const {
+    return sock_fd;
+}
+
+// Make receivePacketSpans return nothing instead of blocking when nothing is pending
+bool NetLinkClient::setNonBlocking() {
+    if (sock_fd < 0) return false;
+    int flags = fcntl(sock_fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
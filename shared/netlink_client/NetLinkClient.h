@@ -2,26 +2,56 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <sys/socket.h> // mmsghdr
 #include <linux/netlink.h>
 #include "NetLinkConfig.h"
 
+// A run of consecutive records from one kernel message, points into the clients receive buffers
+struct PacketSpan {
+    const pckt_info* records;
+    size_t count;
+};
+
 // Netlink client for sending/receiving messages with kernel
 class NetLinkClient {
 public:
     NetLinkClient();                            // constructor: create and bind socket
     ~NetLinkClient();                           // destructor: clean up socket
 
+    NetLinkClient(const NetLinkClient&) = delete; // the receive headers point into the object
+    NetLinkClient& operator=(const NetLinkClient&) = delete;
+
     bool sendMessage(const std::string& msg);   // send string to kernel
     
-    // receive packets info from kernel (for now also interpret it, see explenation on the considerations
-    // and alternative packet_hunterroach in the implementaion of this function)
-    const pckt_info* receivePacketInfo() const;  
-    void freePacketInfo(const pckt_info* pckt) const; // free the packet info structure, the same allocator that allocated the memory (extra safety)
+    // Receive every pending datagram (up to RECV_DATAGRAMS in one recvmmsg) and walk all the messages in them.
+    // Each batch becomes a span of records read in place, valid until the next call.
+    // Empty when nothing is pending (non blocking) or only stop messages came
+    const std::vector<PacketSpan>& receivePacketSpans();
     
     // Shutdown netlink client
     void shutDownClient();
 
+    // Socket fd, to watch it in an event loop
+    int getSocketFd() const;
+
+    // Make receivePacketSpans return nothing instead of blocking when nothing is pending
+    bool setNonBlocking();
+
 private:
+    static constexpr unsigned RECV_DATAGRAMS = 16;           // datagrams read per recvmmsg
+    static constexpr size_t RECV_BUFFER_SIZE = 32 * 1024;    // per datagram, the kernel sends far smaller ones
+
+    // Add the records of one batch message to spans, copies them only if they arent usable in place
+    void addBatch(const char* payload, size_t payloadLen);
+
+    std::unique_ptr<uint64_t[]> recvBuffers;      // RECV_DATAGRAMS buffers, uint64_t keeps records aligned
+    iovec recvIov[RECV_DATAGRAMS];
+    mmsghdr recvMsgs[RECV_DATAGRAMS];
+    std::vector<PacketSpan> spans;                // result of the last receivePacketSpans
+    std::vector<std::vector<pckt_info>> converted;// records of a different size or alignment, copied into pckt_info
+    bool versionWarned;                           // warn once about a module with an invalid wire version
+
     int sock_fd;                  // socket file descriptor
     sockaddr_nl src_addr;       // user-space address
     sockaddr_nl dest_addr;      // kernel address
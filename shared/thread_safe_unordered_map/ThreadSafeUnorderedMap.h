@@ -1,47 +1,153 @@
 #pragma once
 #include <unordered_map>
+#include <vector>
+#include <memory>
+#include <optional>
 #include <mutex>
 #include <shared_mutex>
+#include <functional> // std::hash
+#include <cstddef>
+#include <cstdint>
 
-template <typename Key, typename Value>
+// Concurrent hash map split into shards, each one an unordered_map with its own shared_mutex.
+// A key always lives in the same shard, so writers of different keys rarely wait for each other
+// and readers never wait for writers of other shards.
+// Nothing returned points into the map: lookups return copies, and changes that depend on the
+// current value go through compute/upsert, which run under the shard lock.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
 class ThreadSafeUnorderedMap {
 public:
-    
+    static constexpr size_t DEFAULT_SHARDS = 16;
+
+    // shardCount is rounded up to a power of two
+    explicit ThreadSafeUnorderedMap(size_t shardCount = DEFAULT_SHARDS) {
+        size_t count = 1;
+        while (count < shardCount) count <<= 1;
+        shards = std::make_unique<Shard[]>(count);
+        shardMask = count - 1;
+    }
+
+    ThreadSafeUnorderedMap(const ThreadSafeUnorderedMap&) = delete;
+    ThreadSafeUnorderedMap& operator=(const ThreadSafeUnorderedMap&) = delete;
+
     // Inserts or updates a value
     void insertOrAssign(const Key& key, const Value& value) {
-        std::unique_lock<std::shared_mutex> lock(mtx);// Unique lock for changing the map
-        map[key] = value;
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mtx);// Unique lock for changing the shard
+        shard.map[key] = value;
     }
 
-    // Tries to get a value, returns true if found
-    const Value* get(const Key& key) const {
-        std::shared_lock<std::shared_mutex> lock(mtx);
-        if (map.find(key) != map.end()) {
-            return &(map.at(key));
+    // Copy of the value, empty if the key isnt there
+    std::optional<Value> get(const Key& key) const {
+        const Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mtx);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end()) return std::nullopt; // didnt find the key
+        return it->second;
+    }
+
+    bool contains(const Key& key) const {
+        const Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mtx);
+        return shard.map.count(key) != 0;
+    }
+
+    // Change a key based on its current value, under the shard lock.
+    // func gets std::optional<Value>& (empty if the key isnt there), whatever it leaves there is stored
+    // (an empty optional removes the key). Returns the stored value
+    template <typename Func>
+    std::optional<Value> compute(const Key& key, Func func) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mtx);
+
+        auto it = shard.map.find(key);
+        std::optional<Value> value;
+        if (it != shard.map.end()) value = it->second;
+        func(value);
+
+        if (!value) {
+            if (it != shard.map.end()) shard.map.erase(it);
+        } else if (it != shard.map.end()) {
+            it->second = *value;
+        } else {
+            shard.map.emplace(key, *value);
         }
-        return nullptr; // didnt find the key
+        return value;
+    }
+
+    // Insert value if the key isnt there, otherwise call update(Value&) on the stored one. Returns the stored value
+    template <typename Func>
+    Value upsert(const Key& key, const Value& value, Func update) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mtx);
+
+        auto result = shard.map.try_emplace(key, value);
+        if (!result.second) update(result.first->second);
+        return result.first->second;
     }
 
-    // Removes a key
-    void erase(const Key& key) {
-        std::unique_lock<std::shared_mutex> lock(mtx);
-        map.erase(key);
+    // Removes a key, returns false if it wasnt there
+    bool erase(const Key& key) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mtx);
+        return shard.map.erase(key) != 0;
     }
 
-    // Clears the map
+    // Clears the map, shard by shard
     void clear() {
-        std::unique_lock<std::shared_mutex> lock(mtx);// Unique lock for changing the map
-        map.clear();
+        for (size_t i = 0; i <= shardMask; i++) {
+            std::unique_lock<std::shared_mutex> lock(shards[i].mtx);// Unique lock for changing the shard
+            shards[i].map.clear();
+        }
+    }
+
+    // Number of keys (the shards are counted one after the other, so its only exact without writers)
+    size_t size() const {
+        size_t total = 0;
+        for (size_t i = 0; i <= shardMask; i++) {
+            std::shared_lock<std::shared_mutex> lock(shards[i].mtx);
+            total += shards[i].map.size();
+        }
+        return total;
+    }
+
+    // Calls func(const Key&, const Value&) for every key, each shard is seen consistently
+    // (its read lock is held while its keys are visited), func must not use the map
+    template <typename Func>
+    void forEach(Func func) const {
+        for (size_t i = 0; i <= shardMask; i++) {
+            std::shared_lock<std::shared_mutex> lock(shards[i].mtx);
+            for (const auto& pair : shards[i].map) func(pair.first, pair.second);
+        }
     }
 
-    // Returns const ref of the map
-    const std::unordered_map<Key, Value>& getMap() const {
-        std::shared_lock<std::shared_mutex> lock(mtx);
-        return map;
+    // Copy of the whole map, made of consistent per shard copies
+    std::unordered_map<Key, Value, Hash> snapshot() const {
+        std::unordered_map<Key, Value, Hash> copy;
+        forEach([&copy](const Key& key, const Value& value) { copy.emplace(key, value); });
+        return copy;
     }
-    
 
-protected:
-    mutable std::shared_mutex mtx;// mutable allows const methods to lock, shared mutex allows multiple readers
-    std::unordered_map<Key, Value> map;
+    size_t shardCount() const {
+        return shardMask + 1;
+    }
+
+private:
+    // Own cache line per shard, so locking one doesnt slow down its neighbours
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mtx;// mutable allows const methods to lock, shared mutex allows multiple readers
+        std::unordered_map<Key, Value, Hash> map;
+    };
+
+    // The hash of small ints is the int itself, mix it so neighbouring keys spread over the shards
+    size_t shardIndex(const Key& key) const {
+        uint64_t mixed = static_cast<uint64_t>(Hash()(key)) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<size_t>(mixed >> 32) & shardMask;
+    }
+
+    Shard& shardFor(const Key& key) { return shards[shardIndex(key)]; }
+    const Shard& shardFor(const Key& key) const { return shards[shardIndex(key)]; }
+
+    std::unique_ptr<Shard[]> shards;
+    size_t shardMask;
 };